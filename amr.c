@@ -0,0 +1,471 @@
+#include "amr.h"
+#include "helper.h"
+#include "visual.h"
+#include "logger.h"
+
+void read_amr_settings(const Config *config, AmrSettings *settings)
+{
+    char szBuff[MAX_LINE_LENGTH + 100];
+    int amr_ratio;
+    int amr_regrid;
+    int amr_block;
+    int amr_buffer;
+    double amr_threshold;
+    char amr_indicator[16];
+    READ_INT   (config, amr_ratio, OPTIONAL);
+    READ_INT   (config, amr_regrid, OPTIONAL);
+    READ_INT   (config, amr_block, OPTIONAL);
+    READ_INT   (config, amr_buffer, OPTIONAL);
+    READ_DOUBLE(config, amr_threshold, OPTIONAL);
+    READ_STRING(config, amr_indicator, OPTIONAL);
+    settings->ratio = (amr_ratio > 0) ? amr_ratio : 2;
+    settings->regrid = (amr_regrid > 0) ? amr_regrid : 20;
+    settings->block = (amr_block > 0) ? amr_block : 8;
+    settings->buffer = (amr_buffer > 0) ? amr_buffer : 8;
+    settings->threshold = (amr_threshold > 0) ? amr_threshold : 0.1;
+    if (strcmp(amr_indicator, "NULLSTRING") == 0 || strcmp(amr_indicator, "NONE") == 0)
+        settings->indicator = AMR_INDICATOR_NONE;
+    else if (strcmp(amr_indicator, "VORTICITY") == 0)
+        settings->indicator = AMR_INDICATOR_VORTICITY;
+    else if (strcmp(amr_indicator, "GRADIENT") == 0)
+        settings->indicator = AMR_INDICATOR_GRADIENT;
+    else
+        ERROR("amr_indicator must be NONE, VORTICITY or GRADIENT");
+
+    const char *next = NULL;
+    char *value;
+    settings->numRegions = 0;
+    while ((value = find_next_string(config, "refine", &next)) != NULL)
+    {
+        double *region = settings->regions[settings->numRegions];
+        if (settings->numRegions == AMR_MAX_REGIONS)
+        {
+            snprintf(szBuff, sizeof(szBuff), "%s: more than %d refine regions", config->name, AMR_MAX_REGIONS);
+            ERROR(szBuff);
+        }
+        if (sscanf(value, "%lf %lf %lf %lf", region, region + 1, region + 2, region + 3) != 4
+            || region[0] >= region[2] || region[1] >= region[3])
+        {
+            snprintf(szBuff, sizeof(szBuff), "%s: refine needs X0 Y0 X1 Y1 with X0 < X1 and Y0 < Y1", config->name);
+            ERROR(szBuff);
+        }
+        logMsg("File: %s\t\trefine         = %g %g %g %g", config->name, region[0], region[1], region[2], region[3]);
+        settings->numRegions++;
+    }
+}
+
+int amr_enabled(const AmrSettings *settings)
+{
+    return settings->numRegions > 0 || settings->indicator != AMR_INDICATOR_NONE;
+}
+
+// Indicator of the coarse cell (i, j), 0 for obstacles
+static double indicator(const Simulation *base, AmrIndicator kind, int i, int j)
+{
+    flag **Flags = base->Flags;
+    real **U = base->U, **V = base->V;
+    double dx = base->parameters.dx, dy = base->parameters.dy;
+    if (isObstacle(Flags[i][j]))
+        return 0;
+    if (kind == AMR_INDICATOR_VORTICITY)
+    {
+        // at the centre, from the velocities of the four faces around it and their neighbours
+        double dUdy = (U[i][j + 1] + U[i - 1][j + 1] - U[i][j - 1] - U[i - 1][j - 1]) / (4 * dy);
+        double dVdx = (V[i + 1][j] + V[i + 1][j - 1] - V[i - 1][j] - V[i - 1][j - 1]) / (4 * dx);
+        return fabs(dUdy - dVdx);
+    }
+    // speed at the centres of the cell and its neighbours
+    double speed[3][3];
+    for (int a = -1; a <= 1; a++)
+    {
+        for (int b = -1; b <= 1; b++)
+        {
+            double u = 0.5 * (U[i + a][j + b] + U[i + a - 1][j + b]);
+            double v = 0.5 * (V[i + a][j + b] + V[i + a][j + b - 1]);
+            speed[a + 1][b + 1] = sqrt(u * u + v * v);
+        }
+    }
+    double dsdx = (speed[2][1] - speed[0][1]) / (2 * dx);
+    double dsdy = (speed[1][2] - speed[1][0]) / (2 * dy);
+    return sqrt(dsdx * dsdx + dsdy * dsdy);
+}
+
+// Patches of the coarse cells to refine: the regions and the indicator cells, clustered in blocks (see amr.h)
+static int choosePatches(const Amr *amr, Patch *patches)
+{
+    const AmrSettings *s = &amr->settings;
+    const Parameters *p = &amr->base->parameters;
+    int imax = p->imax, jmax = p->jmax, B = s->block;
+    int bimax = (imax + B - 1) / B, bjmax = (jmax + B - 1) / B;
+    int **blocks = imatrix(0, bimax - 1, 0, bjmax - 1);
+    init_imatrix(blocks, 0, bimax - 1, 0, bjmax - 1, 0);
+
+    double largest = 0;
+    if (s->indicator != AMR_INDICATOR_NONE)
+    {
+        for (int i = 1; i <= imax; i++)
+            for (int j = 1; j <= jmax; j++)
+                largest = fmax(largest, indicator(amr->base, s->indicator, i, j));
+    }
+    for (int i = 1; i <= imax; i++)
+    {
+        for (int j = 1; j <= jmax; j++)
+        {
+            double x = (i - 0.5) * p->dx, y = (j - 0.5) * p->dy;
+            int refine = largest > 0 && indicator(amr->base, s->indicator, i, j) >= s->threshold * largest;
+            for (int r = 0; r < s->numRegions && !refine; r++)
+            {
+                const double *region = s->regions[r];
+                refine = x >= region[0] && x <= region[2] && y >= region[1] && y <= region[3];
+            }
+            if (refine)
+                blocks[(i - 1) / B][(j - 1) / B] = 1;
+        }
+    }
+
+    // runs of flagged blocks along i, merged with the run of the same extent right below
+    int numPatches = 0;
+    for (int bj = 0; bj < bjmax; bj++)
+    {
+        for (int bi = 0; bi < bimax; bi++)
+        {
+            if (!blocks[bi][bj])
+                continue;
+            int bend = bi;
+            while (bend + 1 < bimax && blocks[bend + 1][bj])
+                bend++;
+            int ilo = bi * B + 1, ihi = min((bend + 1) * B, imax);
+            int jlo = bj * B + 1, jhi = min((bj + 1) * B, jmax);
+            int merged = 0;
+            for (int k = 0; k < numPatches && !merged; k++)
+            {
+                Patch *below = patches + k;
+                if (below->ilo == ilo && below->ihi == ihi && below->jhi == jlo - 1)
+                {
+                    below->jhi = jhi;
+                    merged = 1;
+                }
+            }
+            if (!merged)
+            {
+                if (numPatches == AMR_MAX_PATCHES)
+                    ERROR("More than AMR_MAX_PATCHES patches, raise amr_block or amr_threshold");
+                patches[numPatches].ilo = ilo;
+                patches[numPatches].ihi = ihi;
+                patches[numPatches].jlo = jlo;
+                patches[numPatches].jhi = jhi;
+                patches[numPatches].sim = NULL;
+                numPatches++;
+            }
+            bi = bend;
+        }
+    }
+    free_imatrix(blocks, 0, bimax - 1, 0, bjmax - 1);
+    return numPatches;
+}
+
+// Fine grid of the patch, its fields from the base grid, then from the old patches where they overlap it
+static void createPatch(Amr *amr, Patch *patch, int number, const Patch *old, int numOld)
+{
+    const Simulation *base = amr->base;
+    const Parameters *p = &base->parameters;
+    int r = amr->settings.ratio;
+    Parameters q = *p;
+    q.imax = r * (patch->ihi - patch->ilo + 1);
+    q.jmax = r * (patch->jhi - patch->jlo + 1);
+    q.xlength = (patch->ihi - patch->ilo + 1) * p->dx;
+    q.ylength = (patch->jhi - patch->jlo + 1) * p->dy;
+    q.tau = -1;   // dt is set by amr_step()
+    // the name of the base grid shortened so that the suffix always fits, the patches must not share a name
+    char suffix[32];
+    snprintf(suffix, sizeof(suffix), "_patch%d", number);
+    int prefix = (int) (sizeof(q.problem) - strlen(suffix) - 1);
+    int length = snprintf(q.problem, sizeof(q.problem), "%.*s%s", prefix, p->problem, suffix);
+    if (length < 0 || length >= (int) sizeof(q.problem))
+        ERROR("The name of an AMR patch does not fit into the problem name");
+    SolverOptions options = base->options;
+    options.tileAutotune = 0;
+    options.gridLevels = 0;
+    options.steadyTolerance = 0;
+
+    int i0 = r * (patch->ilo - 1), j0 = r * (patch->jlo - 1);   // first fine cell, 0 based
+    int **pic = imatrix(0, q.imax - 1, 0, q.jmax - 1);
+    for (int i = 0; i < q.imax; i++)
+        for (int j = 0; j < q.jmax; j++)
+            pic[i][j] = amr->geometry[i0 + i][j0 + j];
+    Simulation *sim = simulation_create_bitmap(&q, &options, pic);
+    free_imatrix(pic, 0, q.imax - 1, 0, q.jmax - 1);
+    simulation_set_output(sim, 0);
+    sim->t = base->t;
+    sim->boundaryU = matrix(0, q.imax + 1, 0, q.jmax + 1);
+    sim->boundaryV = matrix(0, q.imax + 1, 0, q.jmax + 1);
+    init_matrix(sim->boundaryU, 0, q.imax + 1, 0, q.jmax + 1, 0);
+    init_matrix(sim->boundaryV, 0, q.imax + 1, 0, q.jmax + 1, 0);
+    sim->boundarySides = ((patch->ilo > 1) << LEFT) | ((patch->ihi < p->imax) << RIGHT)
+                         | ((patch->jlo > 1) << BOT) | ((patch->jhi < p->jmax) << TOP);
+    simulation_prolongate(sim, base, (patch->ilo - 1) * p->dx, (patch->jlo - 1) * p->dy);
+
+    // the same fine cells in an old patch, interior cells and faces only
+    for (int k = 0; k < numOld; k++)
+    {
+        const Simulation *o = old[k].sim;
+        int k0 = r * (old[k].ilo - 1), l0 = r * (old[k].jlo - 1);
+        for (int i = 1; i <= q.imax; i++)
+        {
+            for (int j = 1; j <= q.jmax; j++)
+            {
+                int oi = i0 + i - k0, oj = j0 + j - l0;
+                if (oi < 1 || oi > o->parameters.imax || oj < 1 || oj > o->parameters.jmax)
+                    continue;
+                if (oi < o->parameters.imax)
+                    sim->U[i][j] = o->U[oi][oj];
+                if (oj < o->parameters.jmax)
+                    sim->V[i][j] = o->V[oi][oj];
+                sim->P[i][j] = o->P[oi][oj];
+                sim->T[i][j] = o->T[oi][oj];
+            }
+        }
+    }
+    patch->sim = sim;
+}
+
+static void destroyPatch(Patch *patch)
+{
+    Simulation *sim = patch->sim;
+    int imax = sim->parameters.imax, jmax = sim->parameters.jmax;
+    free_matrix(sim->boundaryU, 0, imax + 1, 0, jmax + 1);
+    free_matrix(sim->boundaryV, 0, imax + 1, 0, jmax + 1);
+    simulation_destroy(sim);
+    patch->sim = NULL;
+}
+
+static void logPatches(const Amr *amr)
+{
+    for (int k = 0; k < amr->numPatches; k++)
+    {
+        const Patch *patch = amr->patches + k;
+        logMsg("AMR: patch %d over the coarse cells %d..%d x %d..%d, %d x %d cells", k, patch->ilo, patch->ihi,
+               patch->jlo, patch->jhi, patch->sim->parameters.imax, patch->sim->parameters.jmax);
+    }
+    const Parameters *p = &amr->base->parameters;
+    int r = amr->settings.ratio;
+    logMsg("AMR: %d patches, %d cells instead of %d of the uniform fine grid", amr->numPatches, amr_cells(amr),
+           r * r * p->imax * p->jmax);
+}
+
+// New patches if the flagged blocks have changed
+static void regrid(Amr *amr)
+{
+    Patch patches[AMR_MAX_PATCHES];
+    int numPatches = choosePatches(amr, patches);
+    int same = numPatches == amr->numPatches;
+    for (int k = 0; k < numPatches && same; k++)
+    {
+        const Patch *a = patches + k, *b = amr->patches + k;
+        same = a->ilo == b->ilo && a->ihi == b->ihi && a->jlo == b->jlo && a->jhi == b->jhi;
+    }
+    if (same)
+        return;
+    for (int k = 0; k < numPatches; k++)
+        createPatch(amr, patches + k, k, amr->patches, amr->numPatches);
+    for (int k = 0; k < amr->numPatches; k++)
+        destroyPatch(amr->patches + k);
+    memcpy(amr->patches, patches, numPatches * sizeof(Patch));
+    amr->numPatches = numPatches;
+    logEvent(amr->base->t, "INFO: AMR regrid");
+    logPatches(amr);
+}
+
+Amr *amr_create(Simulation *base, const AmrSettings *settings)
+{
+    const Parameters *p = &base->parameters;
+    Amr *amr = (Amr *) malloc(sizeof(Amr));
+    if (amr == NULL)
+        ERROR("Out of memory for the AMR patches");
+    amr->settings = *settings;
+    amr->base = base;
+    int r = settings->ratio;
+    amr->geometry = load_geometry(p->geometry, r * p->imax, r * p->jmax, p->xlength, p->ylength,
+                                  base->options.geometryResampling);
+    amr->Uold = matrix(0, p->imax + 1, 0, p->jmax + 1);
+    amr->Vold = matrix(0, p->imax + 1, 0, p->jmax + 1);
+    amr->numPatches = 0;
+    amr->steps = 0;
+    regrid(amr);
+    return amr;
+}
+
+// Base velocities at the boundary faces and cells of the patch, the fraction theta of the base step on
+static void fillPatchBoundary(const Amr *amr, const Patch *patch, double theta)
+{
+    const Simulation *base = amr->base;
+    const Parameters *c = &base->parameters;
+    Simulation *sim = patch->sim;
+    int imax = sim->parameters.imax, jmax = sim->parameters.jmax;
+    double dx = sim->parameters.dx, dy = sim->parameters.dy;
+    double x0 = (patch->ilo - 1) * c->dx, y0 = (patch->jlo - 1) * c->dy;
+    for (int i = 0; i <= imax + 1; i++)
+    {
+        for (int j = 0; j <= jmax + 1; j++)
+        {
+            if (i > 0 && i < imax && j > 0 && j <= jmax)
+                continue;   // only the ring and the faces on the sides are read by setPatchBoundary()
+            double x = x0 + i * dx, y = y0 + (j - 0.5) * dy;
+            sim->boundaryU[i][j] = (1 - theta) * interpolate_bilinear(amr->Uold, c->imax, c->jmax, 0, -0.5 * c->dy,
+                                                                      c->dx, c->dy, x, y)
+                                   + theta * interpolate_bilinear(base->U, c->imax, c->jmax, 0, -0.5 * c->dy,
+                                                                  c->dx, c->dy, x, y);
+        }
+    }
+    for (int i = 0; i <= imax + 1; i++)
+    {
+        for (int j = 0; j <= jmax + 1; j++)
+        {
+            if (i > 0 && i <= imax && j > 0 && j < jmax)
+                continue;
+            double x = x0 + (i - 0.5) * dx, y = y0 + j * dy;
+            sim->boundaryV[i][j] = (1 - theta) * interpolate_bilinear(amr->Vold, c->imax, c->jmax, -0.5 * c->dx, 0,
+                                                                      c->dx, c->dy, x, y)
+                                   + theta * interpolate_bilinear(base->V, c->imax, c->jmax, -0.5 * c->dx, 0,
+                                                                  c->dx, c->dy, x, y);
+        }
+    }
+}
+
+// Averages the fine velocities of the patch onto the coarse faces it covers (T onto the cells), except in the
+// buffer along its sides inside the domain: the coarse cells there keep their own solution, so that the coarse
+// velocities the patch boundary comes from are those of the coarse equations and not of the restricted fine ones
+static void restrictPatch(Amr *amr, const Patch *patch)
+{
+    Simulation *base = amr->base;
+    const Simulation *sim = patch->sim;
+    flag **Flags = base->Flags;
+    int imax = base->parameters.imax, jmax = base->parameters.jmax;
+    int r = amr->settings.ratio, b = amr->settings.buffer, sides = sim->boundarySides;
+    int ilo = patch->ilo + ((sides & (1 << LEFT)) ? b : 0), ihi = patch->ihi - ((sides & (1 << RIGHT)) ? b : 0);
+    int jlo = patch->jlo + ((sides & (1 << BOT)) ? b : 0), jhi = patch->jhi - ((sides & (1 << TOP)) ? b : 0);
+
+    // the faces of the restricted cells, which keep the (zero) divergence of the fine ones
+    for (int I = max(ilo - 1, 1); I <= min(ihi, imax - 1); I++)
+    {
+        for (int J = jlo; J <= jhi; J++)
+        {
+            if (isObstacle(Flags[I][J]) || isObstacle(Flags[I + 1][J]))
+                continue;
+            int i = r * (I - patch->ilo + 1), j0 = r * (J - patch->jlo);
+            double u = 0;
+            for (int k = 1; k <= r; k++)
+                u += sim->U[i][j0 + k];
+            base->U[I][J] = (real) (u / r);
+        }
+    }
+    for (int I = ilo; I <= ihi; I++)
+    {
+        for (int J = max(jlo - 1, 1); J <= min(jhi, jmax - 1); J++)
+        {
+            if (isObstacle(Flags[I][J]) || isObstacle(Flags[I][J + 1]))
+                continue;
+            int i0 = r * (I - patch->ilo), j = r * (J - patch->jlo + 1);
+            double v = 0;
+            for (int k = 1; k <= r; k++)
+                v += sim->V[i0 + k][j];
+            base->V[I][J] = (real) (v / r);
+        }
+    }
+    for (int I = ilo; I <= ihi; I++)
+    {
+        for (int J = jlo; J <= jhi; J++)
+        {
+            if (isObstacle(Flags[I][J]))
+                continue;
+            int i0 = r * (I - patch->ilo), j0 = r * (J - patch->jlo);
+            double T = 0;
+            for (int k = 1; k <= r; k++)
+                for (int l = 1; l <= r; l++)
+                    T += sim->T[i0 + k][j0 + l];
+            base->T[I][J] = (real) (T / (r * r));
+        }
+    }
+}
+
+void amr_step(Amr *amr)
+{
+    Simulation *base = amr->base;
+    const Parameters *p = &base->parameters;
+    int imax = p->imax, jmax = p->jmax;
+    for (int i = 0; i <= imax + 1; i++)
+    {
+        memcpy(amr->Uold[i], base->U[i], (jmax + 2) * sizeof(real));
+        memcpy(amr->Vold[i], base->V[i], (jmax + 2) * sizeof(real));
+    }
+    simulation_step(base);
+    double dt = base->dt;
+
+    for (int k = 0; k < amr->numPatches; k++)
+    {
+        Patch *patch = amr->patches + k;
+        Simulation *sim = patch->sim;
+        const Parameters *q = &sim->parameters;
+        // as many fine steps as the stability bound of the patch asks for, ratio with a fixed dt
+        int steps = amr->settings.ratio;
+        if (p->tau > 0)
+        {
+            double dtFine = dt;
+            calculate_dt(p->Re, p->Pr, p->tau, &dtFine, q->dx, q->dy, q->imax, q->jmax, sim->U, sim->V,
+                         sim->diffusiveFactor, sim->convectiveFactor, &sim->tiles);
+            steps = max((int) ceil(dt / dtFine - 1e-9), 1);
+        }
+        for (int s = 1; s <= steps; s++)
+        {
+            fillPatchBoundary(amr, patch, s / (double) steps);
+            sim->dt = dt / steps;
+            simulation_step(sim);
+        }
+        sim->t = base->t;
+        restrictPatch(amr, patch);
+    }
+
+    amr->steps++;
+    if (amr->settings.indicator != AMR_INDICATOR_NONE && amr->steps % amr->settings.regrid == 0)
+        regrid(amr);
+}
+
+void amr_run_until(Amr *amr, double t)
+{
+    while (amr->base->t < t)
+    {
+        amr_step(amr);
+    }
+}
+
+void amr_write_results(const Amr *amr)
+{
+    simulation_write_results(amr->base);
+    for (int k = 0; k < amr->numPatches; k++)
+    {
+        const Simulation *sim = amr->patches[k].sim;
+        const Parameters *q = &sim->parameters;
+        write_fields(q->problem, q->imax, q->jmax, q->xlength, q->ylength, sim->U, sim->V, sim->P);
+    }
+    logPatches(amr);
+}
+
+int amr_cells(const Amr *amr)
+{
+    int cells = amr->base->parameters.imax * amr->base->parameters.jmax;
+    for (int k = 0; k < amr->numPatches; k++)
+        cells += amr->patches[k].sim->parameters.imax * amr->patches[k].sim->parameters.jmax;
+    return cells;
+}
+
+void amr_destroy(Amr *amr)
+{
+    const Parameters *p = &amr->base->parameters;
+    int r = amr->settings.ratio;
+    for (int k = 0; k < amr->numPatches; k++)
+        destroyPatch(amr->patches + k);
+    free_imatrix(amr->geometry, 0, r * p->imax - 1, 0, r * p->jmax - 1);
+    free_matrix(amr->Uold, 0, p->imax + 1, 0, p->jmax + 1);
+    free_matrix(amr->Vold, 0, p->imax + 1, 0, p->jmax + 1);
+    free(amr);
+}
@@ -0,0 +1,112 @@
+#ifndef __AMR_H__
+#define __AMR_H__
+
+#include "simulation.h"
+
+/*
+ * Patch based adaptive mesh refinement: the context of the .dat file is the coarse base
+ * grid, and rectangular patches of it are covered by grids ratio times finer in each
+ * direction, each of them a Simulation context of its own run by the same kernels:
+ *
+ *      amr_ratio       2                   # fine cells per coarse cell in each direction
+ *      refine          0.0 0.0 5.0 4.0     # static refinement region X0 Y0 X1 Y1, may be repeated
+ *      amr_indicator   VORTICITY           # or GRADIENT (of the speed), NONE if not given
+ *      amr_threshold   0.1                 # refined where the indicator is above 0.1 x its maximum
+ *      amr_regrid      20                  # coarse steps between two choices of the indicator regions
+ *      amr_block       8                   # the refined cells are clustered in blocks of 8 x 8 coarse cells
+ *      amr_buffer      8                   # coarse cells along the inner sides of a patch left to the base grid
+ *
+ * The refined coarse cells, those of the regions and those above the threshold, are
+ * clustered in blocks, and the rectangles of flagged blocks become the patches. A step
+ * of the base grid is followed by as many steps of each patch as its stability bound on
+ * dt asks for. The sides of a patch inside the domain take their velocities from the
+ * base grid, interpolated bilinearly in space and linearly in time (net inflow taken
+ * out, see setPatchBoundary() in simulation.c), the sides on the domain boundary keep
+ * its boundary types. After the steps the velocities of the patches are averaged back
+ * onto the faces of the coarse cells they cover (not P, whose level in a patch is its
+ * own), so that the base grid carries the fine solution between the patches. The
+ * buffer of coarse cells along the inner sides is left out: overwritten right up to the
+ * side, the coarse pressure there is driven by fine velocities that do not solve the
+ * coarse equations, and through the side values the patch drifts to a wrong steady
+ * state (problem.dat at Re 100 refined up to x = 6: twice the error of the coarse grid
+ * near the step without the buffer, a fifth of it with the default 8 cells). A patch
+ * not wider than twice the buffer only takes its boundary from the base grid.
+ * At a regrid, the new patches start from the fields of the old ones where they
+ * overlap and from the base grid elsewhere.
+ *
+ * One level of patches, which is enough to put the fine cells where the flow needs
+ * them, e.g. near the step and in the wake of problem.dat.
+ */
+
+#define AMR_MAX_REGIONS 16
+#define AMR_MAX_PATCHES 64
+
+typedef enum AmrIndicator
+{
+    AMR_INDICATOR_NONE,
+    AMR_INDICATOR_VORTICITY,   // |dU/dy - dV/dx|
+    AMR_INDICATOR_GRADIENT     // |grad |u||
+} AmrIndicator;
+
+typedef struct AmrSettings
+{
+    int ratio;                             // 2 if not given
+    int numRegions;
+    double regions[AMR_MAX_REGIONS][4];    // static refinement regions, X0 Y0 X1 Y1
+    AmrIndicator indicator;
+    double threshold;                      // fraction of the largest indicator value, 0.1 if not given
+    int regrid;                            // coarse steps between the regrids, 20 if not given
+    int block;                             // 8 if not given
+    int buffer;                            // 8 if not given
+} AmrSettings;
+
+typedef struct Patch
+{
+    int ilo, ihi, jlo, jhi;   // the coarse cells it covers
+    Simulation *sim;          // its fine grid, in coordinates from the corner of the patch
+} Patch;
+
+typedef struct Amr
+{
+    AmrSettings settings;
+    Simulation *base;         // not owned
+    int **geometry;           // bitmap of the geometry at the resolution of the patches (see load_geometry())
+    int numPatches;
+    Patch patches[AMR_MAX_PATCHES];
+    real **Uold, **Vold;      // base velocities at the start of the step, for the patch boundaries
+    int steps;
+} Amr;
+
+/**
+ * Reads the settings above from the configuration. Stops with ERROR() on a malformed
+ * refine line or setting.
+ */
+void read_amr_settings(const Config *config, AmrSettings *settings);
+
+// 1 if the settings ask for refinement, i.e. give a region or an indicator
+int amr_enabled(const AmrSettings *settings);
+
+/**
+ * Sets up the patches of the base context at its current time, the geometry (of its
+ * parameters) loaded at the resolution of the patches.
+ */
+Amr *amr_create(Simulation *base, const AmrSettings *settings);
+
+// One step of the base grid and the steps of the patches up to the same time
+void amr_step(Amr *amr);
+
+void amr_run_until(Amr *amr, double t);
+
+/**
+ * simulation_write_results() of the base grid, with the fine solution averaged onto it,
+ * then the final fields of each patch (problem_patchN, see write_fields()).
+ */
+void amr_write_results(const Amr *amr);
+
+// Number of cells of the base grid and the patches
+int amr_cells(const Amr *amr);
+
+// Destroys the patches, not the base context
+void amr_destroy(Amr *amr);
+
+#endif
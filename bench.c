@@ -0,0 +1,290 @@
+#define _GNU_SOURCE
+#include "helper.h"
+#include "uvp.h"
+#include "sor.h"
+#include "poisson.h"
+#include "tiles.h"
+#include "logger.h"
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+/*
+ * Kernel benchmark - how to:
+ * 1) Build the bench target (Release or Native build type).
+ * 2) From the binary folder run:
+ *      ./bench [N ...]
+ *   this sets up a lid driven cavity of N x N cells (default 4096) and times calculate_fg, calculate_rs,
+ *   sor and calculate_uv for a set of tile sizes (see tiles.h), the last one picked by tune_tiles(),
+ *   the temporally blocked sor_blocked() doing the same SOR sweeps in a single pass, and the direct
+ *   solver fast_poisson() (one call solves what SOR needs hundreds of sweeps for).
+ *   Where the kernel allows it (Linux perf events), the last level cache misses per cell are reported
+ *   too; otherwise use the effective bandwidth (bytes of the fields touched per second) as the proxy.
+ *
+ * The fields alone take about 60 * N^2 bytes, e.g. 1 GB at N = 4096 and 4 GB at N = 8192.
+ */
+
+typedef struct TileConfig
+{
+    const char *name;
+    int tileI;
+    int tileJ;
+} TileConfig;
+
+static const TileConfig CONFIGS[] = {
+        {"untiled", 0,   0},
+        {"0x512",   0,   512},
+        {"0x256",   0,   256},
+        {"128x128", 128, 128},
+        {"64x512",  64,  512},
+};
+static const int NUM_CONFIGS = sizeof(CONFIGS) / sizeof(CONFIGS[0]);
+
+static const int SOR_SWEEPS = 8;
+static const int REPEATS = 2;
+
+static int missCounter = -1;
+
+static void openMissCounter()
+{
+#ifdef __linux__
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.size = sizeof(attr);
+    attr.config = PERF_COUNT_HW_CACHE_MISSES;
+    attr.disabled = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    missCounter = (int) syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+#endif
+    if (missCounter < 0)
+    {
+        printf("Hardware cache miss counter not available, only timings are reported\n");
+    }
+}
+
+static void startMisses()
+{
+#ifdef __linux__
+    if (missCounter >= 0)
+    {
+        ioctl(missCounter, PERF_EVENT_IOC_RESET, 0);
+        ioctl(missCounter, PERF_EVENT_IOC_ENABLE, 0);
+    }
+#endif
+}
+
+static long long stopMisses()
+{
+    long long count = -1;
+#ifdef __linux__
+    if (missCounter >= 0)
+    {
+        ioctl(missCounter, PERF_EVENT_IOC_DISABLE, 0);
+        if (read(missCounter, &count, sizeof(count)) != sizeof(count))
+            count = -1;
+    }
+#endif
+    return count;
+}
+
+static double wallTime()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + 1e-9 * ts.tv_nsec;
+}
+
+// Cavity geometry: fluid inside, obstacle ghost layer, with the neighbour bits set as init_flag() does
+static void cavityFlags(flag **Flags, int imax, int jmax)
+{
+    for (int i = 0; i <= imax + 1; i++)
+    {
+        for (int j = 0; j <= jmax + 1; j++)
+        {
+            Flags[i][j] = (i == 0 || j == 0 || i == imax + 1 || j == jmax + 1);
+        }
+    }
+    for (int i = 0; i <= imax + 1; i++)
+    {
+        for (int j = 0; j <= jmax + 1; j++)
+        {
+            Flags[i][j] |= (1 << TOP) * (j == jmax + 1 || isObstacle(Flags[i][j + 1]))
+                           | (1 << BOT) * (j == 0 || isObstacle(Flags[i][j - 1]))
+                           | (1 << LEFT) * (i == 0 || isObstacle(Flags[i - 1][j]))
+                           | (1 << RIGHT) * (i == imax + 1 || isObstacle(Flags[i + 1][j]));
+        }
+    }
+    set_kernel_masks(Flags, imax, jmax);
+}
+
+// Timing and cache misses of one kernel, best of REPEATS
+typedef struct Measure
+{
+    double time;
+    long long misses;
+} Measure;
+
+static void record(Measure *m, double time, long long misses)
+{
+    if (m->time < 0 || time < m->time)
+    {
+        m->time = time;
+        m->misses = misses;
+    }
+}
+
+static void report(const char *config, const char *kernel, Measure m, int calls, double cells, int fields)
+{
+    double perCall = m.time / calls;
+    printf("  %-10s %-13s %9.2f ms %9.1f MLUP/s %7.2f GB/s", config, kernel, 1e3 * perCall, 1e-6 * cells / perCall,
+           1e-9 * cells * fields * sizeof(real) / perCall);
+    if (m.misses >= 0)
+        printf(" %8.3f misses/cell", (double) m.misses / calls / cells);
+    printf("\n");
+}
+
+static void benchmark(int n)
+{
+    int imax = n, jmax = n;
+    double dx = 1.0 / imax, dy = 1.0 / jmax;
+    double Re = 100, alpha = 0.5, omg = 1.7, dt = 1e-4;
+    double cells = (double) imax * jmax;
+
+    flag **Flags = flagmatrix(0, imax + 1, 0, jmax + 1);
+    real **U = matrix(0, imax + 1, 0, jmax + 1);
+    real **V = matrix(0, imax + 1, 0, jmax + 1);
+    real **F = matrix(0, imax + 1, 0, jmax + 1);
+    real **G = matrix(0, imax + 1, 0, jmax + 1);
+    real **RS = matrix(0, imax + 1, 0, jmax + 1);
+    real **P = matrix(0, imax + 1, 0, jmax + 1);
+    real **T = matrix(0, imax + 1, 0, jmax + 1);
+    cavityFlags(Flags, imax, jmax);
+    for (int i = 0; i <= imax + 1; i++)
+    {
+        for (int j = 0; j <= jmax + 1; j++)
+        {
+            U[i][j] = sin(M_PI * i * dx) * cos(M_PI * j * dy);
+            V[i][j] = -cos(M_PI * i * dx) * sin(M_PI * j * dy);
+        }
+    }
+    init_matrix(F, 0, imax + 1, 0, jmax + 1, 0);
+    init_matrix(G, 0, imax + 1, 0, jmax + 1, 0);
+    init_matrix(RS, 0, imax + 1, 0, jmax + 1, 0);
+    init_matrix(P, 0, imax + 1, 0, jmax + 1, 0);
+    init_matrix(T, 0, imax + 1, 0, jmax + 1, 0);
+
+    printf("%d x %d cells, %s fields\n", imax, jmax, SIM_PRECISION_NAME);
+
+    int tunedI = 0, tunedJ = 0;
+    tune_tiles(omg, dx, dy, imax, jmax, Flags, 0, &tunedI, &tunedJ);
+    char tunedName[32];
+    snprintf(tunedName, sizeof(tunedName), "tuned %dx%d", tunedI, tunedJ);
+
+    for (int c = 0; c <= NUM_CONFIGS; c++)
+    {
+        const char *name = (c < NUM_CONFIGS) ? CONFIGS[c].name : tunedName;
+        TileList tiles;
+        build_tiles(&tiles, Flags, imax, jmax, (c < NUM_CONFIGS) ? CONFIGS[c].tileI : tunedI,
+                    (c < NUM_CONFIGS) ? CONFIGS[c].tileJ : tunedJ, 0);
+
+        Measure fg = {-1, -1}, rs = {-1, -1}, sweep = {-1, -1}, uv = {-1, -1};
+        for (int r = 0; r < REPEATS; r++)
+        {
+            double start;
+            double res;
+
+            startMisses();
+            start = wallTime();
+            calculate_fg(Re, 0, 0, alpha, 0, dt, dx, dy, imax, jmax, U, V, F, G, T, Flags, &tiles);
+            record(&fg, wallTime() - start, stopMisses());
+
+            startMisses();
+            start = wallTime();
+            calculate_rs(dt, dx, dy, imax, jmax, F, G, RS, Flags, &tiles);
+            record(&rs, wallTime() - start, stopMisses());
+
+            startMisses();
+            start = wallTime();
+            for (int s = 0; s < SOR_SWEEPS; s++)
+            {
+                sor(omg, dx, dy, imax, jmax, P, RS, Flags, &tiles, &res, imax * jmax);
+            }
+            record(&sweep, wallTime() - start, stopMisses());
+
+            startMisses();
+            start = wallTime();
+            calculate_uv(dt, dx, dy, imax, jmax, U, V, F, G, P, Flags, &tiles);
+            record(&uv, wallTime() - start, stopMisses());
+        }
+        // fields streamed per cell: U, V, F, G, T / F, G, RS / P twice (sweep and residual), RS twice / U, V, F, G, P
+        report(name, "calculate_fg", fg, 1, cells, 5);
+        report(name, "calculate_rs", rs, 1, cells, 3);
+        report(name, "sor", sweep, SOR_SWEEPS, cells, 4);
+        report(name, "calculate_uv", uv, 1, cells, 5);
+        free_tiles(&tiles);
+    }
+    
+    Measure blocked = {-1, -1};
+    for (int r = 0; r < REPEATS; r++)
+    {
+        double res;
+        startMisses();
+        double start = wallTime();
+        sor_blocked(omg, dx, dy, imax, jmax, P, RS, Flags, SOR_SWEEPS, &res, imax * jmax);
+        record(&blocked, wallTime() - start, stopMisses());
+    }
+    // P and RS streamed once per block, plus the residual pass
+    report("wavefront", "sor_blocked", blocked, SOR_SWEEPS, cells, 4);
+
+    Measure direct = {-1, -1};
+    FastPoisson poisson;
+    init_fast_poisson(&poisson, dx, dy, imax, jmax, Flags);
+    TileList whole;
+    build_tiles(&whole, Flags, imax, jmax, 0, 0, 0);
+    for (int r = 0; r < REPEATS; r++)
+    {
+        double res;
+        startMisses();
+        double start = wallTime();
+        fast_poisson(&poisson, P, RS, Flags, &whole, &res, imax * jmax);
+        record(&direct, wallTime() - start, stopMisses());
+    }
+    // RS and P once, the transform work vectors a few times per stage: the bandwidth column is only indicative
+    report("direct", "fast_poisson", direct, 1, cells, 2);
+    free_tiles(&whole);
+    free_fast_poisson(&poisson);
+
+    free_flagmatrix(Flags, 0, imax + 1, 0, jmax + 1);
+    free_matrix(U, 0, imax + 1, 0, jmax + 1);
+    free_matrix(V, 0, imax + 1, 0, jmax + 1);
+    free_matrix(F, 0, imax + 1, 0, jmax + 1);
+    free_matrix(G, 0, imax + 1, 0, jmax + 1);
+    free_matrix(RS, 0, imax + 1, 0, jmax + 1);
+    free_matrix(P, 0, imax + 1, 0, jmax + 1);
+    free_matrix(T, 0, imax + 1, 0, jmax + 1);
+}
+
+int main(int argc, char **argv)
+{
+    openLogFile();
+    openMissCounter();
+    if (argc < 2)
+    {
+        benchmark(4096);
+    }
+    for (int a = 1; a < argc; a++)
+    {
+        benchmark(atoi(argv[a]));
+    }
+    closeLogFile();
+    return 0;
+}
@@ -2,245 +2,179 @@
 #include "helper.h"
 #include "logger.h"
 
-void boundaryvalues(int imax, int jmax, double **U, double **V, int **Flags, BoundaryInfo boundaryInfo[4])
+/* value of a Dirichlet condition at the n-th cell of the side (1..) */
+static double boundaryValue(const double *values, char isConst, int n)
 {
-    // Setting boundary conditions on the outer boundary
-    setLeftBoundaryVelocities(imax, jmax, U, V, Flags, boundaryInfo);
-    setRightBoundaryVelocities(imax, jmax, U, V, Flags, boundaryInfo);
-    setTopBoundaryVelocities(imax, jmax, U, V, Flags, boundaryInfo);
-    setBottomBoundaryVelocities(imax, jmax, U, V, Flags, boundaryInfo);
-    
-    // Boundary values at geometries in the internal part of the domain
-    for (int i = 1; i <= imax; ++i)
-    {
-        for (int j = 1; j <= jmax; ++j)
-        {
-//            // debug, print the right boundary edge velocities
-//            if (i == imax)
-//            {
-//                double u = U[i][j];
-//                double v = (V[i][j] + V[i+1][j])/2;
-//                logRawString("u=%f, v=%f | ", u, v);
-//            }
-            //
-            int cell = Flags[i][j];
-            if (isObstacle(cell))
-            {
-                // Compute v
-                if (!skipV(cell))
-                {
-                    if (isNeighbourFluid(cell, TOP))
-                    {
-                        V[i][j] = 0;
-                    }
-                    else
-                    {
-                        int obsLeft = isNeighbourObstacle(cell, LEFT);
-                        int obsRight = isNeighbourObstacle(cell, RIGHT);
-                        V[i][j] = -V[i + obsLeft - obsRight][j];
-                    }
-                }
-                // Compute u
-                if (!skipU(cell))
-                {
-                    if (isNeighbourFluid(cell, RIGHT))
-                    {
-                        U[i][j] = 0;
-                    }
-                    else
-                    {
-                        int obsBottom = isNeighbourObstacle(cell, BOT);
-                        int obsTop = isNeighbourObstacle(cell, TOP);
-                        U[i][j] = -U[i][j + obsBottom - obsTop];
-                    }
-                }
-            }
-            else // if (isFluid(cell))
-            {
-                //compute V
-                if (isNeighbourObstacle(cell, TOP) && (j != jmax))
-                {
-                    V[i][j] = 0;
-                }
-                //compute U
-                if (isNeighbourObstacle(cell, RIGHT) && (i != imax))
-                {
-                    U[i][j] = 0;
-                }
-            }
-        }
-    }
-    logRawString("\n"); //debug
+    return isConst ? values[0] : values[n - 1];
 }
 
-void setLeftBoundaryVelocities(int imax, int jmax, double **U, double **V, int **Flags, BoundaryInfo *boundaryInfo)
+/*
+ * The boundary values of the sides on K lanes of the fields (K = 1: plain fields, ENSEMBLE_WIDTH: ensemble fields,
+ * see ensemble.h), the lanes of the cell (i, j) lying at j K .. j K + K - 1
+ */
+static inline void leftBoundaryLanes(int K, int jmax, real **U, real **V, flag **Flags, const BoundaryInfo *boundaryInfo)
 {
+    const BoundaryInfo *left = boundaryInfo + LEFTBOUNDARY;
     for (int j = 1; j <= jmax; j++)
     {
-        //boundaryInfo[2] == LEFT
-        int rightNeighbourIsFluid = isNeighbourFluid(Flags[0][j],RIGHT);
-        if (boundaryInfo[LEFTBOUNDARY].typeU == DIRICHLET
-            && rightNeighbourIsFluid)
-        {
-            if (boundaryInfo[LEFTBOUNDARY].constU)
-            {
-                U[0][j] = *(boundaryInfo[LEFTBOUNDARY].valuesU);
-            }
-            else
-            {
-                U[0][j] = (boundaryInfo[LEFTBOUNDARY].valuesU)[j - 1];
-            }
-        }
-        else
+        int rightNeighbourIsFluid = isNeighbourFluid(Flags[0][j], RIGHT);
+        int dirichletU = left->typeU == DIRICHLET && rightNeighbourIsFluid;
+        int dirichletV = left->typeV == DIRICHLET && rightNeighbourIsFluid;
+        for (int k = 0; k < K; k++)
         {
-            U[0][j] = U[1][j];
-        }
-        
-        if (boundaryInfo[LEFTBOUNDARY].typeV == DIRICHLET
-            && rightNeighbourIsFluid)
-        {
-            if (boundaryInfo[LEFTBOUNDARY].constV)
-            {
-                V[0][j] = 2 * (boundaryInfo[LEFTBOUNDARY].valuesV)[0] - V[1][j];
-            }
-            else
-            {
-                V[0][j] = 2 * (boundaryInfo[LEFTBOUNDARY].valuesV)[j - 1] - V[1][j];
-            }
-        }
-        else
-        {
-            V[0][j] = V[1][j];
+            int c = j * K + k;
+            U[0][c] = dirichletU ? boundaryValue(left->valuesU, left->constU, j) : U[1][c];
+            V[0][c] = dirichletV ? 2 * boundaryValue(left->valuesV, left->constV, j) - V[1][c] : V[1][c];
         }
     }
 }
 
-void setRightBoundaryVelocities(int imax, int jmax, double **U, double **V, int **Flags, BoundaryInfo *boundaryInfo)
+static inline void rightBoundaryLanes(int K, int imax, int jmax, real **U, real **V, flag **Flags,
+                                      const BoundaryInfo *boundaryInfo)
 {
+    const BoundaryInfo *right = boundaryInfo + RIGHTBOUNDARY;
     for (int j = 1; j <= jmax; j++)
     {
-        //boundaryInfo[3] == RIGHT
-        int leftNeighbourIsFluid = isNeighbourFluid(Flags[imax+1][j],LEFT);
-        if (boundaryInfo[RIGHTBOUNDARY].typeU == DIRICHLET
-                && leftNeighbourIsFluid)
-        {
-            if (boundaryInfo[RIGHTBOUNDARY].constU)
-            {
-                U[imax][j] = *(boundaryInfo[RIGHTBOUNDARY].valuesU);
-            }
-            else
-            {
-                U[imax][j] = (boundaryInfo[RIGHTBOUNDARY].valuesU)[j - 1];
-            }
-        }
-        else
+        int leftNeighbourIsFluid = isNeighbourFluid(Flags[imax + 1][j], LEFT);
+        int dirichletU = right->typeU == DIRICHLET && leftNeighbourIsFluid;
+        int dirichletV = right->typeV == DIRICHLET && leftNeighbourIsFluid;
+        for (int k = 0; k < K; k++)
         {
-            U[imax][j] = U[imax - 1][j];
-        }
-        
-        if (boundaryInfo[RIGHTBOUNDARY].typeV == DIRICHLET
-                && leftNeighbourIsFluid)
-        {
-            if (boundaryInfo[RIGHTBOUNDARY].constV)
-            {
-                V[imax + 1][j] = 2 * (boundaryInfo[RIGHTBOUNDARY].valuesV)[0] - V[imax][j];
-            }
-            else
-            {
-                V[imax + 1][j] = 2 * (boundaryInfo[RIGHTBOUNDARY].valuesV)[j - 1] - V[imax][j];
-            }
-        }
-        else
-        {
-            V[imax + 1][j] = V[imax][j];
+            int c = j * K + k;
+            U[imax][c] = dirichletU ? boundaryValue(right->valuesU, right->constU, j) : U[imax - 1][c];
+            V[imax + 1][c] = dirichletV ? 2 * boundaryValue(right->valuesV, right->constV, j) - V[imax][c]
+                                        : V[imax][c];
         }
     }
 }
 
-void setTopBoundaryVelocities(int imax, int jmax, double **U, double **V, int **Flags, BoundaryInfo *boundaryInfo)
+static inline void topBoundaryLanes(int K, int imax, int jmax, real **U, real **V, flag **Flags,
+                                    const BoundaryInfo *boundaryInfo)
 {
+    const BoundaryInfo *top = boundaryInfo + TOPBOUNDARY;
     for (int i = 1; i <= imax; i++)
     {
-        //boundaryInfo[0] == TOP
-        int bottomNeighbourIsFluid = isNeighbourFluid(Flags[i][jmax+1],BOT);
-        if (boundaryInfo[TOPBOUNDARY].typeV == DIRICHLET
-                && bottomNeighbourIsFluid)
+        int bottomNeighbourIsFluid = isNeighbourFluid(Flags[i][jmax + 1], BOT);
+        int dirichletU = top->typeU == DIRICHLET && bottomNeighbourIsFluid;
+        int dirichletV = top->typeV == DIRICHLET && bottomNeighbourIsFluid;
+        for (int k = 0; k < K; k++)
         {
-            if (boundaryInfo[TOPBOUNDARY].constV)
-            {
-                V[i][jmax] = *(boundaryInfo[TOPBOUNDARY].valuesV);
-            }
-            else
-            {
-                V[i][jmax] = (boundaryInfo[TOPBOUNDARY].valuesV)[i - 1];
-            }
-        }
-        else
-        {
-            V[i][jmax] = V[i][jmax - 1];
-        }
-        
-        if (boundaryInfo[TOPBOUNDARY].typeU == DIRICHLET
-                && bottomNeighbourIsFluid)
-        {
-            if (boundaryInfo[TOPBOUNDARY].constU)
-            {
-                U[i][jmax + 1] = 2 * (boundaryInfo[TOPBOUNDARY].valuesU)[0] - U[i][jmax];
-            }
-            else
-            {
-                U[i][jmax + 1] = 2 * (boundaryInfo[TOPBOUNDARY].valuesU)[i - 1] - U[i][jmax];
-            }
-        }
-        else
-        {
-            U[i][jmax + 1] = U[i][jmax];
+            V[i][jmax * K + k] = dirichletV ? boundaryValue(top->valuesV, top->constV, i) : V[i][(jmax - 1) * K + k];
+            U[i][(jmax + 1) * K + k] = dirichletU ? 2 * boundaryValue(top->valuesU, top->constU, i) - U[i][jmax * K + k]
+                                                  : U[i][jmax * K + k];
         }
     }
 }
 
-void setBottomBoundaryVelocities(int imax, int jmax, double **U, double **V, int **Flags, BoundaryInfo *boundaryInfo)
+static inline void bottomBoundaryLanes(int K, int imax, real **U, real **V, flag **Flags,
+                                       const BoundaryInfo *boundaryInfo)
 {
+    const BoundaryInfo *bottom = boundaryInfo + BOTTOMBOUNDARY;
     for (int i = 1; i <= imax; i++)
     {
-        //boundaryInfo[1] == BOTTOM
-        int topNeighbourIsFluid = isNeighbourFluid(Flags[i][0],TOP);
-        if (boundaryInfo[BOTTOMBOUNDARY].typeV == DIRICHLET
-                && topNeighbourIsFluid)
-        {
-            if (boundaryInfo[BOTTOMBOUNDARY].constV)
-            {
-                V[i][0] = *(boundaryInfo[BOTTOMBOUNDARY].valuesV);
-            }
-            else
-            {
-                V[i][0] = (boundaryInfo[BOTTOMBOUNDARY].valuesV)[i - 1];
-            }
-        }
-        else
+        int topNeighbourIsFluid = isNeighbourFluid(Flags[i][0], TOP);
+        int dirichletU = bottom->typeU == DIRICHLET && topNeighbourIsFluid;
+        int dirichletV = bottom->typeV == DIRICHLET && topNeighbourIsFluid;
+        for (int k = 0; k < K; k++)
         {
-            V[i][0] = V[i][1];
+            V[i][k] = dirichletV ? boundaryValue(bottom->valuesV, bottom->constV, i) : V[i][K + k];
+            U[i][k] = dirichletU ? 2 * boundaryValue(bottom->valuesU, bottom->constU, i) - U[i][K + k] : U[i][K + k];
         }
-        
-        if (boundaryInfo[BOTTOMBOUNDARY].typeU == DIRICHLET
-                && topNeighbourIsFluid)
+    }
+}
+
+/* boundaryvalues() on K lanes of the fields, boundaryvalues() and boundaryvalues_ensemble() inline it with their K */
+static inline void boundaryLanes(int K, int imax, int jmax, real **U, real **V, flag **Flags, const TileList *tiles,
+                                 const BoundaryInfo *boundaryInfo)
+{
+    // Setting boundary conditions on the outer boundary
+    leftBoundaryLanes(K, jmax, U, V, Flags, boundaryInfo);
+    rightBoundaryLanes(K, imax, jmax, U, V, Flags, boundaryInfo);
+    topBoundaryLanes(K, imax, jmax, U, V, Flags, boundaryInfo);
+    bottomBoundaryLanes(K, imax, U, V, Flags, boundaryInfo);
+    
+    // Boundary values at geometries in the internal part of the domain
+    for (int t = 0; t < tiles->numTiles; t++)
+    {
+        const Tile *tile = tiles->tiles + t;
+        for (int i = max(tile->ilo, 1); i <= min(tile->ihi, imax); ++i)
         {
-            if (boundaryInfo[BOTTOMBOUNDARY].constU)
-            {
-                U[i][0] = 2 * (boundaryInfo[BOTTOMBOUNDARY].valuesU)[0] - U[i][1];
-            }
-            else
+            for (int j = max(tile->jlo, 1); j <= min(tile->jhi, jmax); ++j)
             {
-                U[i][0] = 2 * (boundaryInfo[BOTTOMBOUNDARY].valuesU)[i - 1] - U[i][1];
+                flag cell = Flags[i][j];
+                int c = j * K;
+                if (isObstacle(cell))
+                {
+                    // Compute v
+                    if (!skipV(cell))
+                    {
+                        int fluidTop = isNeighbourFluid(cell, TOP);
+                        int ni = i + isNeighbourObstacle(cell, LEFT) - isNeighbourObstacle(cell, RIGHT);
+                        for (int k = 0; k < K; k++)
+                            V[i][c + k] = fluidTop ? 0 : -V[ni][c + k];
+                    }
+                    // Compute u
+                    if (!skipU(cell))
+                    {
+                        int fluidRight = isNeighbourFluid(cell, RIGHT);
+                        int nc = c + (isNeighbourObstacle(cell, BOT) - isNeighbourObstacle(cell, TOP)) * K;
+                        for (int k = 0; k < K; k++)
+                            U[i][c + k] = fluidRight ? 0 : -U[i][nc + k];
+                    }
+                }
+                else // if (isFluid(cell))
+                {
+                    //compute V
+                    if (isNeighbourObstacle(cell, TOP) && (j != jmax))
+                    {
+                        for (int k = 0; k < K; k++)
+                            V[i][c + k] = 0;
+                    }
+                    //compute U
+                    if (isNeighbourObstacle(cell, RIGHT) && (i != imax))
+                    {
+                        for (int k = 0; k < K; k++)
+                            U[i][c + k] = 0;
+                    }
+                }
             }
         }
-        else
-        {
-            U[i][0] = U[i][1];
-        }
     }
 }
 
+void boundaryvalues(int imax, int jmax, real **U, real **V, flag **Flags, const TileList *tiles,
+                    BoundaryInfo boundaryInfo[4])
+{
+    boundaryLanes(1, imax, jmax, U, V, Flags, tiles, boundaryInfo);
+    logRawString("\n"); //debug
+}
+
+void boundaryvalues_ensemble(int imax, int jmax, real **U, real **V, flag **Flags, const TileList *tiles,
+                             BoundaryInfo boundaryInfo[4])
+{
+    boundaryLanes(ENSEMBLE_WIDTH, imax, jmax, U, V, Flags, tiles, boundaryInfo);
+}
+
+void setLeftBoundaryVelocities(int imax, int jmax, real **U, real **V, flag **Flags, BoundaryInfo *boundaryInfo)
+{
+    leftBoundaryLanes(1, jmax, U, V, Flags, boundaryInfo);
+}
+
+void setRightBoundaryVelocities(int imax, int jmax, real **U, real **V, flag **Flags, BoundaryInfo *boundaryInfo)
+{
+    rightBoundaryLanes(1, imax, jmax, U, V, Flags, boundaryInfo);
+}
+
+void setTopBoundaryVelocities(int imax, int jmax, real **U, real **V, flag **Flags, BoundaryInfo *boundaryInfo)
+{
+    topBoundaryLanes(1, imax, jmax, U, V, Flags, boundaryInfo);
+}
+
+void setBottomBoundaryVelocities(int imax, int jmax, real **U, real **V, flag **Flags, BoundaryInfo *boundaryInfo)
+{
+    bottomBoundaryLanes(1, imax, U, V, Flags, boundaryInfo);
+}
+
 void initBoundaryInfo(BoundaryInfo *boundaryInfo, BoundaryType typeU, BoundaryType typeV,
                  int numValuesU, int numValuesV)
 {
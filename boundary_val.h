@@ -1,6 +1,11 @@
 #ifndef __RANDWERTE_H__
 #define __RANDWERTE_H__
 
+#include "precision.h"
+#include "flags.h"
+#include "tiles.h"
+#include "ensemble.h"
+
 /*
  * Auxiliary data structures to handle the boundary values.
  */
@@ -36,14 +41,21 @@ void initBoundaryInfo(BoundaryInfo *boundaryInfo, BoundaryType typeU, BoundaryTy
  * The boundary values of the problem are set.
  */
 
-void boundaryvalues(int imax, int jmax, double **U, double **V, int **Flags, BoundaryInfo boundaryInfo[4]);
+void boundaryvalues(int imax, int jmax, real **U, real **V, flag **Flags, const TileList *tiles,
+                    BoundaryInfo boundaryInfo[4]);
+
+/**
+ * boundaryvalues() for the ENSEMBLE_WIDTH lanes of the ensemble fields U and V (see ensemble.h).
+ */
+void boundaryvalues_ensemble(int imax, int jmax, real **U, real **V, flag **Flags, const TileList *tiles,
+                             BoundaryInfo boundaryInfo[4]);
 
-void setLeftBoundaryVelocities(int imax, int jmax, double **U, double **V, int **Flags, BoundaryInfo *boundaryInfo);
+void setLeftBoundaryVelocities(int imax, int jmax, real **U, real **V, flag **Flags, BoundaryInfo *boundaryInfo);
 
-void setRightBoundaryVelocities(int imax, int jmax, double **U, double **V, int **Flags, BoundaryInfo *boundaryInfo);
+void setRightBoundaryVelocities(int imax, int jmax, real **U, real **V, flag **Flags, BoundaryInfo *boundaryInfo);
 
-void setTopBoundaryVelocities(int imax, int jmax, double **U, double **V, int **Flags, BoundaryInfo *boundaryInfo);
+void setTopBoundaryVelocities(int imax, int jmax, real **U, real **V, flag **Flags, BoundaryInfo *boundaryInfo);
 
-void setBottomBoundaryVelocities(int imax, int jmax, double **U, double **V, int **Flags, BoundaryInfo *boundaryInfo);
+void setBottomBoundaryVelocities(int imax, int jmax, real **U, real **V, flag **Flags, BoundaryInfo *boundaryInfo);
 
 #endif
@@ -0,0 +1,23 @@
+#include "ensemble.h"
+#include "helper.h"
+
+real **ensemble_matrix(int imax, int jmax)
+{
+    return matrix(0, imax + 1, 0, ENSEMBLE_WIDTH * (jmax + 2) - 1);
+}
+
+void free_ensemble_matrix(real **A, int imax, int jmax)
+{
+    free_matrix(A, 0, imax + 1, 0, ENSEMBLE_WIDTH * (jmax + 2) - 1);
+}
+
+void get_lane(real **A, int k, int imax, int jmax, real **B)
+{
+    for (int i = 0; i <= imax + 1; i++)
+    {
+        for (int j = 0; j <= jmax + 1; j++)
+        {
+            B[i][j] = A[i][j * ENSEMBLE_WIDTH + k];
+        }
+    }
+}
@@ -0,0 +1,38 @@
+#ifndef __ENSEMBLE_H__
+#define __ENSEMBLE_H__
+
+#include "precision.h"
+
+/*
+ * Ensemble layout: ENSEMBLE_WIDTH instances (lanes) of the same grid and geometry,
+ * which only differ in their scalar parameters (Re, alpha, UI, ...), stored interleaved:
+ *
+ *      A[i][j * ENSEMBLE_WIDTH + k]    value of lane k at the grid point (i, j)
+ *
+ * so that the lanes of a grid point are contiguous. The *_ensemble kernels (uvp.h, sor.h,
+ * boundary_val.h) loop over the lanes innermost, with a trip count known at compile time:
+ * the compiler maps the lanes to the SIMD lanes, and as the flags are the same for all
+ * lanes every branch on them is taken once for the whole vector. This vectorises even the
+ * kernels which cannot be vectorised along j, as the Gauss-Seidel sweep of sor().
+ * They are the scalar kernels inlined with ENSEMBLE_WIDTH lanes instead of one, so both
+ * share the same stencils.
+ *
+ * The lanes advance in lock-step, with the smallest of their time steps, and the pressure
+ * is iterated until all lanes have converged. The ensemble runs the plain algorithm only:
+ * explicit Euler, upwind weighted differences and point SOR (see --ensemble in sweep.h).
+ *
+ * The width is a build setting, e.g. -DENSEMBLE_WIDTH=8 for float fields on AVX.
+ */
+#ifndef ENSEMBLE_WIDTH
+#define ENSEMBLE_WIDTH 4
+#endif
+
+// Ensemble field over the cells 0..imax+1 x 0..jmax+1, zeroed (matrix())
+real **ensemble_matrix(int imax, int jmax);
+
+void free_ensemble_matrix(real **A, int imax, int jmax);
+
+// Copies lane k of the ensemble field A into the plain field B (0..imax+1 x 0..jmax+1), e.g. for the output
+void get_lane(real **A, int k, int imax, int jmax, real **B);
+
+#endif
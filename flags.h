@@ -0,0 +1,77 @@
+#ifndef __FLAGS_H__
+#define __FLAGS_H__
+
+/**
+ * Cell flags, one byte per cell:
+ *
+ * - bit CENTER                  the cell is an obstacle
+ * - bits TOP, BOT, LEFT, RIGHT  the neighbour in that direction is an obstacle
+ * - bit U_EDGE                  U[i][j] is updated by the momentum equation (cell and right neighbour fluid)
+ * - bit V_EDGE                  V[i][j] is updated by the momentum equation (cell and top neighbour fluid)
+ * - bit P_CELL                  P[i][j] is a pressure unknown (fluid cell)
+ *
+ * The neighbour bits are set by init_flag(), the kernel masks U_EDGE, V_EDGE and P_CELL
+ * are precomputed from them by set_kernel_masks() and must be refreshed whenever the
+ * geometry bits change.
+ *
+ * The predicates are inline so that the inner loops of the kernels do not pay a call.
+ */
+typedef unsigned char flag;
+
+//typedef enum Direction {CENTER=1, TOP=16, BOT=8, LEFT=4, RIGHT=2} Direction;
+typedef enum Direction {CENTER=0, TOP=4, BOT=3, LEFT=2, RIGHT=1} Direction;
+typedef enum KernelMask {U_EDGE=5, V_EDGE=6, P_CELL=7} KernelMask;
+
+#define GEOMETRY_BITS ((1<<CENTER) | (1<<TOP) | (1<<BOT) | (1<<LEFT) | (1<<RIGHT))
+
+// Returns 1 (True) if the cell is an obstacle
+static inline int isObstacle(flag f){
+    return (f>>CENTER)&1;
+}
+
+// Returns 1 (True) if the cell is fluid
+static inline int isFluid(flag f){
+    return !((f>>CENTER)&1);
+}
+
+// Returns 1 (True) if the neighbouring cell in the indicated direction is an obstacle
+static inline int isNeighbourObstacle(flag f, Direction direction){
+    return (f>>direction)&1;
+}
+
+// Returns 1 (True) if the neighbouring cell in the indicated direction is fluid
+static inline int isNeighbourFluid(flag f, Direction direction){
+    return !((f>>direction)&1);
+}
+
+// Returns 1 (True) if the cell is present at a corner (bordering only 2 fluid cells)
+static inline int isCorner(flag f){
+    return ((f>>TOP)&1)^((f>>BOT)&1) && ((f>>LEFT)&1)^((f>>RIGHT)&1);
+}
+
+// Computes skip condition for u-boundary value determination (if top, right and bottom cells are obstacles)
+static inline int skipU(flag f){
+    return (f&(1<<TOP)) && (f&(1<<RIGHT)) && (f&(1<<BOT));
+}
+
+// Computes skip condition for v-boundary value determination (if left, top and right cells are obstacles)
+static inline int skipV(flag f){
+    return (f&(1<<LEFT)) && (f&(1<<TOP)) && (f&(1<<RIGHT));
+}
+
+// Returns 1 (True) if U[i][j] lies on an edge between 2 fluid cells (precomputed U-update mask)
+static inline int isUEdge(flag f){
+    return (f>>U_EDGE)&1;
+}
+
+// Returns 1 (True) if V[i][j] lies on an edge between 2 fluid cells (precomputed V-update mask)
+static inline int isVEdge(flag f){
+    return (f>>V_EDGE)&1;
+}
+
+// Returns 1 (True) if P[i][j] is a pressure unknown (precomputed pressure mask)
+static inline int isPCell(flag f){
+    return (f>>P_CELL)&1;
+}
+
+#endif
@@ -0,0 +1,353 @@
+#include "geometry.h"
+#include "logger.h"
+#include <ctype.h>
+
+#define SHAPES_KEYWORD "shapes"
+#define MAX_POLYGON_VERTICES 64
+
+typedef enum ShapeType
+{
+    SHAPE_RECTANGLE,
+    SHAPE_CIRCLE,
+    SHAPE_POLYGON,
+    SHAPE_CYLINDERS,
+    SHAPE_STEP
+} ShapeType;
+
+// Shapes by name, with the number of their values (the polygon: 1 + 2 N)
+typedef struct ShapeKind
+{
+    const char *name;
+    ShapeType type;
+    int numValues;
+} ShapeKind;
+
+static const ShapeKind KINDS[] = {
+        {"rectangle", SHAPE_RECTANGLE, 4},
+        {"circle",    SHAPE_CIRCLE,    3},
+        {"polygon",   SHAPE_POLYGON,   -1},
+        {"cylinders", SHAPE_CYLINDERS, 7},
+        {"step",      SHAPE_STEP,      2},
+};
+static const int NUM_KINDS = sizeof(KINDS) / sizeof(KINDS[0]);
+
+typedef struct Shape
+{
+    ShapeType type;
+    int numValues;
+    double values[1 + 2 * MAX_POLYGON_VERTICES];
+} Shape;
+
+// Parses "name value ...", returns 0 if the text is no valid shape
+static int parseShape(const char *text, Shape *shape)
+{
+    char name[32];
+    int length = 0;
+    if (sscanf(text, "%31s%n", name, &length) != 1)
+        return 0;
+    const ShapeKind *kind = NULL;
+    for (int k = 0; k < NUM_KINDS; k++)
+    {
+        if (strcmp(KINDS[k].name, name) == 0)
+            kind = KINDS + k;
+    }
+    if (kind == NULL)
+        return 0;
+    shape->type = kind->type;
+    shape->numValues = 0;
+    const char *position = text + length;
+    int maxValues = sizeof(shape->values) / sizeof(shape->values[0]);
+    while (shape->numValues < maxValues)
+    {
+        char *end = NULL;
+        double value = strtod(position, &end);
+        if (end == position)
+            break;
+        shape->values[shape->numValues++] = value;
+        position = end;
+    }
+    while (isspace((int) *position))
+        position++;
+    if (*position != '\0' && *position != ';')
+        return 0;
+    if (kind->type == SHAPE_POLYGON)
+    {
+        int n = (shape->numValues > 0) ? (int) shape->values[0] : 0;
+        return n >= 3 && n <= MAX_POLYGON_VERTICES && shape->numValues == 1 + 2 * n;
+    }
+    if (kind->type == SHAPE_CYLINDERS && (shape->values[3] < 1 || shape->values[4] < 1))
+        return 0;
+    return shape->numValues == kind->numValues;
+}
+
+int is_shape_geometry(const char *geometry)
+{
+    size_t length = strlen(SHAPES_KEYWORD);
+    return strncmp(geometry, SHAPES_KEYWORD, length) == 0 && (geometry[length] == '\0' || geometry[length] == ';');
+}
+
+void read_shapes(const Config *config, char *geometry, size_t size)
+{
+    char szBuff[sizeof(config->name) + MAX_LINE_LENGTH + 100];   // the file name and an obstacle line
+    const char *next = NULL;
+    char *value;
+    int numShapes = 0;
+    snprintf(geometry, size, "%s", SHAPES_KEYWORD);
+    while ((value = find_next_string(config, "obstacle", &next)) != NULL)
+    {
+        // the value up to the end of the line, with the whitespace collapsed
+        char shapeText[MAX_LINE_LENGTH];
+        int length = 0;
+        for (char *c = value; *c && *c != '\n' && *c != '\r'; c++)
+        {
+            if (!isspace((int) *c) || (length > 0 && shapeText[length - 1] != ' '))
+                shapeText[length++] = isspace((int) *c) ? ' ' : *c;
+        }
+        while (length > 0 && shapeText[length - 1] == ' ')
+            length--;
+        shapeText[length] = '\0';
+        Shape shape;
+        if (!parseShape(shapeText, &shape))
+        {
+            snprintf(szBuff, sizeof(szBuff), "%s: obstacle '%s' is no valid shape (see geometry.h)", config->name,
+                     shapeText);
+            ERROR(szBuff);
+        }
+        size_t used = strlen(geometry);
+        if (used + length + 3 > size)
+        {
+            snprintf(szBuff, sizeof(szBuff), "%s: the obstacles do not fit into %d characters", config->name,
+                     (int) size);
+            ERROR(szBuff);
+        }
+        snprintf(geometry + used, size - used, "; %s", shapeText);
+        logMsg("File: %s\t\tobstacle       = %s", config->name, shapeText);
+        numShapes++;
+    }
+    if (numShapes == 0)
+    {
+        snprintf(szBuff, sizeof(szBuff), "%s: geometry shapes, but no obstacle given", config->name);
+        ERROR(szBuff);
+    }
+}
+
+// Range of the cells 0..n-1 of size h whose centres lie in [lo, hi], empty if first > last
+static void cellRange(double lo, double hi, double h, int n, int *first, int *last)
+{
+    *first = max(0, (int) ceil(lo / h - 0.5));
+    *last = min(n - 1, (int) floor(hi / h - 0.5));
+}
+
+static void markCircle(int **pic, double xc, double yc, double r, int imax, int jmax, double dx, double dy)
+{
+    int ilo, ihi, jlo, jhi;
+    cellRange(xc - r, xc + r, dx, imax, &ilo, &ihi);
+    cellRange(yc - r, yc + r, dy, jmax, &jlo, &jhi);
+    for (int i = ilo; i <= ihi; i++)
+    {
+        for (int j = jlo; j <= jhi; j++)
+        {
+            double x = (i + 0.5) * dx - xc, y = (j + 0.5) * dy - yc;
+            if (x * x + y * y <= r * r)
+                pic[i][j] = 1;
+        }
+    }
+}
+
+// Even-odd rule: the number of edges crossed by the ray from (x, y) in x-direction
+static int insidePolygon(const double *vertices, int n, double x, double y)
+{
+    int inside = 0;
+    for (int a = 0, b = n - 1; a < n; b = a++)
+    {
+        double xa = vertices[2 * a], ya = vertices[2 * a + 1];
+        double xb = vertices[2 * b], yb = vertices[2 * b + 1];
+        if ((ya > y) != (yb > y) && x < xa + (y - ya) * (xb - xa) / (yb - ya))
+            inside = !inside;
+    }
+    return inside;
+}
+
+static void markShape(int **pic, const Shape *shape, int imax, int jmax, double dx, double dy)
+{
+    const double *v = shape->values;
+    int ilo, ihi, jlo, jhi;
+    switch (shape->type)
+    {
+        case SHAPE_RECTANGLE:
+        case SHAPE_STEP:
+        {
+            double x0 = (shape->type == SHAPE_STEP) ? 0 : fmin(v[0], v[2]);
+            double y0 = (shape->type == SHAPE_STEP) ? 0 : fmin(v[1], v[3]);
+            double x1 = (shape->type == SHAPE_STEP) ? v[0] : fmax(v[0], v[2]);
+            double y1 = (shape->type == SHAPE_STEP) ? v[1] : fmax(v[1], v[3]);
+            cellRange(x0, x1, dx, imax, &ilo, &ihi);
+            cellRange(y0, y1, dy, jmax, &jlo, &jhi);
+            for (int i = ilo; i <= ihi; i++)
+                for (int j = jlo; j <= jhi; j++)
+                    pic[i][j] = 1;
+            break;
+        }
+        case SHAPE_CIRCLE:
+            markCircle(pic, v[0], v[1], v[2], imax, jmax, dx, dy);
+            break;
+        case SHAPE_CYLINDERS:
+            for (int a = 0; a < (int) v[3]; a++)
+                for (int b = 0; b < (int) v[4]; b++)
+                    markCircle(pic, v[0] + a * v[5], v[1] + b * v[6], v[2], imax, jmax, dx, dy);
+            break;
+        case SHAPE_POLYGON:
+        {
+            int n = (int) v[0];
+            const double *vertices = v + 1;
+            double x0 = vertices[0], x1 = vertices[0], y0 = vertices[1], y1 = vertices[1];
+            for (int k = 1; k < n; k++)
+            {
+                x0 = fmin(x0, vertices[2 * k]);
+                x1 = fmax(x1, vertices[2 * k]);
+                y0 = fmin(y0, vertices[2 * k + 1]);
+                y1 = fmax(y1, vertices[2 * k + 1]);
+            }
+            cellRange(x0, x1, dx, imax, &ilo, &ihi);
+            cellRange(y0, y1, dy, jmax, &jlo, &jhi);
+            for (int i = ilo; i <= ihi; i++)
+                for (int j = jlo; j <= jhi; j++)
+                    if (insidePolygon(vertices, n, (i + 0.5) * dx, (j + 0.5) * dy))
+                        pic[i][j] = 1;
+            break;
+        }
+    }
+}
+
+int **rasterise_shapes(const char *geometry, int imax, int jmax, double xlength, double ylength)
+{
+    double dx = xlength / imax;
+    double dy = ylength / jmax;
+    int **pic = imatrix(0, imax - 1, 0, jmax - 1);
+    init_imatrix(pic, 0, imax - 1, 0, jmax - 1, 0);
+    int numShapes = 0;
+    for (const char *text = strchr(geometry, ';'); text != NULL; text = strchr(text + 1, ';'))
+    {
+        Shape shape;
+        if (!parseShape(text + 1, &shape))
+            ERROR("Malformed shape in the geometry string");
+        markShape(pic, &shape, imax, jmax, dx, dy);
+        numShapes++;
+    }
+    logMsg("Geometry: %d shapes rasterised on %d x %d cells", numShapes, imax, jmax);
+    return pic;
+}
+
+// Pixel of the image (of size pixels along the axis) at the centre of the cell c of n
+static int nearestPixel(int c, int n, int size)
+{
+    return min(size - 1, (int) ((c + 0.5) * size / n));
+}
+
+// Length of the overlap of the pixel p with [lo, hi] (in pixels)
+static double overlap(int p, double lo, double hi)
+{
+    return fmax(0.0, fmin(p + 1.0, hi) - fmax((double) p, lo));
+}
+
+int **resample_bitmap(int **pic, int width, int height, int imax, int jmax, GeometryResampling rule)
+{
+    int **cells = imatrix(0, imax - 1, 0, jmax - 1);
+    double sx = (double) width / imax;   // pixels per cell
+    double sy = (double) height / jmax;
+    for (int i = 0; i < imax; i++)
+    {
+        for (int j = 0; j < jmax; j++)
+        {
+            int nearest = pic[nearestPixel(i, imax, width)][nearestPixel(j, jmax, height)] != 0;
+            // the cell covers the pixels [x0, x1) x [y0, y1)
+            double x0 = i * sx, x1 = (i + 1) * sx;
+            double y0 = j * sy, y1 = (j + 1) * sy;
+            int pxlo = (int) x0, pxhi = min(width - 1, (int) ceil(x1) - 1);
+            int pylo = (int) y0, pyhi = min(height - 1, (int) ceil(y1) - 1);
+            if (rule == RESAMPLING_MAJORITY)
+            {
+                int obstacles = 0, pixels = 0;
+                for (int px = pxlo; px <= pxhi; px++)
+                {
+                    for (int py = pylo; py <= pyhi; py++)
+                    {
+                        // pixels centred in the cell
+                        if (px + 0.5 < x0 || px + 0.5 >= x1 || py + 0.5 < y0 || py + 0.5 >= y1)
+                            continue;
+                        obstacles += pic[px][py] != 0;
+                        pixels++;
+                    }
+                }
+                cells[i][j] = (pixels > 0) ? 2 * obstacles >= pixels : nearest;
+            }
+            else if (rule == RESAMPLING_AREA)
+            {
+                double covered = 0;
+                for (int px = pxlo; px <= pxhi; px++)
+                {
+                    for (int py = pylo; py <= pyhi; py++)
+                    {
+                        if (pic[px][py] != 0)
+                            covered += overlap(px, x0, x1) * overlap(py, y0, y1);
+                    }
+                }
+                cells[i][j] = 2 * covered >= sx * sy;
+            }
+            else
+            {
+                cells[i][j] = nearest;
+            }
+        }
+    }
+    return cells;
+}
+
+// 1 if the obstacle cell (i, j) has fluid on two opposite sides: 1 left and right, 2 below and above
+static int forbiddenCell(flag **Flag, int i, int j)
+{
+    if (isFluid(Flag[i][j]))
+        return 0;
+    if (isFluid(Flag[i - 1][j]) && isFluid(Flag[i + 1][j]))
+        return 1;
+    if (isFluid(Flag[i][j - 1]) && isFluid(Flag[i][j + 1]))
+        return 2;
+    return 0;
+}
+
+int repair_geometry(flag **Flag, int imax, int jmax, GeometryRepair repair)
+{
+    if (repair == REPAIR_NONE)
+        return 0;
+    int repaired = 0, changed = 1;
+    while (changed)
+    {
+        // sweeps in a fixed order until nothing changes, the result only depends on the geometry
+        changed = 0;
+        for (int i = 1; i <= imax; i++)
+        {
+            for (int j = 1; j <= jmax; j++)
+            {
+                int side = forbiddenCell(Flag, i, j);
+                if (side == 0)
+                    continue;
+                if (repair == REPAIR_REMOVE)
+                {
+                    Flag[i][j] &= ~(1 << CENTER);
+                    logMsg("Geometry repaired at (%d,%d): obstacle removed", i, j);
+                }
+                else
+                {
+                    // the fluid cell to the right of (above) the wall becomes an obstacle, which thickens it
+                    int fi = (side == 1) ? i + 1 : i;
+                    int fj = (side == 2) ? j + 1 : j;
+                    Flag[fi][fj] |= 1 << CENTER;
+                    logMsg("Geometry repaired at (%d,%d): obstacle filled in at (%d,%d)", i, j, fi, fj);
+                }
+                changed++;
+            }
+        }
+        repaired += changed;
+    }
+    return repaired;
+}
@@ -0,0 +1,79 @@
+#ifndef __GEOMETRY_H__
+#define __GEOMETRY_H__
+
+#include "helper.h"
+
+/*
+ * Procedural geometry: instead of naming a PGM file, the .dat file may describe the
+ * obstacles as shapes in domain coordinates (0..xlength x 0..ylength), which are
+ * rasterised at whatever imax x jmax the grid has, so refining the grid needs no new image:
+ *
+ *      geometry    shapes
+ *      obstacle    rectangle  X0 Y0 X1 Y1
+ *      obstacle    circle     XC YC R
+ *      obstacle    polygon    N  X1 Y1 ... XN YN
+ *      obstacle    cylinders  XC YC R NX NY SX SY   # NX x NY circles, the first one at XC YC, SX and SY apart
+ *      obstacle    step       L H                   # backward-facing step: the rectangle 0 0 L H
+ *
+ * A cell is an obstacle if its centre lies inside one of the shapes (edges included).
+ * read_parameters() gathers the obstacle lines into the geometry string of the parameters,
+ * "shapes; rectangle 0 0 2 1; circle 5 2 0.5", so that the description goes wherever the
+ * parameters go, as a file name would, and init_flag() rasterises it.
+ */
+
+/*
+ * A PGM image of another size than the grid (e.g. one high resolution master of the geometry
+ * for coarse and fine runs) is resampled to the imax x jmax cells on load, by the rule set
+ * with geometry_resampling.
+ */
+typedef enum GeometryResampling
+{
+    RESAMPLING_NEAREST,   // the pixel at the centre of the cell
+    RESAMPLING_MAJORITY,  // obstacle if at least half of the pixels centred in the cell are (nearest if none is)
+    RESAMPLING_AREA       // obstacle if the obstacle pixels cover at least half of the area of the cell
+} GeometryResampling;
+
+/*
+ * The forbidden cells of a geometry (obstacle cells with fluid on two opposite sides, see
+ * geometryCheck()), which images, resampling and shapes all may produce, are repaired when
+ * the Flags are set, by the rule set with geometry_repair.
+ */
+typedef enum GeometryRepair
+{
+    REPAIR_REMOVE,        // the forbidden cell becomes fluid
+    REPAIR_FILL,          // the fluid cell to its right (above it) becomes an obstacle
+    REPAIR_NONE           // no repair, geometryCheck() stops the run
+} GeometryRepair;
+
+#define GEOMETRY_LENGTH 1024   // size of the geometry string: the PGM path, or the shapes
+
+// 1 if the geometry string describes shapes rather than naming a PGM file
+int is_shape_geometry(const char *geometry);
+
+/**
+ * Appends the obstacle lines of the configuration to the geometry string "shapes" (size
+ * bytes in all). Stops with ERROR() on a malformed shape, or if they do not fit.
+ */
+void read_shapes(const Config *config, char *geometry, size_t size);
+
+/**
+ * Rasterises the shapes of the geometry string: returns the bitmap as read_pgm() does,
+ * pic[i][j] over 0..imax-1 x 0..jmax-1 (j upwards), 1 for obstacle and 0 for fluid cells.
+ */
+int **rasterise_shapes(const char *geometry, int imax, int jmax, double xlength, double ylength);
+
+/**
+ * Resamples the width x height bitmap pic (pixel values != 0 are obstacles) to imax x jmax
+ * cells by the rule, returns the new bitmap (0 fluid, 1 obstacle), pic is left as it is.
+ */
+int **resample_bitmap(int **pic, int width, int height, int imax, int jmax, GeometryResampling rule);
+
+/**
+ * Repairs the forbidden cells of the Flags, obstacle cells with fluid on two opposite sides,
+ * which geometryCheck() rejects. Only the obstacle bits of the inner cells are read and
+ * changed, the boundary cells around the domain count as obstacles. The sweeps are repeated
+ * until no forbidden cell is left, each change is logged. Returns the number of changes.
+ */
+int repair_geometry(flag **Flag, int imax, int jmax, GeometryRepair repair);
+
+#endif
@@ -36,45 +36,8 @@ double fmax( double a, double b)
 /*                             custom auxiliary functions                  */
 /* ----------------------------------------------------------------------- */
 
-// Returns 1 (True) if the cell is an obstacle
-int isObstacle(int flag){
-    return (flag>>CENTER)&1;
-}
-
-// Returns 1 (True) if the cell is fluid
-int isFluid(int flag){
-    return !((flag>>CENTER)&1);
-}
-
-// Returns 1 (True) if the neighbouring cell in the indicated direction is an obstacle
-int isNeighbourObstacle(int flag, Direction direction){
-    return (flag>>direction)&1;
-}
-
-// Returns 1 (True) if the neighbouring cell in the indicated direction is fluid
-int isNeighbourFluid(int flag, Direction direction){
-    return !((flag>>direction)&1);
-}
-
-// Returns 1 (True) if the cell is present at a corner (bordering only 2 fluid cells)
-int isCorner(int flag){
-//    return ((flag&(1<<TOP))>>TOP)^((flag&(1<<BOT))>>BOT) && ((flag&(1<<LEFT))>>LEFT)^((flag&(1<<RIGHT))>>RIGHT);
-    return ((flag>>TOP)&1)^((flag>>BOT)&1) && ((flag>>LEFT)&1)^((flag>>RIGHT)&1);
-}
-
-
-// Computes skip condition for u-boundary value determination (if top, right and bottom cells are obstacles)
-int skipU(int flag){
-    return (flag&(1<<TOP)) && (flag&(1<<RIGHT)) && (flag&(1<<BOT));
-}
-
-// Computes skip condition for v-boundary value determination (if left, top and right cells are obstacles)
-int skipV(int flag){
-    return (flag&(1<<LEFT)) && (flag&(1<<TOP)) && (flag&(1<<RIGHT));
-}
-
 // Function that checks geometry for forbidden cases
-void geometryCheck(int** Flag, int imax, int jmax){
+void geometryCheck(flag** Flag, int imax, int jmax){
     int isForbidden = 0;
     for (int j = jmax; j > 0; j--)
     {
@@ -103,6 +66,22 @@ void geometryCheck(int** Flag, int imax, int jmax){
 }
 
 
+// Precomputes the per-kernel masks from the geometry bits (see flags.h)
+void set_kernel_masks(flag** Flag, int imax, int jmax){
+    for (int i = 0; i <= imax + 1; i++)
+    {
+        for (int j = 0; j <= jmax + 1; j++)
+        {
+            flag f = Flag[i][j] & GEOMETRY_BITS;
+            f |= (isFluid(f) && isNeighbourFluid(f, RIGHT)) << U_EDGE;
+            f |= (isFluid(f) && isNeighbourFluid(f, TOP)) << V_EDGE;
+            f |= isFluid(f) << P_CELL;
+            Flag[i][j] = f;
+        }
+    }
+}
+
+
 /* ----------------------------------------------------------------------- */
 /*                         local auxiliary functions                       */
 /* ----------------------------------------------------------------------- */
@@ -141,47 +120,83 @@ void errhandler( int nLine, const char *szFile, const char *szString )
 
 /*  for comfort */
 #define READ_ERROR(szMessage, szVarName, szFileName, nLine) \
-  { char szTmp[80]; \
+  { char szTmp[3 * MAX_LINE_LENGTH]; \
     if( nLine ) \
-	sprintf( szTmp, " %s  File: %s   Variable: %s  Line: %d", szMessage, szFileName, szVarName, nLine ); \
+	snprintf( szTmp, sizeof(szTmp), " %s  File: %s   Variable: %s  Line: %d", szMessage, szFileName, szVarName, nLine ); \
     else \
-	sprintf( szTmp, " %s  File: %s   Variable: %s ", szMessage, szFileName, szVarName); \
+	snprintf( szTmp, sizeof(szTmp), " %s  File: %s   Variable: %s ", szMessage, szFileName, szVarName); \
     ERROR( szTmp ); \
   }
     
 
+void read_config(const char *szFileName, Config *config)
+{
+    FILE *fh = fopen(szFileName, "rb");
+    if (fh == NULL)
+    {
+        char szBuff[300];
+        snprintf(szBuff, sizeof(szBuff), "Could not open file %s", szFileName);
+        ERROR(szBuff);
+    }
+    fseek(fh, 0, SEEK_END);
+    long size = ftell(fh);
+    fseek(fh, 0, SEEK_SET);
+    config->text = (char *) malloc(size + 1);
+    if (config->text == NULL || fread(config->text, 1, size, fh) != (size_t) size)
+    {
+        fclose(fh);
+        ERROR("Could not read the datafile");
+    }
+    config->text[size] = '\0';
+    fclose(fh);
+    snprintf(config->name, sizeof(config->name), "%s", szFileName);
+}
+
+void config_from_string(const char *name, const char *text, Config *config)
+{
+    config->text = (char *) malloc(strlen(text) + 1);
+    strcpy(config->text, text);
+    snprintf(config->name, sizeof(config->name), "%s", name);
+}
+
+void free_config(Config *config)
+{
+    free(config->text);
+    config->text = NULL;
+}
+
 /* --------------------------------------------------------------------------*/
-/* The function searches the datafile fh for the line defining the variable  */
-/* szVarName and returns the respctive string including the value of the     */
-/* variable. If there's no appropriate line within the datafile, the program */
-/* stops with an error messsage.                                             */
+/* Searches the datafile config from *szNext on for the next line defining   */
+/* the variable szVarName and returns the string of its value, NULL if there */
+/* is none. *szNext is moved past the line, *nLine counts the lines.         */
 /* ATTENTION: The pointer returned refers to a static variable within the    */
-/* function. To maintain the string over several program calls, it has to be */
-/* copied!!!                                                                 */
+/* function (one per thread). To maintain the string over several program    */
+/* calls, it has to be copied!!!                                             */
 /*                                                                           */
-char *find_string(const char *szFileName, const char *szVarName, Optional optional)
+static char *scanConfig(const Config *config, const char *szVarName, const char **szNext, int *nLine)
 { 
-    int nLine = 0;
     int i;
-    FILE *fh = NULL;
+    const char *szFileName = config->name;
     
-    static char szBuffer[MAX_LINE_LENGTH];	/* containes the line read  */
+    static __thread char szBuffer[MAX_LINE_LENGTH];	/* containes the line read  */
                                                /* from the datafile        */
 
     char* szLine = szBuffer;
     char* szValue = NULL;
     char* szName = NULL;
 
-    /* open file */
-    fh = fopen( szFileName, "rt" );
-    if( fh == 0 ) 
-	READ_ERROR("Could not open file", szVarName, szFileName, 0);
-
     /* searching */
-    while( ! feof(fh) )
+    while( **szNext )
     {
-	fgets( szLine, MAX_LINE_LENGTH, fh );
-	++nLine;
+	/* copy the next line, as fgets() would read it */
+	szLine = szBuffer;
+	i = 0;
+	while( (*szNext)[i] && (*szNext)[i] != '\n' && i < MAX_LINE_LENGTH - 2 ) ++i;
+	if( (*szNext)[i] == '\n' ) ++i;
+	memcpy( szLine, *szNext, i );
+	szLine[i] = '\0';
+	*szNext += i;
+	++*nLine;
 
 	/* remove comments */
 	for( i = 0; i < strlen(szLine); i++)
@@ -202,7 +217,7 @@ char *find_string(const char *szFileName, const char *szVarName, Optional option
 	
 	/* is the value for the respective name missing? */
 	if( *szValue == '\n' || strlen( szValue) == 0)  
-	    READ_ERROR("wrong format", szName, szFileName, nLine);
+	    READ_ERROR("wrong format", szName, szFileName, *nLine);
 	
 	*szValue = 0;		/* complete szName! at the right place */
 	++szValue;
@@ -213,94 +228,130 @@ char *find_string(const char *szFileName, const char *szVarName, Optional option
 	/* remove all leading blnkets and tabs from the value string  */
 	while( isspace( (int)*szValue) ) ++szValue;
 	if( *szValue == '\n' || strlen( szValue) == 0)  
-	    READ_ERROR("wrong format", szName, szFileName, nLine);
+	    READ_ERROR("wrong format", szName, szFileName, *nLine);
 	
-	fclose(fh);
 	return szValue;
     }  
+    return NULL;
+} 
+
+/* --------------------------------------------------------------------------*/
+/* The function searches the datafile config for the line defining the       */
+/* variable szVarName and returns the respctive string including the value of*/
+/* the variable. If there's no appropriate line within the datafile, the     */
+/* program stops with an error messsage.                                     */
+/* ATTENTION: The pointer returned refers to a static variable within the    */
+/* function (one per thread). To maintain the string over several program    */
+/* calls, it has to be copied!!!                                             */
+/*                                                                           */
+char *find_string(const Config *config, const char *szVarName, Optional optional)
+{ 
+    int nLine = 0;
+    const char *szNext = config->text;
+    char *szValue = scanConfig(config, szVarName, &szNext, &nLine);
    
-    if (optional == REQUIRED)
-        READ_ERROR("variable not found", szVarName, szFileName, nLine);
+    if (szValue == NULL && optional == REQUIRED)
+        READ_ERROR("variable not found", szVarName, config->name, nLine);
     
-    return NULL;		/* dummy to satisfy the compiler  */
+    return szValue;
 } 
 
-void read_string(const char *szFileName, const char *szVarName, char *pVariable, Optional optional)
+char *find_next_string(const Config *config, const char *szVarName, const char **szNext)
+{
+    int nLine = 0;
+    if (*szNext == NULL)
+        *szNext = config->text;
+    return scanConfig(config, szVarName, szNext, &nLine);
+}
+
+void read_string(const Config *config, const char *szVarName, char *pVariable, size_t size, Optional optional)
 {
     char* szValue = NULL;	/* string containg the read variable value */
 
     if( szVarName  == 0 )  ERROR("null pointer given as variable name" );
-    if( szFileName == 0 )  ERROR("null pointer given as filename" );
+    if( config     == 0 )  ERROR("null pointer given as datafile" );
     if( pVariable  == 0 )  ERROR("null pointer given as variable" );
 
     if( szVarName[0] == '*' )
-	szValue = find_string(szFileName, szVarName + 1, optional);
+	szValue = find_string(config, szVarName + 1, optional);
     else
-	szValue = find_string(szFileName, szVarName, optional);
+	szValue = find_string(config, szVarName, optional);
     
     if (szValue)
     {
-        if (sscanf(szValue, "%s", pVariable) == 0)
-        READ_ERROR("wrong format", szVarName, szFileName, 0);
+        // the first word of the value, as sscanf("%s") would read it
+        while (isspace((int) *szValue))
+            ++szValue;
+        size_t length = 0;
+        while (szValue[length] && !isspace((int) szValue[length]))
+            ++length;
+        if (length == 0)
+            READ_ERROR("wrong format", szVarName, config->name, 0);
+        if (length >= size)
+            READ_ERROR("value too long", szVarName, config->name, 0);
+        memcpy(pVariable, szValue, length);
+        pVariable[length] = '\0';
     }
-    else // If not found default to 0
+    else if (size > strlen("NULLSTRING")) // If not found default to 0
         strcpy(pVariable, "NULLSTRING");
+    else
+        READ_ERROR("buffer too small", szVarName, config->name, 0);
     
-    logMsg( "File: %s\t\t%s%s= %s", szFileName,
+    logMsg( "File: %s\t\t%s%s= %s", config->name,
             szVarName,
             &("               "[min_int( strlen(szVarName), 15)]),
             pVariable );
 }
 
-void read_int(const char *szFileName, const char *szVarName, int *pVariable, Optional optional)
+void read_int(const Config *config, const char *szVarName, int *pVariable, Optional optional)
 {
     char* szValue = NULL;	/* string containing the read variable value */
 
     if( szVarName  == 0 )  ERROR("null pointer given as varable name" );
-    if( szFileName == 0 )  ERROR("null pointer given as filename" );
+    if( config     == 0 )  ERROR("null pointer given as datafile" );
     if( pVariable  == 0 )  ERROR("null pointer given as variable" );
 
     if( szVarName[0] == '*' )
-	szValue = find_string(szFileName, szVarName + 1, optional);
+	szValue = find_string(config, szVarName + 1, optional);
     else
-	szValue = find_string(szFileName, szVarName, optional);
+	szValue = find_string(config, szVarName, optional);
     
     if (szValue)
     {
         if (sscanf(szValue, "%d", pVariable) == 0)
-        READ_ERROR("wrong format", szVarName, szFileName, 0);
+        READ_ERROR("wrong format", szVarName, config->name, 0);
     }
     else // If not found default to 0
         *pVariable = 0;
     
-    logMsg( "File: %s\t\t%s%s= %d", szFileName,
+    logMsg( "File: %s\t\t%s%s= %d", config->name,
             szVarName,
             &("               "[min_int( strlen(szVarName), 15)]),
             *pVariable );
 }
 
-void read_double(const char *szFileName, const char *szVarName, double *pVariable, Optional optional)
+void read_double(const Config *config, const char *szVarName, double *pVariable, Optional optional)
 {
     char* szValue = NULL;	/* String mit dem eingelesenen Variablenwert */
 
     if( szVarName  == 0 )  ERROR("null pointer given as varable name" );
-    if( szFileName == 0 )  ERROR("null pointer given as filename" );
+    if( config     == 0 )  ERROR("null pointer given as datafile" );
     if( pVariable  == 0 )  ERROR("null pointer given as variable" );
 
     if( szVarName[0] == '*' )
-	szValue = find_string(szFileName, szVarName + 1, optional);
+	szValue = find_string(config, szVarName + 1, optional);
     else
-        szValue = find_string(szFileName, szVarName, optional);
+        szValue = find_string(config, szVarName, optional);
     
     if (szValue)
     {
         if (sscanf(szValue, "%lf", pVariable) == 0)
-        READ_ERROR("wrong format", szVarName, szFileName, 0);
+        READ_ERROR("wrong format", szVarName, config->name, 0);
     }
     else // If not found default to 0
         *pVariable = 0.0;
     
-    logMsg( "File: %s\t\t%s%s= %f", szFileName,
+    logMsg( "File: %s\t\t%s%s= %f", config->name,
             szVarName,
             &("               "[min_int( strlen(szVarName), 15)]),
             *pVariable );
@@ -312,7 +363,7 @@ void read_double(const char *szFileName, const char *szVarName, double *pVariabl
 /* ----------------------------------------------------------------------- */
 
 void write_matrix( const char* szFileName,       /* filename */
-		   double **m,		       /* matrix */
+		   real **m,		       /* matrix */
 		   int nrl,		       /* first column */
 		   int nrh,		       /* last column */
 		   int ncl,		       /* first row */
@@ -334,8 +385,8 @@ void write_matrix( const char* szFileName,       /* filename */
        fh = fopen( szFileName, "w");	/* overwrite file/write new file */
        if( fh == NULL )			/* opening failed ? */
        {
-	   char szBuff[80];
-	   sprintf( szBuff, "Outputfile %s cannot be created", szFileName );
+	   char szBuff[MAX_LINE_LENGTH + 100];
+	   snprintf( szBuff, sizeof(szBuff), "Outputfile %s cannot be created", szFileName );
 	   ERROR( szBuff );
        }
        
@@ -370,7 +421,7 @@ void write_matrix( const char* szFileName,       /* filename */
 
 
 void read_matrix( const char* szFileName,       /* filename */
-		   double **m,		       /* matrix */
+		   real **m,		       /* matrix */
 		   int nrl,		       /* first column */
 		   int nrh,		       /* last column */
 		   int ncl,		       /* first row */
@@ -416,14 +467,16 @@ void read_matrix( const char* szFileName,       /* filename */
 /* ----------------------------------------------------------------------- */
 
 /*  allocates storage for a matrix                                         */
-double **matrix( int nrl, int nrh, int ncl, int nch )
+real **matrix( int nrl, int nrh, int ncl, int nch )
 {
    int i;
    int nrow = nrh - nrl + 1;	/* compute number of lines */
    int ncol = nch - ncl + 1;	/* compute number of columns */
    
-   double **pArray  = (double **) malloc((size_t)( nrow * sizeof(double*)) );
-   double  *pMatrix = (double *)  malloc((size_t)( nrow * ncol * sizeof( double )));
+   real **pArray  = (real **) malloc((size_t)( nrow * sizeof(real*)) );
+   /* zeroed storage: pages which are never written (e.g. deep inside obstacles,
+      see tiles.h) are never committed by the operating system */
+   real  *pMatrix = (real *)  calloc((size_t) nrow * ncol, sizeof( real ));
 
    if( pArray  == 0)  ERROR("Storage cannot be allocated");
    if( pMatrix == 0)  ERROR("Storage cannot be allocated");
@@ -444,16 +497,16 @@ double **matrix( int nrl, int nrh, int ncl, int nch )
 
 
 /* deallocates the storage of a matrix  */
-void free_matrix( double **m, int nrl, int nrh, int ncl, int nch )
+void free_matrix( real **m, int nrl, int nrh, int ncl, int nch )
 {
-   double **pArray  = m + nrl;
-   double  *pMatrix = m[nrl]+ncl;
+   real **pArray  = m + nrl;
+   real  *pMatrix = m[nrl]+ncl;
 
    free( pMatrix );
    free( pArray );
 }
 
-void init_matrix( double **m, int nrl, int nrh, int ncl, int nch, double a)
+void init_matrix( real **m, int nrl, int nrh, int ncl, int nch, real a)
 {
    int i,j;
    for( i = nrl; i <= nrh; i++)
@@ -462,6 +515,19 @@ void init_matrix( double **m, int nrl, int nrh, int ncl, int nch, double a)
 }
 
 
+real interpolate_bilinear(real **A, int imax, int jmax, double x0, double y0, double hx, double hy, double x, double y)
+{
+    double s = (x - x0) / hx;
+    double r = (y - y0) / hy;
+    int i = min(max((int) floor(s), 0), imax);
+    int j = min(max((int) floor(r), 0), jmax);
+    s = fmin(fmax(s - i, 0.0), 1.0);
+    r = fmin(fmax(r - j, 0.0), 1.0);
+    return (real) ((1 - s) * (1 - r) * A[i][j] + s * (1 - r) * A[i + 1][j]
+                   + (1 - s) * r * A[i][j + 1] + s * r * A[i + 1][j + 1]);
+}
+
+
 /* allocates storage for a matrix */
 int **imatrix( int nrl, int nrh, int ncl, int nch )
 {
@@ -510,7 +576,88 @@ void init_imatrix( int **m, int nrl, int nrh, int ncl, int nch, int a)
 }
 
 
-int **read_pgm(const char *filename) {
+/* allocates storage for a matrix of cell flags */
+flag **flagmatrix( int nrl, int nrh, int ncl, int nch )
+{
+   int i;
+
+   int nrow = nrh - nrl + 1;	/* compute number of rows */
+   int ncol = nch - ncl + 1;	/* compute number of columns */
+   
+   flag **pArray  = (flag **) malloc((size_t)( nrow * sizeof( flag* )) );
+   flag  *pMatrix = (flag *)  malloc((size_t)( nrow * ncol * sizeof( flag )));
+
+   if( pArray  == 0)  ERROR("Storage cannot be allocated");
+   if( pMatrix == 0)  ERROR("Storage cannot be allocated");
+
+   pArray[0] = pMatrix - ncl; 
+   for( i = 1; i < nrow; i++ )
+   {
+       pArray[i] = pArray[i-1] + ncol;
+   }
+   return pArray - nrl;
+}
+
+/* deallocates the storage of a matrix of cell flags */
+void free_flagmatrix( flag **m, int nrl, int nrh, int ncl, int nch )
+{
+   flag **pArray  = m + nrl;
+   flag  *pMatrix = m[nrl]+ncl;
+
+   free( pMatrix );
+   free( pArray );
+}
+
+void init_flagmatrix( flag **m, int nrl, int nrh, int ncl, int nch, flag a)
+{
+   int i,j;
+   for( i = nrl; i <= nrh; i++)
+       for( j = ncl; j <= nch; j++)
+	   m[i][j] = a;
+}
+
+/* allocates storage for a float matrix */
+float **fmatrix( int nrl, int nrh, int ncl, int nch )
+{
+   int i;
+
+   int nrow = nrh - nrl + 1;	/* compute number of rows */
+   int ncol = nch - ncl + 1;	/* compute number of columns */
+   
+   float **pArray  = (float **) malloc((size_t)( nrow * sizeof( float* )) );
+   float  *pMatrix = (float *)  calloc((size_t) nrow * ncol, sizeof( float ));
+
+   if( pArray  == 0)  ERROR("Storage cannot be allocated");
+   if( pMatrix == 0)  ERROR("Storage cannot be allocated");
+
+   pArray[0] = pMatrix - ncl; 
+   for( i = 1; i < nrow; i++ )
+   {
+       pArray[i] = pArray[i-1] + ncol;
+   }
+   return pArray - nrl;
+}
+
+/* deallocates the storage of a float matrix  */
+void free_fmatrix( float **m, int nrl, int nrh, int ncl, int nch )
+{
+   float **pArray  = m + nrl;
+   float  *pMatrix = m[nrl]+ncl;
+
+   free( pMatrix );
+   free( pArray );
+}
+
+void init_fmatrix( float **m, int nrl, int nrh, int ncl, int nch, float a)
+{
+   int i,j;
+   for( i = nrl; i <= nrh; i++)
+       for( j = ncl; j <= nch; j++)
+	   m[i][j] = a;
+}
+
+
+int **read_pgm(const char *filename, int *width, int *height) {
     FILE *input = NULL;
     char line[1024];
     int levels;
@@ -563,5 +710,7 @@ int **read_pgm(const char *filename) {
     /* close file */
     fclose(input);
 
+    *width = xsize;
+    *height = ysize;
     return pic;
 }
@@ -9,6 +9,8 @@
 #include <string.h>
 #include <float.h>
 #include <time.h>
+#include "precision.h"
+#include "flags.h"
 
 #ifdef PI
 #undef PI
@@ -24,8 +26,6 @@
 /**
  * Stores the last timer value 
  */
-//typedef enum Direction {CENTER=1, TOP=16, BOT=8, LEFT=4, RIGHT=2} Direction;
-typedef enum Direction {CENTER=0, TOP=4, BOT=3, LEFT=2, RIGHT=1} Direction;
 typedef enum Optional {REQUIRED, OPTIONAL} Optional;
 extern clock_t last_timer_reset;   
 
@@ -35,14 +35,9 @@ int max( int a, int b);
 double fmin( double a, double b);
 double fmax( double a, double b);
 
-int isObstacle(int flag);   // Current cell is an obstacle
-int isFluid(int flag);      // Current cell is fluid
-int isNeighbourObstacle(int flag, Direction direction); // Current cell's neighbor in the specified direction is obstacle
-int isNeighbourFluid(int flag, Direction direction);    // Current cell's neighbor in the specified direction is fluid
-int isCorner(int flag); // Current cell is a corner obstacle
-int skipU(int flag);    // Current cell is surrounded by obstacles to its Top-Right-Bottom
-int skipV(int flag);    // Current cell is surrounded by obstacles to its Left-Top-Right
-void geometryCheck(int** flag, int imax, int jmax);  //Checks if forbidden geometry is in pgm
+// The cell predicates (isObstacle(), isFluid(), isNeighbourFluid(), ...) are inline in flags.h
+void geometryCheck(flag** Flag, int imax, int jmax);  //Checks if forbidden geometry is in pgm
+void set_kernel_masks(flag** Flag, int imax, int jmax);  //Precomputes the U_EDGE, V_EDGE and P_CELL bits
 
 
 /**
@@ -76,6 +71,23 @@ void geometryCheck(int** flag, int imax, int jmax);  //Checks if forbidden geome
 void  errhandler( int nLine, const char *szFile, const char *szString );
 
 
+/**
+ * Contents of a datafile the READ_*() macros read from: the text of a file, read
+ * into memory once by read_config() so that the variables are not searched for by
+ * opening the file over and over, or a text handed in by the caller with
+ * config_from_string() (e.g. parameters generated by a program, without a file).
+ * name is the file name, or whatever names the text in the messages.
+ */
+typedef struct Config
+{
+    char name[256];
+    char *text;
+} Config;
+
+void read_config(const char *szFileName, Config *config);
+void config_from_string(const char *name, const char *text, Config *config);
+void free_config(Config *config);
+
 /**
  * Reading from a datafile.
  *
@@ -83,10 +95,10 @@ void  errhandler( int nLine, const char *szFile, const char *szString );
  * If a variable cannot be found, the program stops with an error message.
  *
  * Example:
- * READ_INT( "MyFile.dat", imax );
- * READ_STRING( szFile, szProblem );
+ * READ_INT( &config, imax );
+ * READ_STRING( &config, szProblem );
  */
-#define READ_INT( szFileName, VarName, Optional)    read_int   ( szFileName, #VarName, &(VarName), Optional )
+#define READ_INT( config, VarName, Optional)    read_int   ( config, #VarName, &(VarName), Optional )
 
 /**
  * Reading from a datafile.
@@ -95,10 +107,10 @@ void  errhandler( int nLine, const char *szFile, const char *szString );
  * If a variable cannot be found, the program stops with an error message.
  *
  * Example:
- * READ_INT( "MyFile.dat", imax );
- * READ_STRING( szFile, szProblem );
+ * READ_INT( &config, imax );
+ * READ_STRING( &config, szProblem );
  */
-#define READ_DOUBLE( szFileName, VarName, Optional) read_double( szFileName, #VarName, &(VarName), Optional )
+#define READ_DOUBLE( config, VarName, Optional) read_double( config, #VarName, &(VarName), Optional )
 
 /**
  * Reading from a datafile.
@@ -107,14 +119,27 @@ void  errhandler( int nLine, const char *szFile, const char *szString );
  * If a variable cannot be found, the program stops with an error message.
  *
  * Example:
- * READ_INT( "MyFile.dat", imax );
- * READ_STRING( szFile, szProblem );
+ * READ_INT( &config, imax );
+ * READ_STRING( &config, szProblem );
+ */
+#define READ_STRING( config, VarName, Optional) read_string( config, #VarName,  (VarName), sizeof(VarName), Optional )
+
+/**
+ * Iterates over the lines defining the variable szName, for the variables which may be
+ * given several times: *szNext is NULL at the first call and moved past the line found
+ * by each call. Returns its value string (in a static buffer, copy it to keep it) or
+ * NULL after the last one.
  */
-#define READ_STRING( szFileName, VarName, Optional) read_string( szFileName, #VarName,  (VarName), Optional )
+char *find_next_string(const Config *config, const char *szName, const char **szNext);
 
-void read_string(const char *szFilename, const char *szName, char *sValue, Optional optional);
-void read_int(const char *szFilename, const char *szName, int *nValue, Optional optional);
-void read_double(const char *szFilename, const char *szName, double *Value, Optional optional);
+/**
+ * Reads the string variable szName into sValue, a buffer of size characters (READ_STRING() takes
+ * the size of the array it is given, call read_string() directly for a pointer). A value which
+ * does not fit stops with an error message.
+ */
+void read_string(const Config *config, const char *szName, char *sValue, size_t size, Optional optional);
+void read_int(const Config *config, const char *szName, int *nValue, Optional optional);
+void read_double(const Config *config, const char *szName, double *Value, Optional optional);
 
 
 /**
@@ -170,7 +195,7 @@ void read_double(const char *szFilename, const char *szName, double *Value, Opti
  */
 void write_matrix( 
   const char* szFileName,
-  double **m,
+  real **m,
   int nrl,
   int nrh,
   int ncl,
@@ -189,7 +214,7 @@ void write_matrix(
  * @param nch           last row
  */
 void read_matrix( const char* szFileName,	               /* filehandle */
-		  double **m,		       /* matrix */
+		  real **m,		       /* matrix */
 		  int nrl,		       /* first column */
 		  int nrh,		       /* last column */
 		  int ncl,		       /* first row */
@@ -197,7 +222,8 @@ void read_matrix( const char* szFileName,	               /* filehandle */
 
 
 /**
- * matrix(...)        storage allocation for a matrix (nrl..nrh, ncl..nch)
+ * matrix(...)        storage allocation for a matrix (nrl..nrh, ncl..nch),
+ *                    the entries are zeroed
  * free_matrix(...)   storage deallocation
  * init_matrix(...)   initialization of all matrix entries with a fixed
  *                  (floating point) value
@@ -208,7 +234,7 @@ void read_matrix( const char* szFileName,	               /* filehandle */
  *    init_matrix( U , 0, imax+1, 0, jmax+1, 0 );
  *    free_matrix( U,  0, imax+1, 0, jmax+1 );
  */
-double **matrix( int nrl, int nrh, int ncl, int nch );
+real **matrix( int nrl, int nrh, int ncl, int nch );
 /**
  * matrix(...)        storage allocation for a matrix (nrl..nrh, ncl..nch)
  * free_matrix(...)   storage deallocation
@@ -221,7 +247,7 @@ double **matrix( int nrl, int nrh, int ncl, int nch );
  *    init_matrix( U , 0, imax+1, 0, jmax+1, 0 );
  *    free_matrix( U,  0, imax+1, 0, jmax+1 );
  */
-void free_matrix( double **m, int nrl, int nrh, int ncl, int nch );
+void free_matrix( real **m, int nrl, int nrh, int ncl, int nch );
 /**
  * matrix(...)        storage allocation for a matrix (nrl..nrh, ncl..nch)
  * free_matrix(...)   storage deallocation
@@ -234,7 +260,14 @@ void free_matrix( double **m, int nrl, int nrh, int ncl, int nch );
  *    init_matrix( U , 0, imax+1, 0, jmax+1, 0 );
  *    free_matrix( U,  0, imax+1, 0, jmax+1 );
  */
-void init_matrix( double **m, int nrl, int nrh, int ncl, int nch, double a);
+void init_matrix( real **m, int nrl, int nrh, int ncl, int nch, real a);
+
+/**
+ * Bilinear interpolation at (x, y) of the matrix A over 0..imax+1 x 0..jmax+1, whose entry
+ * (i, j) lies at (x0 + i hx, y0 + j hy), e.g. x0 = 0, y0 = -dy/2 for U on the staggered grid.
+ * Beyond the entries the nearest ones are taken.
+ */
+real interpolate_bilinear(real **A, int imax, int jmax, double x0, double y0, double hx, double hy, double x, double y);
 
 /**
  * matrix(...)        storage allocation for a matrix (nrl..nrh, ncl..nch)
@@ -276,11 +309,27 @@ void free_imatrix( int **m, int nrl, int nrh, int ncl, int nch );
  */
 void init_imatrix( int **m, int nrl, int nrh, int ncl, int nch, int a);
 
+/**
+ * flagmatrix(...)    analog for matrices of cell flags (one byte per cell, see flags.h)
+ */
+flag **flagmatrix( int nrl, int nrh, int ncl, int nch );
+void free_flagmatrix( flag **m, int nrl, int nrh, int ncl, int nch );
+void init_flagmatrix( flag **m, int nrl, int nrh, int ncl, int nch, flag a);
+
+/**
+ * fmatrix(...)       analog for matrices with float-entries, independent of the
+ *                    precision chosen for real (used by the mixed precision solvers)
+ */
+float **fmatrix( int nrl, int nrh, int ncl, int nch );
+void free_fmatrix( float **m, int nrl, int nrh, int ncl, int nch );
+void init_fmatrix( float **m, int nrl, int nrh, int ncl, int nch, float a);
+
 
 /**
- * reads in a ASCII pgm-file and returns the colour information in a two-dimensional integer array.
+ * reads in a ASCII pgm-file and returns the colour information in a two-dimensional integer array,
+ * pic[x][y] over 0..width-1 x 0..height-1 (y upwards), its size in width and height.
  */
-int **read_pgm(const char *filename);
+int **read_pgm(const char *filename, int *width, int *height);
 
 
 /**
@@ -2,6 +2,7 @@
 #include "init.h"
 #include "logger.h"
 #include "boundary_configurator.h"
+#include "geometry.h"
 
 void setDefaultStringIfRequired(char *variable, const char *defaultValue)
 {
@@ -11,45 +12,49 @@ void setDefaultStringIfRequired(char *variable, const char *defaultValue)
     }
 }
 
-int read_parameters(const char *szFileName, double *Re, double *UI, double *VI, double *PI, double *GX, double *GY,
+int read_parameters(const Config *config, double *Re, double *UI, double *VI, double *PI, double *GX, double *GY,
                     double *t_end, double *xlength, double *ylength, double *dt, double *dx, double *dy, int *imax,
                     int *jmax, double *alpha, double *omg, double *tau, int *itermax, double *eps, double *dt_value,
                     char *problem, char *geometry, BoundaryInfo boundaryInfo[4],
                     double *beta, double *TI, double *T_h, double *T_c,
                     double *Pr)    /* path/filename to geometry file */
 {
-    READ_DOUBLE(szFileName, *xlength, REQUIRED);
-    READ_DOUBLE(szFileName, *ylength, REQUIRED);
+    READ_DOUBLE(config, *xlength, REQUIRED);
+    READ_DOUBLE(config, *ylength, REQUIRED);
     
-    READ_DOUBLE(szFileName, *Re, REQUIRED);
-    READ_DOUBLE(szFileName, *t_end, REQUIRED);
-    READ_DOUBLE(szFileName, *dt, REQUIRED);
+    READ_DOUBLE(config, *Re, REQUIRED);
+    READ_DOUBLE(config, *t_end, REQUIRED);
+    READ_DOUBLE(config, *dt, REQUIRED);
     
-    READ_INT   (szFileName, *imax, REQUIRED);
-    READ_INT   (szFileName, *jmax, REQUIRED);
+    READ_INT   (config, *imax, REQUIRED);
+    READ_INT   (config, *jmax, REQUIRED);
     
-    READ_DOUBLE(szFileName, *omg, REQUIRED);
-    READ_DOUBLE(szFileName, *eps, REQUIRED);
-    READ_DOUBLE(szFileName, *tau, REQUIRED);
-    READ_DOUBLE(szFileName, *alpha, REQUIRED);
+    READ_DOUBLE(config, *omg, REQUIRED);
+    READ_DOUBLE(config, *eps, REQUIRED);
+    READ_DOUBLE(config, *tau, REQUIRED);
+    READ_DOUBLE(config, *alpha, REQUIRED);
     
-    READ_INT   (szFileName, *itermax, REQUIRED);
-    READ_DOUBLE(szFileName, *dt_value, REQUIRED);
+    READ_INT   (config, *itermax, REQUIRED);
+    READ_DOUBLE(config, *dt_value, REQUIRED);
     
-    READ_DOUBLE(szFileName, *UI, REQUIRED);
-    READ_DOUBLE(szFileName, *VI, REQUIRED);
-    READ_DOUBLE(szFileName, *GX, REQUIRED);
-    READ_DOUBLE(szFileName, *GY, REQUIRED);
-    READ_DOUBLE(szFileName, *PI, REQUIRED);
+    READ_DOUBLE(config, *UI, REQUIRED);
+    READ_DOUBLE(config, *VI, REQUIRED);
+    READ_DOUBLE(config, *GX, REQUIRED);
+    READ_DOUBLE(config, *GY, REQUIRED);
+    READ_DOUBLE(config, *PI, REQUIRED);
     
-    READ_DOUBLE(szFileName, *beta, OPTIONAL);
-    READ_DOUBLE(szFileName, *TI, OPTIONAL);
-    READ_DOUBLE(szFileName, *T_h, OPTIONAL);
-    READ_DOUBLE(szFileName, *T_c, OPTIONAL);
-    READ_DOUBLE(szFileName, *Pr, OPTIONAL);
+    READ_DOUBLE(config, *beta, OPTIONAL);
+    READ_DOUBLE(config, *TI, OPTIONAL);
+    READ_DOUBLE(config, *T_h, OPTIONAL);
+    READ_DOUBLE(config, *T_c, OPTIONAL);
+    READ_DOUBLE(config, *Pr, OPTIONAL);
     
-    READ_STRING(szFileName, problem, REQUIRED);
-    READ_STRING(szFileName, geometry, REQUIRED);
+    read_string(config, "problem", problem, PROBLEM_LENGTH, REQUIRED);
+    read_string(config, "geometry", geometry, GEOMETRY_LENGTH, REQUIRED);
+    if (is_shape_geometry(geometry))
+    {
+        read_shapes(config, geometry, GEOMETRY_LENGTH);
+    }
     
     *dx = *xlength / (double) (*imax);
     *dy = *ylength / (double) (*jmax);
@@ -69,23 +74,23 @@ int read_parameters(const char *szFileName, double *Re, double *UI, double *VI,
     double bottom_boundary_V;
     
     char *boundaryTypeDefault = "NOSLIP";
-    READ_STRING(szFileName, left_boundary_type, OPTIONAL);
+    READ_STRING(config, left_boundary_type, OPTIONAL);
     setDefaultStringIfRequired(left_boundary_type, boundaryTypeDefault);
-    READ_STRING(szFileName, right_boundary_type, OPTIONAL);
+    READ_STRING(config, right_boundary_type, OPTIONAL);
     setDefaultStringIfRequired(right_boundary_type, boundaryTypeDefault);
-    READ_STRING(szFileName, top_boundary_type, OPTIONAL);
+    READ_STRING(config, top_boundary_type, OPTIONAL);
     setDefaultStringIfRequired(top_boundary_type, boundaryTypeDefault);
-    READ_STRING(szFileName, bottom_boundary_type, OPTIONAL);
+    READ_STRING(config, bottom_boundary_type, OPTIONAL);
     setDefaultStringIfRequired(bottom_boundary_type, boundaryTypeDefault);
     
-    READ_DOUBLE(szFileName, left_boundary_U, OPTIONAL);
-    READ_DOUBLE(szFileName, left_boundary_V, OPTIONAL);
-    READ_DOUBLE(szFileName, right_boundary_U, OPTIONAL);
-    READ_DOUBLE(szFileName, right_boundary_V, OPTIONAL);
-    READ_DOUBLE(szFileName, top_boundary_U, OPTIONAL);
-    READ_DOUBLE(szFileName, top_boundary_V, OPTIONAL);
-    READ_DOUBLE(szFileName, bottom_boundary_U, OPTIONAL);
-    READ_DOUBLE(szFileName, bottom_boundary_V, OPTIONAL);
+    READ_DOUBLE(config, left_boundary_U, OPTIONAL);
+    READ_DOUBLE(config, left_boundary_V, OPTIONAL);
+    READ_DOUBLE(config, right_boundary_U, OPTIONAL);
+    READ_DOUBLE(config, right_boundary_V, OPTIONAL);
+    READ_DOUBLE(config, top_boundary_U, OPTIONAL);
+    READ_DOUBLE(config, top_boundary_V, OPTIONAL);
+    READ_DOUBLE(config, bottom_boundary_U, OPTIONAL);
+    READ_DOUBLE(config, bottom_boundary_V, OPTIONAL);
     
     configureBoundary(boundaryInfo, LEFTBOUNDARY, left_boundary_type, left_boundary_U, left_boundary_V);
     configureBoundary(boundaryInfo, RIGHTBOUNDARY, right_boundary_type, right_boundary_U, right_boundary_V);
@@ -96,43 +101,198 @@ int read_parameters(const char *szFileName, double *Re, double *UI, double *VI,
     return 1;
 }
 
-void init_uvpt(double UI, double VI, double PI, double TI, int imax, int jmax, double **U, double **V, double **P,
-               double **T, int **Flags)
+void read_parameter_config(const Config *config, Parameters *parameters)
 {
-    init_matrix(U, 0, imax + 1, 0, jmax + 1, UI);
-    init_matrix(V, 0, imax + 1, 0, jmax + 1, VI);
-    init_matrix(P, 0, imax + 1, 0, jmax + 1, PI);
-    init_matrix(T, 0, imax + 1, 0, jmax + 1, TI);
-    for (int i = 0; i <= imax + 1; ++i)
+    Parameters *p = parameters;
+    read_parameters(config, &p->Re, &p->UI, &p->VI, &p->PI, &p->GX, &p->GY, &p->t_end, &p->xlength, &p->ylength,
+                    &p->dt, &p->dx, &p->dy, &p->imax, &p->jmax, &p->alpha, &p->omg, &p->tau, &p->itermax, &p->eps,
+                    &p->dt_value, p->problem, p->geometry, p->boundaryInfo, &p->beta, &p->TI, &p->T_h, &p->T_c, &p->Pr);
+}
+
+void read_parameter_set(const char *szFileName, Parameters *parameters)
+{
+    Config config;
+    read_config(szFileName, &config);
+    read_parameter_config(&config, parameters);
+    free_config(&config);
+}
+
+void read_solver_options(const char *szFileName, SolverOptions *options)
+{
+    Config config;
+    read_config(szFileName, &config);
+    read_solver_options_config(&config, options);
+    free_config(&config);
+}
+
+void read_solver_options_config(const Config *config, SolverOptions *options)
+{
+    int refinement_sweeps;
+    int sparse_storage;
+    int sparse_block;
+    int tile_i;
+    int tile_j;
+    int tile_autotune;
+    int sor_block;
+    int omega_adaptive;
+    int pressure_extrapolation;
+    int viscous_implicit;
+    int semi_lagrangian;
+    int grid_levels;
+    double steady_tolerance;
+    char pressure_solver[16];
+    char time_integration[16];
+    char geometry_resampling[16];
+    char geometry_repair[16];
+    READ_INT   (config, refinement_sweeps, OPTIONAL);
+    READ_INT   (config, sparse_storage, OPTIONAL);
+    READ_INT   (config, sparse_block, OPTIONAL);
+    READ_INT   (config, tile_i, OPTIONAL);
+    READ_INT   (config, tile_j, OPTIONAL);
+    READ_INT   (config, tile_autotune, OPTIONAL);
+    READ_INT   (config, sor_block, OPTIONAL);
+    READ_INT   (config, omega_adaptive, OPTIONAL);
+    READ_INT   (config, pressure_extrapolation, OPTIONAL);
+    READ_INT   (config, viscous_implicit, OPTIONAL);
+    READ_INT   (config, semi_lagrangian, OPTIONAL);
+    READ_INT   (config, grid_levels, OPTIONAL);
+    READ_DOUBLE(config, steady_tolerance, OPTIONAL);
+    READ_STRING(config, pressure_solver, OPTIONAL);
+    setDefaultStringIfRequired(pressure_solver, "AUTO");
+    READ_STRING(config, time_integration, OPTIONAL);
+    setDefaultStringIfRequired(time_integration, "EULER");
+    READ_STRING(config, geometry_resampling, OPTIONAL);
+    setDefaultStringIfRequired(geometry_resampling, "NEAREST");
+    READ_STRING(config, geometry_repair, OPTIONAL);
+    setDefaultStringIfRequired(geometry_repair, "REMOVE");
+    options->refinementSweeps = refinement_sweeps;
+    options->sparseStorage = sparse_storage;
+    options->sparseBlock = (sparse_block > 0) ? sparse_block : 16;
+    options->tileI = tile_i;
+    options->tileJ = tile_j;
+    options->tileAutotune = tile_autotune;
+    options->sorBlock = sor_block;
+    options->gridLevels = grid_levels;
+    options->steadyTolerance = steady_tolerance;
+    options->omegaAdaptive = omega_adaptive;
+    options->pressureExtrapolation = pressure_extrapolation;
+    options->viscousImplicit = viscous_implicit;
+    options->semiLagrangian = semi_lagrangian;
+    if (strcmp(pressure_solver, "AUTO") == 0)
+        options->pressureSolver = PRESSURE_SOLVER_AUTO;
+    else if (strcmp(pressure_solver, "SOR") == 0)
+        options->pressureSolver = PRESSURE_SOLVER_SOR;
+    else if (strcmp(pressure_solver, "DCT") == 0)
+        options->pressureSolver = PRESSURE_SOLVER_DCT;
+    else if (strcmp(pressure_solver, "LINE") == 0)
+        options->pressureSolver = PRESSURE_SOLVER_LINE;
+    else
+        ERROR("pressure_solver must be AUTO, SOR, DCT or LINE");
+    if (strcmp(time_integration, "EULER") == 0)
+        options->timeIntegration = TIME_INTEGRATION_EULER;
+    else if (strcmp(time_integration, "AB2") == 0)
+        options->timeIntegration = TIME_INTEGRATION_AB2;
+    else
+        ERROR("time_integration must be EULER or AB2");
+    if (strcmp(geometry_resampling, "NEAREST") == 0)
+        options->geometryResampling = RESAMPLING_NEAREST;
+    else if (strcmp(geometry_resampling, "MAJORITY") == 0)
+        options->geometryResampling = RESAMPLING_MAJORITY;
+    else if (strcmp(geometry_resampling, "AREA") == 0)
+        options->geometryResampling = RESAMPLING_AREA;
+    else
+        ERROR("geometry_resampling must be NEAREST, MAJORITY or AREA");
+    if (strcmp(geometry_repair, "REMOVE") == 0)
+        options->geometryRepair = REPAIR_REMOVE;
+    else if (strcmp(geometry_repair, "FILL") == 0)
+        options->geometryRepair = REPAIR_FILL;
+    else if (strcmp(geometry_repair, "NONE") == 0)
+        options->geometryRepair = REPAIR_NONE;
+    else
+        ERROR("geometry_repair must be REMOVE, FILL or NONE");
+}
+
+/* init_uvpt() on K lanes of the fields (K = 1: plain fields, ENSEMBLE_WIDTH: ensemble fields), lane k from UI[k], ... */
+static inline void initLanes(int K, const double *UI, const double *VI, const double *PI, const double *TI, real **U,
+                             real **V, real **P, real **T, flag **Flags, const TileList *tiles)
+{
+    // Only the tiles are touched: the cells outside of them are obstacles, which are 0 from the allocation.
+    for (int t = 0; t < tiles->numTiles; t++)
     {
-        for (int j = 0; j <= jmax + 1; ++j)
+        const Tile *tile = tiles->tiles + t;
+        for (int i = tile->ilo; i <= tile->ihi; ++i)
         {
-            if (isObstacle(Flags[i][j]))
+            for (int j = tile->jlo; j <= tile->jhi; ++j)
             {
-                U[i][j] = 0;
-                V[i][j] = 0;
-                P[i][j] = 0;
-                T[i][j] = 0;
+                int fluid = isFluid(Flags[i][j]);
+                for (int k = 0; k < K; k++)
+                {
+                    U[i][j * K + k] = fluid ? UI[k] : 0;
+                    V[i][j * K + k] = fluid ? VI[k] : 0;
+                    P[i][j * K + k] = fluid ? PI[k] : 0;
+                    T[i][j * K + k] = fluid ? TI[k] : 0;
+                }
             }
         }
     }
 }
 
+void init_uvpt(double UI, double VI, double PI, double TI, int imax, int jmax, real **U, real **V, real **P,
+               real **T, flag **Flags, const TileList *tiles)
+{
+    initLanes(1, &UI, &VI, &PI, &TI, U, V, P, T, Flags, tiles);
+}
+
+void init_uvpt_ensemble(const double *UI, const double *VI, const double *PI, const double *TI, int imax, int jmax,
+                        real **U, real **V, real **P, real **T, flag **Flags, const TileList *tiles)
+{
+    initLanes(ENSEMBLE_WIDTH, UI, VI, PI, TI, U, V, P, T, Flags, tiles);
+}
+
+int **load_geometry(const char *geometry, int imax, int jmax, double xlength, double ylength,
+                    GeometryResampling resampling)
+{
+    if (is_shape_geometry(geometry))
+    {
+        return rasterise_shapes(geometry, imax, jmax, xlength, ylength);
+    }
+    int width, height;
+    int **pic = read_pgm(geometry, &width, &height); // NOTE: this is covering just the inner part of the image
+    if (width != imax || height != jmax)
+    {
+        // resampled to the imax*jmax cells, the forbidden cells it may leave are repaired with the others
+        static const char *RULES[] = {"nearest", "majority", "area"};
+        int **cells = resample_bitmap(pic, width, height, imax, jmax, resampling);
+        free_imatrix(pic, 0, width - 1, 0, height - 1);
+        pic = cells;
+        logMsg("Geometry: %d x %d image resampled to %d x %d cells (%s)",
+               width, height, imax, jmax, RULES[resampling]);
+    }
+    return pic;
+}
+
 void init_flag(
         char *problem,
         char *geometry,
         int imax,
         int jmax,
-        int **Flag,
+        double xlength,
+        double ylength,
+        GeometryResampling resampling,
+        GeometryRepair repair,
+        flag **Flag,
         int *counter
 )
 {
-    int **pic = NULL;
-    
-    pic = read_pgm(geometry); // NOTE: this is covering just the inner part of the image, so it is imax*jmax
-    
-    // Set the outer boundary + the first inner layers
-    for (int i = 0; i < imax + 1; ++i)
+    int **pic = load_geometry(geometry, imax, jmax, xlength, ylength, resampling);
+    init_flag_bitmap(pic, imax, jmax, repair, Flag, counter);
+    free_imatrix(pic, 0, imax - 1, 0, jmax - 1);
+}
+
+void init_flag_bitmap(int **pic, int imax, int jmax, GeometryRepair repair, flag **Flag, int *counter)
+{
+    // Set the outer boundary + the first inner layers (corners included)
+    for (int i = 0; i <= imax + 1; ++i)
     {
         // Outer boundary
         Flag[i][0] = 1;
@@ -152,6 +312,11 @@ void init_flag(
             Flag[i][j] = pic[i - 1][j - 1];
         }
     }
+    int repaired = repair_geometry(Flag, imax, jmax, repair);
+    if (repaired > 0)
+    {
+        logMsg("Geometry: %d forbidden cells repaired (%s)", repaired, (repair == REPAIR_FILL) ? "filled" : "removed");
+    }
     *counter = 0;
     // Set the boundary domain flags
     for (int j = 1; j < jmax + 1; ++j)
@@ -191,6 +356,11 @@ void init_flag(
         logRawString("\n");
     }
     logMsg("Total fluid cells in domain: %d", (*counter));
+    // nothing to solve for, and the residual is normalised by the number of fluid cells
+    if (*counter == 0)
+        ERROR((repaired > 0) ? "Geometry: no fluid cells left after the repair, try geometry_repair REMOVE"
+                             : "Geometry: no fluid cells");
     geometryCheck(Flag, imax, jmax);
-    free_imatrix(pic, 0, imax + 1, 0, jmax + 1);
+    // Precompute the U-update, V-update and pressure masks used by the kernels
+    set_kernel_masks(Flag, imax, jmax);
 }
@@ -1,19 +1,27 @@
 #ifndef __INIT_H_
 #define __INIT_H_
 
+#include "helper.h"
 #include "boundary_val.h"
+#include "tiles.h"
+#include "ensemble.h"
+#include "geometry.h"
+
+#define PROBLEM_LENGTH 256   // size of the problem string, the prefix of the output files
 
 /**
  * This operation initializes all the local variables reading a configuration
  * file. For every variable a macro like READ_INT() is called passing it the
- * input filename and the variable to be written to. This macro calls
+ * configuration (the file read into memory, see Config) and the variable to be
+ * written to. This macro calls
  * an operation read_int() augmenting the parameter set with the name of the
  * variable to be read. The read_int() operation parses the input file, extracts
  * the value of the variable, sets the variable and finally prints some debug
  * information. This is possible as the macro adds the name of the variable to
  * be set. All the helper operations can be found within helper.h and helper.c.
  *
- * @param szFileName char pointer to the filename
+ * @param config     contents of the configuration file (read_config()) or a text
+ *                   in the same format (config_from_string())
  * @param Re         Reynolds number
  * @param UI         initial velocity in  x-direction - used by init_uvp()
  * @param VI         initial velocity y-direction - used by init_upv()
@@ -39,30 +47,176 @@
  * @param eps        tolerance limit for pressure calculation
  * @param dt_value   time steps for output (after how many time steps one should
  *                   write into the output file)
- * @param problem    the problem short string (no spaces please!)
- * @param geometry   /path/to/geometry.pgm file
+ * @param problem    the problem short string (no spaces please!), PROBLEM_LENGTH characters
+ * @param geometry   GEOMETRY_LENGTH characters: /path/to/geometry.pgm file, or "shapes" followed by obstacle lines
+ *                   (see geometry.h), which are gathered into the string
  */
-int read_parameters(const char *szFileName, double *Re, double *UI, double *VI, double *PI, double *GX, double *GY,
+int read_parameters(const Config *config, double *Re, double *UI, double *VI, double *PI, double *GX, double *GY,
                     double *t_end, double *xlength, double *ylength, double *dt, double *dx, double *dy, int *imax,
                     int *jmax, double *alpha, double *omg, double *tau, int *itermax, double *eps, double *dt_value,
                     char *problem, char *geometry, BoundaryInfo boundaryInfo[4], 
                     double *beta, double *TI, double *T_h, double *T_c, double* Pr);
 
+/**
+ * The parameters read by read_parameters(), gathered in one struct so that they can be
+ * handed around as a whole (e.g. to the cases of a parameter sweep, see sweep.h).
+ */
+typedef struct Parameters
+{
+    double Re;
+    double UI;
+    double VI;
+    double PI;
+    double GX;
+    double GY;
+    double t_end;
+    double xlength;
+    double ylength;
+    double dt;
+    double dx;
+    double dy;
+    int imax;
+    int jmax;
+    double alpha;
+    double omg;
+    double tau;
+    int itermax;
+    double eps;
+    double dt_value;
+    char problem[PROBLEM_LENGTH];
+    char geometry[GEOMETRY_LENGTH]; // bigger since this can be a full path, or the shapes
+    BoundaryInfo boundaryInfo[4];
+    double beta;
+    double TI;
+    double T_h;
+    double T_c;
+    double Pr;
+} Parameters;
+
+/**
+ * read_parameters() into a Parameters struct.
+ */
+void read_parameter_config(const Config *config, Parameters *parameters);
+
+/**
+ * read_parameter_config() of the configuration file szFileName.
+ */
+void read_parameter_set(const char *szFileName, Parameters *parameters);
+
+// Pressure solver of the time steps
+typedef enum PressureSolver
+{
+    PRESSURE_SOLVER_AUTO, // the direct solver in closed domains for which it is cheap, SOR otherwise
+    PRESSURE_SOLVER_SOR,  // SOR iterations (sor() and its variants)
+    PRESSURE_SOLVER_DCT,  // direct solver (fast_poisson()), closed domains only
+    PRESSURE_SOLVER_LINE  // line SOR iterations (line_sor()), for strongly anisotropic cells
+} PressureSolver;
+
+// Time integration of the momentum step
+typedef enum TimeIntegration
+{
+    TIME_INTEGRATION_EULER, // explicit Euler (calculate_fg())
+    TIME_INTEGRATION_AB2    // second order Adams-Bashforth (adams_bashforth_fg())
+} TimeIntegration;
+
+/**
+ * Optional numerical settings of the solver. All of them are read with
+ * read_solver_options() and default to 0, i.e. the plain algorithm, but for the
+ * pressure solver, which is chosen from the geometry by default.
+ */
+typedef struct SolverOptions
+{
+    int refinementSweeps; // > 0: mixed precision refinement of the pressure, with this many float SOR sweeps per step
+    int sparseStorage;    // 1: the kernels only visit the tiles holding fluid (see tiles.h)
+    int sparseBlock;      // tile size of the sparse storage, 16 if not given
+    int tileI;            // > 0: tile size in x-direction of the traversal of the kernels (see tiles.h)
+    int tileJ;            // > 0: tile size in y-direction of the traversal of the kernels
+    int tileAutotune;     // 1: choose the tile size by timing the pressure solver (tune_tiles())
+    int sorBlock;         // > 1: SOR iterations per temporally blocked pass (sor_blocked()), residual checked after each
+    int omegaAdaptive;    // 1: omg is estimated during the first steps instead of taken from the file (AdaptiveOmega)
+    int pressureExtrapolation; // 1, 2: initial guess of the pressure solve extrapolated in time (PressureHistory)
+    PressureSolver pressureSolver; // AUTO if not given
+    int viscousImplicit;  // 1: viscous terms implicit (implicit_viscous_fg()), dt only limited by the convection
+    TimeIntegration timeIntegration; // EULER if not given
+    int semiLagrangian;   // > 0: semi-Lagrangian advection (calculate_fg_semi_lagrangian()), dt up to this many cells per step
+    GeometryResampling geometryResampling; // NEAREST if not given, rule of the resampling of a PGM of another size
+    GeometryRepair geometryRepair;         // REMOVE if not given, rule of the repair of forbidden cells
+    int gridLevels;       // > 1: grid sequencing (simulation_sequence()), over this many grids each halving the cells
+    double steadyTolerance; // > 0: the runs stop at the steady state, once max |dU/dt|, |dV/dt| is below it
+} SolverOptions;
+
+/**
+ * Reads the optional solver settings (see SolverOptions) from the configuration file:
+ *
+ * @param refinement_sweeps  number of float SOR sweeps per refinement step of sor_refined(), 0 for plain sor()
+ * @param sparse_storage     1 to skip the blocks of cells lying deep inside obstacles (see tiles.h)
+ * @param sparse_block       edge length in cells of those blocks, 16 if not given
+ * @param tile_i, tile_j     tile size of the traversal of the kernels, the whole grid if not given
+ * @param tile_autotune      1 to pick the tile size at start-up among a few candidates, by timing sor()
+ * @param sor_block          number of SOR iterations per pass of sor_blocked(), 0 or 1 for plain sor()
+ * @param omega_adaptive     1 to replace omg by the optimum estimated during the first timesteps
+ * @param pressure_extrapolation  order of the extrapolation of the initial pressure guess, 1 linear, 2 quadratic
+ * @param pressure_solver    AUTO, SOR, DCT or LINE (see PressureSolver), AUTO if not given
+ * @param viscous_implicit   1 to treat the viscous terms implicitly (ADI), which lifts the diffusive bound on dt
+ * @param time_integration   EULER or AB2 (see TimeIntegration), EULER if not given
+ * @param semi_lagrangian    N > 0 for semi-Lagrangian advection with up to N times the convective bound on dt
+ * @param geometry_resampling  NEAREST, MAJORITY or AREA (see GeometryResampling), NEAREST if not given
+ * @param geometry_repair      REMOVE, FILL or NONE (see GeometryRepair), REMOVE if not given
+ * @param grid_levels        N > 1 to start from the steady state of N-1 coarser grids, each with half the cells
+ * @param steady_tolerance   > 0 to stop the runs at the steady state, once max |dU/dt|, |dV/dt| is below it
+ */
+void read_solver_options_config(const Config *config, SolverOptions *options);
+
+/**
+ * read_solver_options_config() of the configuration file szFileName.
+ */
+void read_solver_options(const char *szFileName, SolverOptions *options);
+
 /**
  * The arrays U,V and P are initialized to the constant values UI, VI and PI on
- * the whole domain.
+ * the fluid cells of the tiles, and to 0 on their obstacle cells.
+ */
+void init_uvpt(double UI, double VI, double PI, double TI, int imax, int jmax, real **U, real **V, real **P,
+               real **T, flag **Flags, const TileList *tiles);
+
+/**
+ * init_uvpt() for the ENSEMBLE_WIDTH lanes of ensemble fields (see ensemble.h), lane k
+ * initialised to UI[k], VI[k], PI[k] and TI[k].
  */
-void init_uvpt(double UI, double VI, double PI, double TI, int imax, int jmax, double **U, double **V, double **P,
-               double **T, int **Flags);
+void init_uvpt_ensemble(const double *UI, const double *VI, const double *PI, const double *TI, int imax, int jmax,
+                        real **U, real **V, real **P, real **T, flag **Flags, const TileList *tiles);
 
+/**
+ * The geometry as a bitmap of imax x jmax cells, as read_pgm() returns it (pic[i][j], j upwards,
+ * 1 obstacle, 0 fluid): the PGM file it names, resampled by the rule resampling if its size
+ * differs, or the shapes it describes, rasterised on the cells of the xlength x ylength domain.
+ */
+int **load_geometry(const char *geometry, int imax, int jmax, double xlength, double ylength,
+                    GeometryResampling resampling);
+
+/**
+ * Sets the Flags from the geometry, the bitmap of load_geometry() (see geometry.h).
+ */
 void init_flag(
   char* problem,
   char* geometry,
   int imax,
   int jmax,
-  int** Flag,
+  double xlength,
+  double ylength,
+  GeometryResampling resampling,
+  GeometryRepair repair,
+  flag** Flag,
   int* counter
 );
 
+/**
+ * init_flag() from a geometry bitmap in memory instead of the PGM file: pic[i][j] over
+ * 0..imax-1 x 0..jmax-1, as read_pgm() returns it (j upwards, 1 obstacle, 0 fluid).
+ * The forbidden cells are repaired in the Flags by the rule repair (see repair_geometry()),
+ * pic is left as it is.
+ */
+void init_flag_bitmap(int **pic, int imax, int jmax, GeometryRepair repair, flag **Flag, int *counter);
+
 #endif
 
@@ -14,22 +14,40 @@
  *   time must be the current simulation time, message a printf-friendly string,
  *   then optional args in prtf style can be passed.
  * 3) Make sure to call closeLogfile() before exiting the main (this closes the file at OS level).
+ * 4) redirectLog() switches to another log file, e.g. one per case of a parameter sweep, optionally
+ *    without the console output.
+ * The log is per thread (several simulation contexts may run in one process, see simulation.h):
+ * a thread which has opened no log file of its own only logs to the console.
  */
 static char* LOG_FILE_NAME = "sim.log";
-static FILE* LOG_FILE;
+static __thread FILE* LOG_FILE;
+static __thread int LOG_CONSOLE = 1;
 
 void openLogFile()
 {
     LOG_FILE = fopen(LOG_FILE_NAME, "w");
 }
 
+void redirectLog(const char *fileName, int console)
+{
+    if (LOG_FILE != NULL)
+        fclose(LOG_FILE);
+    LOG_FILE = fopen(fileName, "w");
+    LOG_CONSOLE = console;
+}
+
 void logRawString(char *fmt, ...)
 {
     // Newline at the end of the message is included.
     va_list args;
-    va_start(args,fmt);
-    vprintf(fmt, args);
-    va_end(args);
+    if (LOG_CONSOLE)
+    {
+        va_start(args,fmt);
+        vprintf(fmt, args);
+        va_end(args);
+    }
+    if (LOG_FILE == NULL)
+        return;
     va_start(args,fmt);
     vfprintf(LOG_FILE, fmt, args);
     va_end(args);
@@ -39,11 +57,16 @@ void logEvent(double t, char *fmt, ...)
 {
     // Newline at the end of the message is included.
     va_list args;
-    va_start(args,fmt);
-    printf("[%12.9f] ", t);
-    vprintf(fmt, args);
-    printf("\n");
-    va_end(args);
+    if (LOG_CONSOLE)
+    {
+        va_start(args,fmt);
+        printf("[%12.9f] ", t);
+        vprintf(fmt, args);
+        printf("\n");
+        va_end(args);
+    }
+    if (LOG_FILE == NULL)
+        return;
     va_start(args,fmt);
     fprintf(LOG_FILE, "[%12.9f] ", t);
     vfprintf(LOG_FILE, fmt, args);
@@ -55,11 +78,16 @@ void logMsg(char *fmt, ...)
 {
     // Newline at the end of the message is included.
     va_list args;
-    va_start(args,fmt);
-    printf("---> ");
-    vprintf(fmt, args);
-    printf("\n");
-    va_end(args);
+    if (LOG_CONSOLE)
+    {
+        va_start(args,fmt);
+        printf("---> ");
+        vprintf(fmt, args);
+        printf("\n");
+        va_end(args);
+    }
+    if (LOG_FILE == NULL)
+        return;
     va_start(args,fmt);
     fprintf(LOG_FILE, "---> ");
     vfprintf(LOG_FILE, fmt, args);
@@ -69,5 +97,7 @@ void logMsg(char *fmt, ...)
 
 void closeLogFile()
 {
-    fclose(LOG_FILE);
+    if (LOG_FILE != NULL)
+        fclose(LOG_FILE);
+    LOG_FILE = NULL;
 }
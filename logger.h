@@ -6,6 +6,7 @@
 #define SIM_LOGGER_H
 
 void openLogFile();
+void redirectLog(const char *fileName, int console);
 void logRawString(char *fmt, ...);
 void logEvent(double t, char *fmt, ...);
 void logMsg(char *fmt, ...);
@@ -2,9 +2,14 @@
 #include "visual.h"
 #include "init.h"
 #include "sor.h"
+#include "poisson.h"
 #include "boundary_val.h"
 #include "uvp.h"
 #include "logger.h"
+#include "sweep.h"
+#include "simulation.h"
+#include "amr.h"
+#include <unistd.h>
 
 
 /**
@@ -31,166 +36,187 @@
  *
  * - calculate_dt() Determine the maximal time step size.
  * - boundaryvalues() Set the boundary values for the next time step.
- * - calculate_fg() Determine the values of F and G (diffusion and confection).
+ * - calculate_fg() Determine the values of F and G (diffusion and confection),
+ *   or calculate_fg_semi_lagrangian() with the convection along the characteristics.
  *   This is the right hand side of the pressure equation and used later on for
- *   the time step transition.
+ *   the time step transition. Optionally, adams_bashforth_fg() then makes the
+ *   step second order and implicit_viscous_fg() the diffusion implicit.
  * - calculate_rs()
  * - Iterate the pressure poisson equation until the residual becomes smaller
  *   than eps or the maximal number of iterations is performed. Within the
- *   iteration loop the operation sor() is used.
+ *   iteration loop the operation sor() is used (line_sor() on request). On
+ *   rectangles with few obstacles the equation is solved directly by
+ *   fast_poisson() instead.
  * - calculate_uv() Calculate the velocity at the next time step.
+ *
+ * The time loop is simulation_step() of the solver library (see simulation.h), main()
+ * runs one context from t = 0 to t_end (or to the steady state, optionally starting from the
+ * steady state of coarser grids, see simulation_sequence()). Its set-up only depends on the grid and the
+ * geometry, so that with --sweep (see sweep.h) it is done once and shared by all the
+ * cases, each of which restarts the context with its own parameters, or with --ensemble
+ * runs ENSEMBLE_WIDTH of them in lock-step (simulation_run_ensemble()).
  */
 
-// TODO: check if geometry is not forbidden!
+// The context of a run and the refinement patches of the .dat file (see amr.h)
+typedef struct Run
+{
+    Simulation *sim;
+    AmrSettings amr;
+} Run;
+
+// Runs the context from t = 0 to t_end, or to the steady state, sequenced from coarser grids if asked for
+static void runToEnd(Simulation *sim, const AmrSettings *amrSettings)
+{
+    const Parameters *p = &sim->parameters;
+    if (amr_enabled(amrSettings))
+    {
+        Amr *amr = amr_create(sim, amrSettings);
+        amr_run_until(amr, p->t_end);
+        amr_write_results(amr);
+        amr_destroy(amr);
+        return;
+    }
+    simulation_sequence(sim);
+    if (sim->options.steadyTolerance > 0)
+        simulation_run_steady(sim, p->t_end, sim->options.steadyTolerance);
+    else
+        simulation_run_until(sim, p->t_end);
+    simulation_write_results(sim);
+}
+
+// Worker of a sweep case: the parameters of the case, its own log file and no console output
+static void runSweepCase(const SweepCase *cases, int numCases, void *data)
+{
+    Run *run = (Run *) data;
+    Simulation *sim = run->sim;
+    Parameters parameters = sim->parameters;
+    apply_sweep_case(cases, &parameters);
+    char szLogName[300];
+    snprintf(szLogName, sizeof(szLogName), "%s.log", parameters.problem);
+    redirectLog(szLogName, 0);
+    simulation_reset(sim, &parameters);
+    runToEnd(sim, &run->amr);
+    closeLogFile();
+}
+
+// Worker of an ensemble of sweep cases, logging to the log file of its first case
+static void runEnsembleCases(const SweepCase *cases, int numCases, void *data)
+{
+    const Simulation *sim = (const Simulation *) data;
+    Parameters lanes[ENSEMBLE_WIDTH];
+    for (int k = 0; k < numCases; k++)
+    {
+        lanes[k] = sim->parameters;
+        apply_sweep_case(cases + k, lanes + k);
+    }
+    char szLogName[300];
+    snprintf(szLogName, sizeof(szLogName), "%s.log", lanes[0].problem);
+    redirectLog(szLogName, 0);
+    simulation_run_ensemble(sim, lanes, numCases);
+    closeLogFile();
+}
+
+// The ensemble runs the plain algorithm in lock-step: checks the options and that the lanes of each group agree
+static void checkEnsemble(const Parameters *parameters, const SolverOptions *o, const SweepCase *cases, int numCases)
+{
+    simulation_check_ensemble(o);
+    for (int first = 0; first < numCases; first += ENSEMBLE_WIDTH)
+    {
+        Parameters a = *parameters;
+        apply_sweep_case(cases + first, &a);
+        for (int c = first + 1; c < min(first + ENSEMBLE_WIDTH, numCases); c++)
+        {
+            Parameters b = *parameters;
+            apply_sweep_case(cases + c, &b);
+            if (a.t_end != b.t_end || a.dt_value != b.dt_value || a.tau != b.tau || a.itermax != b.itermax)
+            {
+                char szBuff[MAX_LINE_LENGTH];
+                snprintf(szBuff, sizeof(szBuff), "--ensemble: cases %s and %s differ in t_end, dt_value, tau or itermax",
+                         cases[first].name, cases[c].name);
+                ERROR(szBuff);
+            }
+        }
+    }
+}
 
 int main(int argc, char** argv){
 
+    if (argc < 2)
+    {
+        printf("Usage: %s PROBLEM [--sweep CASES_FILE [--jobs N] [--ensemble]]\n", argv[0]);
+        return 1;
+    }
     // Handling the problem file name which is passed as 1st argument.
 	char szFileName[256]; // We assume name will not be longer than 256 chars...
     strcpy(szFileName, argv[1]);
     strcat(szFileName, ".dat");
-    //
-	char problem[256];
-    char geometry[1024]; // bigger since this can be a full path
-	double Re;                /* reynolds number   */
-    double UI;                /* velocity x-direction */
-    double VI;                /* velocity y-direction */
-    double PI;                /* pressure */
-    double GX;                /* gravitation x-direction */
-    double GY;                /* gravitation y-direction */
-    double t_end;             /* end time */
-    double xlength;           /* length of the domain x-dir.*/
-    double ylength;           /* length of the domain y-dir.*/
-    double dt;                /* time step */
-    double dx;                /* length of a cell x-dir. */
-    double dy;                /* length of a cell y-dir. */
-    int  imax;                /* number of cells x-direction*/
-    int  jmax;                /* number of cells y-direction*/
-    double alpha;             /* uppwind differencing factor*/
-    double omg;               /* relaxation factor */
-    double tau;               /* safety factor for time step*/
-	int  itermax;			  /* max. number of iterations  */
-    double eps;               /* accuracy bound for pressure*/
-    double dt_value;          /* time for output */
-	int n = 0;				  /* timestep iteration counter */
-	double res = 10;		  /* residual */
-	double t = 0;			  /* initial time */
-	int it;					  /* sor iteration counter */
-	double mindt=10000;       /* arbitrary counter that keeps track of minimum dt value in calculation */
-	int noFluidCells;		  /* number of fluid cells in simulation */
-	double beta; 			  /* coefficient of thermal expansion */
-	double TI; 				  /* initial temperature */
-	double T_h; 				  /* hot surface boundary condition */
-	double T_c; 			      /* cold surface boundary condition */
-	double Pr; 				  /* Prandtl number */
+    // Parameter sweep (see sweep.h), by default as many cases at a time as there are cores
+    const char *sweepFile = NULL;
+    int jobs = (int) sysconf(_SC_NPROCESSORS_ONLN);
+    int ensemble = 0;
+    for (int a = 2; a < argc; a++)
+    {
+        if (strcmp(argv[a], "--sweep") == 0 && a + 1 < argc)
+            sweepFile = argv[++a];
+        else if (strcmp(argv[a], "--jobs") == 0 && a + 1 < argc)
+            jobs = atoi(argv[++a]);
+        else if (strcmp(argv[a], "--ensemble") == 0)
+            ensemble = 1;
+        else
+        {
+            printf("Unknown argument %s\n", argv[a]);
+            return 1;
+        }
+    }
 
-    BoundaryInfo boundaryInfo[4];
+    Parameters parameters;
+    SolverOptions options;
+    Run run;
 
     openLogFile(); // Initialize the log file descriptor.
+    logMsg("Field precision: %s", SIM_PRECISION_NAME);
     
-    read_parameters(szFileName, &Re, &UI, &VI, &PI, &GX, &GY, &t_end, &xlength, &ylength, &dt, &dx, &dy, &imax, &jmax,
-                    &alpha, &omg,
-                    &tau, &itermax, &eps, &dt_value, problem, geometry, boundaryInfo,
-                    &beta, &TI, &T_h, &T_c, &Pr);
+    Config config;
+    read_config(szFileName, &config);
+    read_parameter_config(&config, &parameters);
+    read_solver_options_config(&config, &options);
+    read_amr_settings(&config, &run.amr);
+    free_config(&config);
+    if (amr_enabled(&run.amr) && (options.gridLevels > 1 || options.steadyTolerance > 0))
+        ERROR("The refinement patches run to t_end, remove grid_levels and steady_tolerance");
+    // the cases are checked before anything is set up
+    SweepCase *cases = NULL;
+    int numCases = (sweepFile != NULL) ? read_sweep(sweepFile, &cases) : 0;
+    ensemble = ensemble && sweepFile != NULL;
+    if (ensemble)
+    {
+        // lanes of ensemble fields, point SOR on all of them
+        if (options.pressureSolver == PRESSURE_SOLVER_AUTO)
+            options.pressureSolver = PRESSURE_SOLVER_SOR;
+        checkEnsemble(&parameters, &options, cases, numCases);
+        if (amr_enabled(&run.amr))
+            ERROR("--ensemble does not run refinement patches");
+    }
 
-    int** Flags = imatrix(0, imax+1, 0, jmax+1);
-    double** U = matrix(0, imax+1, 0, jmax+1);
-    double** V = matrix(0, imax+1, 0, jmax+1);
-    double** F = matrix(0, imax+1, 0, jmax+1);
-    double** G = matrix(0, imax+1, 0, jmax+1);
-    double** RS = matrix(0, imax+1, 0, jmax+1);
-    double** P = matrix(0, imax+1, 0, jmax+1);
-    double** T = matrix(0, imax+1, 0, jmax+1);
-    
-    // create flag array to determine boundary connditions
-    init_flag(problem, geometry, imax, jmax, Flags, &noFluidCells);
-    
-    // initialise velocities and pressure
-    init_uvpt(UI, VI, PI, TI, imax, jmax, U, V, P, T, Flags);
-    
-//    // Debug
-//    logEvent(t, "INFO: Writing visualization file n=%d", n);
-//    write_vtkFile(problem, n, xlength, ylength, imax, jmax, dx, dy, U, V, P, T);
-//    n++;
-//
-	// simulation interval 0 to t_end
-	double currentOutputTime = 0; // For chosing when to output
-	while(t < t_end){
-		
-		// adaptive stepsize control based on stability conditions ensures stability of the method!
-		// dt = tau * min(cond1, cond2, cond3) where tau is a safety factor
-		// NOTE: if tau<0, stepsize is not adaptively computed!
-		if(tau > 0){
-			calculate_dt(Re, Pr, tau, &dt, dx, dy, imax, jmax, U, V);
-            dt = fmin(dt, dt_value); // test, to avoid a dt bigger than visualization interval
-			// Used to check the minimum time-step for convergence
-			if (dt < mindt)
-				mindt = dt;
-		}
-		
-		// ensure boundary conditions for velocity
-        // Special boundary condition are addressed here by using the boundaryInfo data.
-        // These special boundary values are configured at configuration time in read_parameters(). Still TODO !
-        boundaryvalues(imax, jmax, U, V, Flags, boundaryInfo);
+    // flags, tiles and pressure solver of the geometry, then the fields at t = 0 (see simulation.h)
+    Simulation *sim = simulation_create(&parameters, &options);
+    run.sim = sim;
 
-		// calculate T using energy equation in 2D with boussinesq approximation
-//        calculate_T(Re, Pr, dt, dx, dy, alpha, imax, jmax, T, U, V);
-        
-		// momentum equations M1 and M2 - F and G are the terms arising from explicit Euler velocity update scheme
-        calculate_fg(Re, GX, GY, alpha, beta, dt, dx, dy, imax, jmax, U, V, F, G, T, Flags);
-		
-		// momentum equations M1 and M2 are plugged into continuity equation C to produce PPE - depends on F and G - RS is the rhs of the implicit pressure update scheme
-        calculate_rs(dt, dx, dy, imax, jmax, F, G, RS, Flags);
-		
-		// solve the system of eqs arising from implicit pressure uptate scheme using succesive overrelaxation solver
-		it = 0;
-        res = 1e9;
-        while(it < itermax && res > eps){
-            sor(omg, dx, dy, imax, jmax, P, RS, Flags, &res, noFluidCells);
-			it++;
-		}
-        if (it == itermax)
-        {
-            logEvent(t, "WARNING: max number of iterations reached on SOR. Probably it did not converge!");
-        }
-		// calculate velocities acc to explicit Euler velocity update scheme - depends on F, G and P
-        calculate_uv(dt, dx, dy, imax, jmax, U, V, F, G, P, Flags);
-		
-		// write visualization file for current iteration (only every dt_value step)
-		if (t >= currentOutputTime)
-		{
-            logEvent(t, "INFO: Writing visualization file n=%d", n);
-            write_vtkFile(problem, n, xlength, ylength, imax, jmax, dx, dy, U, V, P, T, Flags);
-			currentOutputTime += dt_value;
-			// update output timestep iteration counter
-			n++;
-		}
-        // Recap shell output
-        logEvent(t, "INFO: dt=%f, numSorIterations=%d, sorResidual=%f", dt, it, res);
-		// advance in time
-		t += dt;
-	}
-
-	// write visualisation file for the last iteration
-    logEvent(t, "INFO: Writing visualization file n=%d", n);
-    write_vtkFile(problem, n, xlength, ylength, imax, jmax, dx, dy, U, V, P, T, Flags);
-
-	// Check value of U[imax/2][7*jmax/8] (task6)
-    logMsg("Final value for U[imax/2][7*jmax/8] = %16e", U[imax / 2][7 * jmax / 8]);
+    int failed = 0;
+    if (sweepFile != NULL)
+    {
+        failed = ensemble ? run_sweep(cases, numCases, ENSEMBLE_WIDTH, jobs, runEnsembleCases, sim)
+                          : run_sweep(cases, numCases, 1, jobs, runSweepCase, &run);
+        free_sweep(cases);
+    }
+    else
+    {
+        runToEnd(sim, &run.amr);
+    }
 
-    free_imatrix( Flags, 0, imax+1, 0, jmax+1);
-    free_matrix( U, 0, imax+1, 0, jmax+1);
-	free_matrix( V, 0, imax+1, 0, jmax+1);
-	free_matrix( F, 0, imax+1, 0, jmax+1);
-	free_matrix( G, 0, imax+1, 0, jmax+1);
-	free_matrix( RS, 0, imax+1, 0, jmax+1);
-	free_matrix( P, 0, imax+1, 0, jmax+1);
-	free_matrix( T, 0, imax+1, 0, jmax+1);
-    
-    logMsg("Min dt value used: %16e", mindt);
+    simulation_destroy(sim);
     
     closeLogFile(); // Properly close the log file
 
-	return 0;
+	return failed != 0;
 }
-
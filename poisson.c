@@ -0,0 +1,567 @@
+#include "poisson.h"
+#include "helper.h"
+#include "sor.h"
+#include <math.h>
+
+// Largest prime factor of imax and jmax for which the direct solver is chosen automatically
+#define DCT_MAX_FACTOR 13
+// Largest number of obstacle cells next to fluid (size of the capacitance matrix) chosen automatically
+#define CAPACITANCE_MAX_CELLS 512
+
+static double *realVector(long n)
+{
+    double *v = (double *) malloc((size_t) n * sizeof(double));
+    if (v == NULL)
+        ERROR("Storage cannot be allocated");
+    return v;
+}
+
+static int smallestFactor(int n)
+{
+    for (int p = 2; p * p <= n; p++)
+    {
+        if (n % p == 0)
+            return p;
+    }
+    return n;
+}
+
+static int largestFactor(int n)
+{
+    int p = 1;
+    while (n > 1)
+    {
+        p = smallestFactor(n);
+        n /= p;
+    }
+    return p;
+}
+
+/*
+ * Work vectors of the FFTs: input, output and the buffer of the p point DFTs, each entry
+ * being a vector of batch values, split into real and imaginary parts.
+ */
+typedef struct FftWork
+{
+    double *inRe, *inIm;
+    double *outRe, *outIm;
+    double *tmpRe, *tmpIm;
+} FftWork;
+
+/*
+ * Mixed radix decimation in time FFT of the n entries in[0], in[stride], ... into out[0..n-1].
+ * The n/p point transforms of the p interleaved subsequences are combined by p point DFTs,
+ * with a dedicated butterfly for p = 2. sign = -1 is the forward transform, +1 the (unscaled)
+ * inverse one, exp(sign 2 pi i x / n) being read from the tables of the full length of the plan.
+ */
+static void fft(const DctPlan *plan, double sign, int n, int stride, const double *inRe, const double *inIm,
+                double *outRe, double *outIm, double *tmpRe, double *tmpIm)
+{
+    int B = plan->batch;
+    int p = smallestFactor(n);
+    int q = n / p;
+    long step = plan->n / n;   // angle x / n at index x * step of the tables
+    long stepP = plan->n / p;  // angle x / p at index x * stepP
+    if (q == 1)
+    {
+        // p point DFT of the input
+        for (int m = 0; m < p; m++)
+        {
+            double *yRe = outRe + (long) m * B, *yIm = outIm + (long) m * B;
+            for (int b = 0; b < B; b++)
+            {
+                yRe[b] = inRe[b];
+                yIm[b] = inIm[b];
+            }
+            for (int r = 1, rm = m; r < p; r++, rm = (rm + m) % p)
+            {
+                double c = plan->cosTable[rm * stepP], s = sign * plan->sinTable[rm * stepP];
+                const double *xRe = inRe + (long) r * stride * B, *xIm = inIm + (long) r * stride * B;
+                for (int b = 0; b < B; b++)
+                {
+                    yRe[b] += c * xRe[b] - s * xIm[b];
+                    yIm[b] += c * xIm[b] + s * xRe[b];
+                }
+            }
+        }
+        return;
+    }
+    for (int r = 0; r < p; r++)
+    {
+        fft(plan, sign, q, stride * p, inRe + (long) r * stride * B, inIm + (long) r * stride * B,
+            outRe + (long) r * q * B, outIm + (long) r * q * B, tmpRe, tmpIm);
+    }
+    if (p == 2)
+    {
+        for (int k = 0; k < q; k++)
+        {
+            double c = plan->cosTable[k * step], s = sign * plan->sinTable[k * step];
+            double *aRe = outRe + (long) k * B, *aIm = outIm + (long) k * B;
+            double *bRe = outRe + (long) (q + k) * B, *bIm = outIm + (long) (q + k) * B;
+            for (int b = 0; b < B; b++)
+            {
+                double wRe = c * bRe[b] - s * bIm[b];
+                double wIm = c * bIm[b] + s * bRe[b];
+                bRe[b] = aRe[b] - wRe;
+                bIm[b] = aIm[b] - wIm;
+                aRe[b] += wRe;
+                aIm[b] += wIm;
+            }
+        }
+        return;
+    }
+    for (int k = 0; k < q; k++)
+    {
+        // twiddled inputs of the p point DFT of index k
+        for (int r = 0; r < p; r++)
+        {
+            double c = plan->cosTable[r * k * step], s = sign * plan->sinTable[r * k * step];
+            const double *xRe = outRe + (long) (r * q + k) * B, *xIm = outIm + (long) (r * q + k) * B;
+            double *tRe = tmpRe + (long) r * B, *tIm = tmpIm + (long) r * B;
+            for (int b = 0; b < B; b++)
+            {
+                tRe[b] = c * xRe[b] - s * xIm[b];
+                tIm[b] = c * xIm[b] + s * xRe[b];
+            }
+        }
+        for (int m = 0; m < p; m++)
+        {
+            double *yRe = outRe + (long) (m * q + k) * B, *yIm = outIm + (long) (m * q + k) * B;
+            for (int b = 0; b < B; b++)
+            {
+                yRe[b] = tmpRe[b];
+                yIm[b] = tmpIm[b];
+            }
+            for (int r = 1, rm = m; r < p; r++, rm = (rm + m) % p)
+            {
+                double c = plan->cosTable[rm * stepP], s = sign * plan->sinTable[rm * stepP];
+                const double *tRe = tmpRe + (long) r * B, *tIm = tmpIm + (long) r * B;
+                for (int b = 0; b < B; b++)
+                {
+                    yRe[b] += c * tRe[b] - s * tIm[b];
+                    yIm[b] += c * tIm[b] + s * tRe[b];
+                }
+            }
+        }
+    }
+}
+
+static void initDctPlan(DctPlan *plan, int n, int batch)
+{
+    plan->n = n;
+    plan->batch = batch;
+    plan->cosTable = realVector(n);
+    plan->sinTable = realVector(n);
+    plan->shiftCos = realVector(n);
+    plan->shiftSin = realVector(n);
+    for (int k = 0; k < n; k++)
+    {
+        plan->cosTable[k] = cos(2.0 * M_PI * k / n);
+        plan->sinTable[k] = sin(2.0 * M_PI * k / n);
+        plan->shiftCos[k] = cos(M_PI * k / (2.0 * n));
+        plan->shiftSin[k] = sin(M_PI * k / (2.0 * n));
+    }
+}
+
+static void freeDctPlan(DctPlan *plan)
+{
+    free(plan->cosTable);
+    free(plan->sinTable);
+    free(plan->shiftCos);
+    free(plan->shiftSin);
+}
+
+/*
+ * DCT-II of the n x batch values of x into y (which may be x), along the first index:
+ * y[k] = sum_m x[m] cos(pi k (2m+1) / (2n)). Done by one complex FFT of length n of the
+ * even entries of x followed by the odd ones in reverse order (Makhoul).
+ */
+static void dct(const DctPlan *plan, const FftWork *work, const double *x, double *y)
+{
+    int n = plan->n;
+    int B = plan->batch;
+    for (int m = 0; m < n; m++)
+    {
+        const double *xm = x + (long) m * B;
+        double *zRe = work->inRe + (long) (m % 2 == 0 ? m / 2 : n - 1 - m / 2) * B;
+        double *zIm = work->inIm + (long) m * B;
+        for (int b = 0; b < B; b++)
+        {
+            zRe[b] = xm[b];
+            zIm[b] = 0;
+        }
+    }
+    fft(plan, -1, n, 1, work->inRe, work->inIm, work->outRe, work->outIm, work->tmpRe, work->tmpIm);
+    for (int k = 0; k < n; k++)
+    {
+        // Re(exp(-i pi k / (2n)) z[k])
+        double c = plan->shiftCos[k], s = plan->shiftSin[k];
+        const double *zRe = work->outRe + (long) k * B, *zIm = work->outIm + (long) k * B;
+        double *yk = y + (long) k * B;
+        for (int b = 0; b < B; b++)
+            yk[b] = c * zRe[b] + s * zIm[b];
+    }
+}
+
+// Inverse of dct(): x = DCT-III(y) / n with the first term halved, x may be y
+static void idct(const DctPlan *plan, const FftWork *work, const double *y, double *x)
+{
+    int n = plan->n;
+    int B = plan->batch;
+    for (int b = 0; b < B; b++)
+    {
+        work->inRe[b] = y[b];
+        work->inIm[b] = 0;
+    }
+    for (int k = 1; k < n; k++)
+    {
+        // exp(i pi k / (2n)) (y[k] - i y[n-k])
+        double c = plan->shiftCos[k], s = plan->shiftSin[k];
+        const double *a = y + (long) k * B, *d = y + (long) (n - k) * B;
+        double *zRe = work->inRe + (long) k * B, *zIm = work->inIm + (long) k * B;
+        for (int b = 0; b < B; b++)
+        {
+            zRe[b] = c * a[b] + s * d[b];
+            zIm[b] = s * a[b] - c * d[b];
+        }
+    }
+    fft(plan, +1, n, 1, work->inRe, work->inIm, work->outRe, work->outIm, work->tmpRe, work->tmpIm);
+    for (int m = 0; m < n; m++)
+    {
+        const double *z = work->outRe + (long) (m % 2 == 0 ? m / 2 : n - 1 - m / 2) * B;
+        double *xm = x + (long) m * B;
+        for (int b = 0; b < B; b++)
+            xm[b] = z[b] / n;
+    }
+}
+
+// B = A^T, A being rows x cols, in cache sized blocks
+static void transpose(const double *A, double *B, int rows, int cols)
+{
+    const int block = 32;
+    for (int ib = 0; ib < rows; ib += block)
+    {
+        for (int jb = 0; jb < cols; jb += block)
+        {
+            for (int i = ib; i < min(ib + block, rows); i++)
+            {
+                for (int j = jb; j < min(jb + block, cols); j++)
+                    B[(long) j * rows + i] = A[(long) i * cols + j];
+            }
+        }
+    }
+}
+
+static inline long cellIndex(int jmax, int i, int j)
+{
+    return (long) (i - 1) * jmax + j - 1;
+}
+
+/*
+ * Solves L x = b in place in X (imax x jmax), L being the Laplacian of the rectangle with
+ * the constant mode given the eigenvalue gauge, or dropped (x of zero mean) if gauge is 0.
+ */
+static void solveRectangle(FastPoisson *poisson, double *X, double gauge)
+{
+    int imax = poisson->imax;
+    int jmax = poisson->jmax;
+    double *Y = poisson->Y;
+    FftWork work = {poisson->inRe, poisson->inIm, poisson->outRe, poisson->outIm, poisson->tmpRe, poisson->tmpIm};
+
+    // transform in x-direction (all the columns at once), then in y-direction on the transpose
+    dct(&poisson->planI, &work, X, X);
+    transpose(X, Y, imax, jmax);
+    dct(&poisson->planJ, &work, Y, Y);
+    for (int j = 0; j < jmax; j++)
+    {
+        for (int i = 0; i < imax; i++)
+        {
+            if (i > 0 || j > 0)
+                Y[(long) j * imax + i] /= poisson->eigenI[i] + poisson->eigenJ[j];
+        }
+    }
+    Y[0] = (gauge != 0) ? Y[0] / gauge : 0;
+    idct(&poisson->planJ, &work, Y, Y);
+    transpose(Y, X, jmax, imax);
+    idct(&poisson->planI, &work, X, X);
+}
+
+/*
+ * Row s of the correction of the capacitance matrix method applied to X: the equation of the
+ * obstacle cell, P minus its value from set_pressure_boundary(), minus the row of the rectangle
+ * Laplacian (Neumann mirror on the domain boundary) that the fast solve puts in its place.
+ */
+static double interfaceRow(const FastPoisson *poisson, flag **Flags, int s, const double *X)
+{
+    int imax = poisson->imax;
+    int jmax = poisson->jmax;
+    int i = poisson->interfaceI[s];
+    int j = poisson->interfaceJ[s];
+    flag C = Flags[i][j];
+    double center = X[cellIndex(jmax, i, j)];
+    double boundary = 0;
+    if (isCorner(C))
+    {
+        boundary = (X[cellIndex(jmax, i + isNeighbourObstacle(C, LEFT) - isNeighbourObstacle(C, RIGHT), j)] +
+                    X[cellIndex(jmax, i, j + isNeighbourObstacle(C, BOT) - isNeighbourObstacle(C, TOP))]) / 2;
+    }
+    else
+    {
+        boundary += !isNeighbourObstacle(C, TOP) ? X[cellIndex(jmax, i, j + 1)] : 0;
+        boundary += !isNeighbourObstacle(C, BOT) ? X[cellIndex(jmax, i, j - 1)] : 0;
+        boundary += !isNeighbourObstacle(C, RIGHT) ? X[cellIndex(jmax, i + 1, j)] : 0;
+        boundary += !isNeighbourObstacle(C, LEFT) ? X[cellIndex(jmax, i - 1, j)] : 0;
+    }
+    double left = (i > 1) ? X[cellIndex(jmax, i - 1, j)] : center;
+    double right = (i < imax) ? X[cellIndex(jmax, i + 1, j)] : center;
+    double bottom = (j > 1) ? X[cellIndex(jmax, i, j - 1)] : center;
+    double top = (j < jmax) ? X[cellIndex(jmax, i, j + 1)] : center;
+    double laplacian = (left - 2 * center + right) / (poisson->dx * poisson->dx) +
+                       (bottom - 2 * center + top) / (poisson->dy * poisson->dy);
+    return center - boundary - laplacian;
+}
+
+// LU decomposition with partial pivoting of the n x n row major matrix A, in place
+static void luDecompose(double *A, int *pivot, int n)
+{
+    for (int k = 0; k < n; k++)
+    {
+        int p = k;
+        for (int r = k + 1; r < n; r++)
+        {
+            if (fabs(A[(long) r * n + k]) > fabs(A[(long) p * n + k]))
+                p = r;
+        }
+        if (A[(long) p * n + k] == 0)
+            ERROR("Singular capacitance matrix");
+        pivot[k] = p;
+        for (int c = 0; c < n; c++)
+        {
+            double tmp = A[(long) k * n + c];
+            A[(long) k * n + c] = A[(long) p * n + c];
+            A[(long) p * n + c] = tmp;
+        }
+        for (int r = k + 1; r < n; r++)
+        {
+            double factor = A[(long) r * n + k] /= A[(long) k * n + k];
+            for (int c = k + 1; c < n; c++)
+                A[(long) r * n + c] -= factor * A[(long) k * n + c];
+        }
+    }
+}
+
+// Solves A x = b in place in b, A holding the factors of luDecompose()
+static void luSolve(const double *A, const int *pivot, int n, double *b)
+{
+    for (int k = 0; k < n; k++)
+    {
+        double tmp = b[k];
+        b[k] = b[pivot[k]];
+        b[pivot[k]] = tmp;
+    }
+    for (int r = 0; r < n; r++)
+    {
+        for (int c = 0; c < r; c++)
+            b[r] -= A[(long) r * n + c] * b[c];
+    }
+    for (int r = n - 1; r >= 0; r--)
+    {
+        for (int c = r + 1; c < n; c++)
+            b[r] -= A[(long) r * n + c] * b[c];
+        b[r] /= A[(long) r * n + r];
+    }
+}
+
+// Returns 1 if the obstacle cell (i, j) has a fluid neighbour, i.e. its pressure enters the fluid equations
+static int isInterfaceCell(flag **Flags, int i, int j)
+{
+    return isObstacle(Flags[i][j]) && (isFluid(Flags[i - 1][j]) || isFluid(Flags[i + 1][j]) ||
+                                       isFluid(Flags[i][j - 1]) || isFluid(Flags[i][j + 1]));
+}
+
+int count_interface_cells(flag **Flags, int imax, int jmax)
+{
+    int count = 0;
+    for (int i = 1; i <= imax; i++)
+    {
+        for (int j = 1; j <= jmax; j++)
+        {
+            count += isInterfaceCell(Flags, i, j);
+        }
+    }
+    return count;
+}
+
+int fast_poisson_suitable(flag **Flags, int imax, int jmax)
+{
+    return largestFactor(imax) <= DCT_MAX_FACTOR && largestFactor(jmax) <= DCT_MAX_FACTOR &&
+           count_interface_cells(Flags, imax, jmax) <= CAPACITANCE_MAX_CELLS;
+}
+
+/*
+ * Capacitance matrix of the interface cells: C = I + W L^-1 E, E putting a value on each interface
+ * cell and W being the rows of interfaceRow(), so m rectangle solves. By the Sherman-Morrison-Woodbury
+ * formula the system with the obstacles is then solved by (L + E W)^-1 = L^-1 - L^-1 E C^-1 W L^-1.
+ */
+static void initCapacitance(FastPoisson *poisson, flag **Flags)
+{
+    int imax = poisson->imax;
+    int jmax = poisson->jmax;
+    int m = count_interface_cells(Flags, imax, jmax);
+    poisson->numInterface = m;
+    poisson->interfaceI = (int *) malloc((size_t) (m + 1) * sizeof(int));
+    poisson->interfaceJ = (int *) malloc((size_t) (m + 1) * sizeof(int));
+    poisson->pivot = (int *) malloc((size_t) (m + 1) * sizeof(int));
+    if (poisson->interfaceI == NULL || poisson->interfaceJ == NULL || poisson->pivot == NULL)
+        ERROR("Storage cannot be allocated");
+    poisson->capacitance = realVector((long) m * m + 1);
+    poisson->alpha = realVector(m + 1);
+    poisson->Z = realVector((long) imax * jmax);
+    // any eigenvalue for the constant mode makes L invertible, one of the size of the diagonal is well scaled
+    poisson->gauge = (m > 0) ? -2.0 / (poisson->dx * poisson->dx) - 2.0 / (poisson->dy * poisson->dy) : 0;
+
+    int s = 0;
+    for (int i = 1; i <= imax; i++)
+    {
+        for (int j = 1; j <= jmax; j++)
+        {
+            if (isInterfaceCell(Flags, i, j))
+            {
+                poisson->interfaceI[s] = i;
+                poisson->interfaceJ[s] = j;
+                s++;
+            }
+        }
+    }
+    double *Z = poisson->Z;
+    for (s = 0; s < m; s++)
+    {
+        for (long c = 0; c < (long) imax * jmax; c++)
+            Z[c] = 0;
+        Z[cellIndex(jmax, poisson->interfaceI[s], poisson->interfaceJ[s])] = 1;
+        solveRectangle(poisson, Z, poisson->gauge);
+        for (int r = 0; r < m; r++)
+            poisson->capacitance[(long) r * m + s] = (r == s) + interfaceRow(poisson, Flags, r, Z);
+    }
+    luDecompose(poisson->capacitance, poisson->pivot, m);
+}
+
+void init_fast_poisson(FastPoisson *poisson, double dx, double dy, int imax, int jmax, flag **Flags)
+{
+    long cells = (long) imax * jmax;
+    poisson->imax = imax;
+    poisson->jmax = jmax;
+    poisson->dx = dx;
+    poisson->dy = dy;
+    poisson->eigenI = realVector(imax);
+    poisson->eigenJ = realVector(jmax);
+    // cos(pi k (2m+1) / (2n)) has eigenvalue 2 cos(pi k / n) - 2 for the Neumann second difference
+    for (int k = 0; k < imax; k++)
+        poisson->eigenI[k] = (2.0 * cos(M_PI * k / imax) - 2.0) / (dx * dx);
+    for (int k = 0; k < jmax; k++)
+        poisson->eigenJ[k] = (2.0 * cos(M_PI * k / jmax) - 2.0) / (dy * dy);
+    initDctPlan(&poisson->planI, imax, jmax);
+    initDctPlan(&poisson->planJ, jmax, imax);
+    poisson->X = realVector(cells);
+    poisson->Y = realVector(cells);
+    poisson->inRe = realVector(cells);
+    poisson->inIm = realVector(cells);
+    poisson->outRe = realVector(cells);
+    poisson->outIm = realVector(cells);
+    // p vectors of the batch for the p point DFTs
+    long tmpI = (long) largestFactor(imax) * jmax;
+    long tmpJ = (long) largestFactor(jmax) * imax;
+    long tmp = tmpI > tmpJ ? tmpI : tmpJ;
+    poisson->tmpRe = realVector(tmp);
+    poisson->tmpIm = realVector(tmp);
+    initCapacitance(poisson, Flags);
+}
+
+void fast_poisson(FastPoisson *poisson, real **P, real **RS, flag **Flags, const TileList *tiles,
+                  double *res, int noFluidCells)
+{
+    int imax = poisson->imax;
+    int jmax = poisson->jmax;
+    int m = poisson->numInterface;
+    double *X = poisson->X;
+    double *Z = poisson->Z;
+    double mean = 0;
+    double meanRS = 0;
+
+    // rhs: RS on the fluid cells, 0 (the equation of set_pressure_boundary()) on the obstacles
+    for (int i = 1; i <= imax; i++)
+    {
+        for (int j = 1; j <= jmax; j++)
+        {
+            if (isFluid(Flags[i][j]))
+            {
+                mean += P[i][j];
+                meanRS += RS[i][j];
+            }
+        }
+    }
+    mean /= noFluidCells;
+    meanRS /= noFluidCells;
+    // The Neumann problem only has a solution if RS has zero mean, which the flux through inflow and
+    // outflow boundaries need not give: the mean is taken out, as SOR does by letting P drift.
+    for (int i = 1; i <= imax; i++)
+    {
+        for (int j = 1; j <= jmax; j++)
+            X[cellIndex(jmax, i, j)] = isFluid(Flags[i][j]) ? RS[i][j] - meanRS : 0;
+    }
+
+    if (m > 0)
+    {
+        // x = L^-1 b - L^-1 E C^-1 W L^-1 b = L^-1 (b - E alpha), with C alpha = W L^-1 b
+        for (long c = 0; c < (long) imax * jmax; c++)
+            Z[c] = X[c];
+        solveRectangle(poisson, X, poisson->gauge);
+        for (int s = 0; s < m; s++)
+            poisson->alpha[s] = interfaceRow(poisson, Flags, s, X);
+        luSolve(poisson->capacitance, poisson->pivot, m, poisson->alpha);
+        for (int s = 0; s < m; s++)
+            Z[cellIndex(jmax, poisson->interfaceI[s], poisson->interfaceJ[s])] -= poisson->alpha[s];
+        X = Z;
+    }
+    solveRectangle(poisson, X, poisson->gauge);
+
+    // the constant the Neumann problem leaves free: the previous mean of P on the fluid cells
+    double shift = mean;
+    for (int i = 1; i <= imax; i++)
+    {
+        for (int j = 1; j <= jmax; j++)
+            shift -= isFluid(Flags[i][j]) ? X[cellIndex(jmax, i, j)] / noFluidCells : 0;
+    }
+    for (int i = 1; i <= imax; i++)
+    {
+        for (int j = 1; j <= jmax; j++)
+        {
+            if (isFluid(Flags[i][j]))
+                P[i][j] = X[cellIndex(jmax, i, j)] + shift;
+        }
+    }
+    set_pressure_boundary(imax, jmax, P, Flags, tiles);
+    *res = pressure_residual(poisson->dx, poisson->dy, imax, jmax, P, RS, Flags, tiles, noFluidCells);
+}
+
+void free_fast_poisson(FastPoisson *poisson)
+{
+    freeDctPlan(&poisson->planI);
+    freeDctPlan(&poisson->planJ);
+    free(poisson->eigenI);
+    free(poisson->eigenJ);
+    free(poisson->X);
+    free(poisson->Y);
+    free(poisson->Z);
+    free(poisson->inRe);
+    free(poisson->inIm);
+    free(poisson->outRe);
+    free(poisson->outIm);
+    free(poisson->tmpRe);
+    free(poisson->tmpIm);
+    free(poisson->interfaceI);
+    free(poisson->interfaceJ);
+    free(poisson->capacitance);
+    free(poisson->pivot);
+    free(poisson->alpha);
+}
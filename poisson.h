@@ -0,0 +1,88 @@
+#ifndef __POISSON_H__
+#define __POISSON_H__
+
+#include "precision.h"
+#include "flags.h"
+#include "tiles.h"
+
+/*
+ * Direct solver of the pressure Poisson equation on rectangular domains with few obstacles.
+ *
+ * With no obstacle among the cells 1..imax x 1..jmax, the system sor() iterates on (the
+ * 5-point Laplacian with the homogeneous Neumann conditions P[0][j] = P[1][j], ...) is
+ * diagonalised by the discrete cosine transform (DCT-II) in each direction: the transform
+ * of the rhs is divided by the eigenvalues of the Laplacian and transformed back, which
+ * costs O(imax*jmax*log(imax*jmax)) instead of hundreds of SOR sweeps.
+ *
+ * Obstacles are handled by the capacitance matrix method: the system sor() converges to
+ * differs from the one of the rectangle only in the rows of the obstacle cells next to fluid
+ * (their P is the value set by set_pressure_boundary() instead of a Laplacian), m rows in all.
+ * The m x m capacitance matrix of these rows is computed once at init with m rectangle solves
+ * and LU factorised; each solve then costs two rectangle solves and one small dense solve.
+ *
+ * The transforms are computed through complex FFTs of the same length (mixed radix,
+ * self-contained), which are fast when imax and jmax only have small prime factors; a
+ * large prime factor p costs O(p) per point. All the rows (columns) are transformed at
+ * once, the innermost loops running over them, so that they vectorise and the recursion
+ * of the FFT is paid once per direction rather than once per row.
+ */
+
+// Tables of the DCT of length n, done on batch vectors at once (the contiguous index of the data)
+typedef struct DctPlan
+{
+    int n;
+    int batch;
+    double *cosTable, *sinTable;   // cos, sin(2 pi k / n), k < n
+    double *shiftCos, *shiftSin;   // cos, sin(pi k / (2 n))
+} DctPlan;
+
+typedef struct FastPoisson
+{
+    int imax, jmax;
+    double dx, dy;
+    double *eigenI;   // eigenvalues of the 1D Neumann Laplacian in x-direction, 1/dx^2 included
+    double *eigenJ;   // same in y-direction
+    DctPlan planI;    // transforms in x-direction, batch of jmax
+    DctPlan planJ;    // transforms in y-direction, batch of imax
+    double *X;        // rhs and solution, imax x jmax, transformed in place
+    double *Y;        // transpose of X
+    double *inRe, *inIm, *outRe, *outIm, *tmpRe, *tmpIm; // work vectors of the FFTs
+    // capacitance matrix of the obstacles, numInterface = 0 without obstacles
+    int numInterface;     // obstacle cells with a fluid neighbour
+    int *interfaceI;      // their indices
+    int *interfaceJ;
+    double gauge;         // eigenvalue given to the constant mode, which makes the rectangle solve invertible
+    double *capacitance;  // LU factors of the capacitance matrix, numInterface x numInterface
+    int *pivot;
+    double *alpha;        // correction on the interface cells
+    double *Z;            // second rhs, imax x jmax
+} FastPoisson;
+
+// Number of obstacle cells with a fluid neighbour inside the domain (the ghost layer excluded)
+int count_interface_cells(flag **Flags, int imax, int jmax);
+
+/**
+ * Returns 1 if the direct solver is cheap for the geometry: neither imax nor jmax has a
+ * prime factor larger than 13 and at most 512 obstacle cells border on fluid. The direct
+ * solver is only chosen automatically in this case.
+ */
+int fast_poisson_suitable(flag **Flags, int imax, int jmax);
+
+// Sets up the transforms and, if there are obstacles, computes the capacitance matrix
+void init_fast_poisson(FastPoisson *poisson, double dx, double dy, int imax, int jmax, flag **Flags);
+
+/**
+ * Solves the pressure equation, sets the boundary values of P and stores the residual, as
+ * computed by sor(), in res. The solve is exact (up to round-off) only if RS has zero mean over
+ * the fluid cells, as in closed domains: with inflow and outflow the mean is taken out, and res
+ * is left above eps by the imbalance. Only the fluid cells of P are
+ * written besides the boundary values, so the sparse storage is respected. The additive
+ * constant the Neumann problem leaves free is fixed by keeping the mean of P over the
+ * fluid cells from the previous step, so that P stays continuous in time as with SOR.
+ */
+void fast_poisson(FastPoisson *poisson, real **P, real **RS, flag **Flags, const TileList *tiles,
+                  double *res, int noFluidCells);
+
+void free_fast_poisson(FastPoisson *poisson);
+
+#endif
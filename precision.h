@@ -0,0 +1,34 @@
+#ifndef __PRECISION_H__
+#define __PRECISION_H__
+
+/**
+ * Floating point type of the fields (U, V, P, F, G, RS, T), chosen at build time:
+ *
+ * - default               all fields are double
+ * - SIM_PRECISION_FLOAT   all fields are float, this halves the memory traffic of every kernel
+ * - SIM_PRECISION_MIXED   all fields are float, but the pressure solver accumulates its residual in double
+ *
+ * The scalar parameters (Re, dt, dx, ...) stay double in every mode, so the arithmetic in the kernels
+ * is still carried out in double, only loads and stores of the fields are narrowed.
+ *
+ * real_acc is the type used by the reductions over the fields (e.g. the SOR residual).
+ */
+#if defined(SIM_PRECISION_FLOAT) && defined(SIM_PRECISION_MIXED)
+#error "SIM_PRECISION_FLOAT and SIM_PRECISION_MIXED are mutually exclusive"
+#endif
+
+#if defined(SIM_PRECISION_FLOAT)
+typedef float real;
+typedef float real_acc;
+#define SIM_PRECISION_NAME "float"
+#elif defined(SIM_PRECISION_MIXED)
+typedef float real;
+typedef double real_acc;
+#define SIM_PRECISION_NAME "mixed"
+#else
+typedef double real;
+typedef double real_acc;
+#define SIM_PRECISION_NAME "double"
+#endif
+
+#endif
@@ -0,0 +1,811 @@
+#include "simulation.h"
+#include "helper.h"
+#include "visual.h"
+#include "boundary_val.h"
+#include "logger.h"
+
+// 1 if no fluid crosses the domain boundary, i.e. the normal velocity is 0 on all sides, so that the pressure
+// equation has a solution (RS of zero mean)
+static int closedDomain(const BoundaryInfo *boundaryInfo)
+{
+    for (int side = TOPBOUNDARY; side <= RIGHTBOUNDARY; side++)
+    {
+        const BoundaryInfo *b = boundaryInfo + side;
+        int normalU = (side == LEFTBOUNDARY || side == RIGHTBOUNDARY);
+        BoundaryType type = normalU ? b->typeU : b->typeV;
+        int uniform = normalU ? b->constU : b->constV;
+        double value = normalU ? b->valuesU[0] : b->valuesV[0];
+        if (type != DIRICHLET || !uniform || value != 0)
+            return 0;
+    }
+    return 1;
+}
+
+// Flags, tiles and pressure solver of the grid and the geometry (the bitmap pic, or the PGM file if NULL),
+// they do not change over the life of the context
+static void setUp(Simulation *sim, int **pic)
+{
+    const Parameters *p = &sim->parameters;
+    SolverOptions *options = &sim->options;
+    int imax = p->imax;
+    int jmax = p->jmax;
+
+    // create flag array to determine boundary connditions
+    sim->Flags = flagmatrix(0, imax+1, 0, jmax+1);
+    if (pic != NULL)
+    {
+        init_flag_bitmap(pic, imax, jmax, options->geometryRepair, sim->Flags, &sim->noFluidCells);
+    }
+    else
+    {
+        init_flag((char *) p->problem, (char *) p->geometry, imax, jmax, p->xlength, p->ylength,
+                  options->geometryResampling, options->geometryRepair, sim->Flags, &sim->noFluidCells);
+    }
+
+    // block index the kernels iterate over: cache sized tiles of the grid, only the ones holding fluid if sparse
+    int tileI = options->tileI;
+    int tileJ = options->tileJ;
+    if (options->sparseStorage && tileI <= 0 && tileJ <= 0)
+    {
+        tileI = tileJ = options->sparseBlock;
+    }
+    if (options->tileAutotune)
+    {
+        tune_tiles(p->omg, p->dx, p->dy, imax, jmax, sim->Flags, options->sparseStorage, &tileI, &tileJ);
+    }
+    build_tiles(&sim->tiles, sim->Flags, imax, jmax, tileI, tileJ, options->sparseStorage);
+    log_tiles(&sim->tiles, imax, jmax);
+
+    // direct pressure solver if the domain is a closed rectangle with few obstacles, SOR iterations otherwise
+    // (see poisson.h): with inflow and outflow it cannot solve the equation down to eps
+    if (options->pressureSolver == PRESSURE_SOLVER_DCT && !closedDomain(p->boundaryInfo))
+    {
+        ERROR("pressure_solver DCT needs walls on all four sides, use AUTO or SOR with inflow and outflow");
+    }
+    sim->directPressure = options->pressureSolver == PRESSURE_SOLVER_DCT ||
+                          (options->pressureSolver == PRESSURE_SOLVER_AUTO && closedDomain(p->boundaryInfo) &&
+                           fast_poisson_suitable(sim->Flags, imax, jmax));
+    if (sim->directPressure)
+    {
+        init_fast_poisson(&sim->poisson, p->dx, p->dy, imax, jmax, sim->Flags);
+        // nothing is iterated, the options of the SOR iterations do not apply
+        options->refinementSweeps = options->sorBlock = options->omegaAdaptive = options->pressureExtrapolation = 0;
+        logMsg("Pressure solver: direct (DCT), capacitance matrix of %d obstacle cells", sim->poisson.numInterface);
+    }
+    else if (options->pressureSolver == PRESSURE_SOLVER_LINE)
+    {
+        // whole lines per iteration, neither the float sweeps nor the row wavefront apply
+        options->refinementSweeps = options->sorBlock = 0;
+        logMsg("Pressure solver: line SOR");
+    }
+    else
+    {
+        logMsg("Pressure solver: SOR");
+    }
+
+    // The semi-Lagrangian step is no explicit Euler step of the convection, AB2 does not apply to it
+    if (options->semiLagrangian > 0)
+    {
+        options->timeIntegration = TIME_INTEGRATION_EULER;
+    }
+}
+
+// Fields and work data of the time loop, initialised to t = 0
+static void initState(Simulation *sim)
+{
+    const Parameters *p = &sim->parameters;
+    const SolverOptions *options = &sim->options;
+    int imax = p->imax;
+    int jmax = p->jmax;
+
+    sim->U = matrix(0, imax+1, 0, jmax+1);
+    sim->V = matrix(0, imax+1, 0, jmax+1);
+    sim->F = matrix(0, imax+1, 0, jmax+1);
+    sim->G = matrix(0, imax+1, 0, jmax+1);
+    sim->RS = matrix(0, imax+1, 0, jmax+1);
+    sim->P = matrix(0, imax+1, 0, jmax+1);
+    sim->T = matrix(0, imax+1, 0, jmax+1);
+
+    if (options->pressureSolver == PRESSURE_SOLVER_LINE)
+    {
+        init_line_relaxation(&sim->lines, imax, jmax);
+    }
+    sim->E = sim->R = NULL;
+    if (options->refinementSweeps > 0)
+    {
+        sim->E = fmatrix(0, imax+1, 0, jmax+1);
+        sim->R = fmatrix(0, imax+1, 0, jmax+1);
+        init_fmatrix(sim->R, 0, imax+1, 0, jmax+1, 0.0f);
+    }
+    sim->W = NULL;
+    if (options->viscousImplicit)
+    {
+        sim->W = matrix(0, imax+1, 0, jmax+1);
+        init_matrix(sim->W, 0, imax+1, 0, jmax+1, 0);
+    }
+    // Explicit terms of the last step, for the Adams-Bashforth steps
+    if (options->timeIntegration == TIME_INTEGRATION_AB2)
+    {
+        init_adams_bashforth(&sim->adamsBashforth, imax, jmax);
+    }
+    // Diffusive bound of dt: none with implicit viscous terms, AB2 is stable on half the stretch of Euler
+    sim->diffusiveFactor = options->viscousImplicit ? 0.0 :
+                           (options->timeIntegration == TIME_INTEGRATION_AB2) ? 0.5 : 1.0;
+    // Convective bound of dt: the semi-Lagrangian steps may cross several cells
+    sim->convectiveFactor = (options->semiLagrangian > 0) ? options->semiLagrangian : 1.0;
+
+    // initialise velocities and pressure
+    init_uvpt(p->UI, p->VI, p->PI, p->TI, imax, jmax, sim->U, sim->V, sim->P, sim->T, sim->Flags, &sim->tiles);
+
+    adaptive_omega_init(&sim->adaptive, p->omg);
+    if (options->pressureExtrapolation > 0)
+    {
+        init_pressure_history(&sim->history, options->pressureExtrapolation, imax, jmax);
+    }
+
+    sim->t = 0;
+    sim->dt = p->dt;
+    sim->mindt = 10000;   /* arbitrary counter that keeps track of minimum dt value in calculation */
+    sim->iterations = 0;
+    sim->residual = 10;
+    sim->n = 0;
+    sim->currentOutputTime = 0;
+}
+
+static void freeState(Simulation *sim)
+{
+    const SolverOptions *options = &sim->options;
+    int imax = sim->parameters.imax;
+    int jmax = sim->parameters.jmax;
+
+    free_matrix(sim->U, 0, imax+1, 0, jmax+1);
+    free_matrix(sim->V, 0, imax+1, 0, jmax+1);
+    free_matrix(sim->F, 0, imax+1, 0, jmax+1);
+    free_matrix(sim->G, 0, imax+1, 0, jmax+1);
+    free_matrix(sim->RS, 0, imax+1, 0, jmax+1);
+    free_matrix(sim->P, 0, imax+1, 0, jmax+1);
+    free_matrix(sim->T, 0, imax+1, 0, jmax+1);
+    if (options->refinementSweeps > 0)
+    {
+        free_fmatrix(sim->E, 0, imax+1, 0, jmax+1);
+        free_fmatrix(sim->R, 0, imax+1, 0, jmax+1);
+    }
+    if (options->pressureExtrapolation > 0)
+    {
+        free_pressure_history(&sim->history, imax, jmax);
+    }
+    if (options->viscousImplicit)
+    {
+        free_matrix(sim->W, 0, imax+1, 0, jmax+1);
+    }
+    if (options->timeIntegration == TIME_INTEGRATION_AB2)
+    {
+        free_adams_bashforth(&sim->adamsBashforth, imax, jmax);
+    }
+    if (options->pressureSolver == PRESSURE_SOLVER_LINE)
+    {
+        free_line_relaxation(&sim->lines, imax, jmax);
+    }
+}
+
+Simulation *simulation_create_bitmap(const Parameters *parameters, const SolverOptions *options, int **geometry)
+{
+    Simulation *sim = (Simulation *) malloc(sizeof(Simulation));
+    if (sim == NULL)
+        ERROR("Out of memory for the simulation context");
+    sim->parameters = *parameters;
+    sim->parameters.dx = parameters->xlength / (double) parameters->imax;
+    sim->parameters.dy = parameters->ylength / (double) parameters->jmax;
+    sim->options = *options;
+    sim->output = 1;
+    sim->boundaryU = sim->boundaryV = NULL;
+    sim->boundarySides = 0;
+    setUp(sim, geometry);
+    initState(sim);
+    return sim;
+}
+
+Simulation *simulation_create(const Parameters *parameters, const SolverOptions *options)
+{
+    return simulation_create_bitmap(parameters, options, NULL);
+}
+
+// Parameters and solver options of the configuration, then the context
+static Simulation *createFromConfig(const Config *config, int **geometry)
+{
+    Parameters parameters;
+    SolverOptions options;
+    read_parameter_config(config, &parameters);
+    read_solver_options_config(config, &options);
+    return simulation_create_bitmap(&parameters, &options, geometry);
+}
+
+Simulation *simulation_load(const char *szFileName)
+{
+    Config config;
+    read_config(szFileName, &config);
+    Simulation *sim = createFromConfig(&config, NULL);
+    free_config(&config);
+    return sim;
+}
+
+Simulation *simulation_load_string(const char *text, int **geometry)
+{
+    Config config;
+    config_from_string("<string>", text, &config);
+    Simulation *sim = createFromConfig(&config, geometry);
+    free_config(&config);
+    return sim;
+}
+
+void simulation_reset(Simulation *sim, const Parameters *parameters)
+{
+    const Parameters *p = &sim->parameters;
+    if (parameters->imax != p->imax || parameters->jmax != p->jmax || parameters->xlength != p->xlength
+        || parameters->ylength != p->ylength || strcmp(parameters->geometry, p->geometry) != 0)
+    {
+        ERROR("simulation_reset() cannot change the grid or the geometry, create a new context");
+    }
+    freeState(sim);
+    sim->parameters = *parameters;
+    initState(sim);
+}
+
+// Velocities of the patch boundary sides from boundaryU, boundaryV, then the mass balance of the patch: its net inflow
+// through the fluid faces of all sides is taken out of the normal velocities of these sides, or P would not converge
+static void setPatchBoundary(Simulation *sim)
+{
+    int imax = sim->parameters.imax, jmax = sim->parameters.jmax;
+    double dx = sim->parameters.dx, dy = sim->parameters.dy;
+    real **U = sim->U, **V = sim->V, **Ub = sim->boundaryU, **Vb = sim->boundaryV;
+    flag **Flags = sim->Flags;
+    int left = sim->boundarySides & (1 << LEFT), right = sim->boundarySides & (1 << RIGHT);
+    int bottom = sim->boundarySides & (1 << BOT), top = sim->boundarySides & (1 << TOP);
+    for (int j = 1; j <= jmax; j++)
+    {
+        if (left)
+        {
+            U[0][j] = Ub[0][j];
+            V[0][j] = Vb[0][j];
+        }
+        if (right)
+        {
+            U[imax][j] = Ub[imax][j];
+            V[imax + 1][j] = Vb[imax + 1][j];
+        }
+    }
+    for (int i = 1; i <= imax; i++)
+    {
+        if (bottom)
+        {
+            U[i][0] = Ub[i][0];
+            V[i][0] = Vb[i][0];
+        }
+        if (top)
+        {
+            U[i][jmax + 1] = Ub[i][jmax + 1];
+            V[i][jmax] = Vb[i][jmax];
+        }
+    }
+
+    double inflow = 0, length = 0;
+    for (int j = 1; j <= jmax; j++)
+    {
+        if (isFluid(Flags[1][j]))
+        {
+            inflow += U[0][j] * dy;
+            length += left ? dy : 0;
+        }
+        if (isFluid(Flags[imax][j]))
+        {
+            inflow -= U[imax][j] * dy;
+            length += right ? dy : 0;
+        }
+    }
+    for (int i = 1; i <= imax; i++)
+    {
+        if (isFluid(Flags[i][1]))
+        {
+            inflow += V[i][0] * dx;
+            length += bottom ? dx : 0;
+        }
+        if (isFluid(Flags[i][jmax]))
+        {
+            inflow -= V[i][jmax] * dx;
+            length += top ? dx : 0;
+        }
+    }
+    if (length == 0)
+        return;
+    double outflow = inflow / length;   // outwards, on every Dirichlet face
+    for (int j = 1; j <= jmax; j++)
+    {
+        if (left && isFluid(Flags[1][j]))
+            U[0][j] -= outflow;
+        if (right && isFluid(Flags[imax][j]))
+            U[imax][j] += outflow;
+    }
+    for (int i = 1; i <= imax; i++)
+    {
+        if (bottom && isFluid(Flags[i][1]))
+            V[i][0] -= outflow;
+        if (top && isFluid(Flags[i][jmax]))
+            V[i][jmax] += outflow;
+    }
+}
+
+void simulation_step(Simulation *sim)
+{
+    const Parameters *p = &sim->parameters;
+    const SolverOptions *options = &sim->options;
+    flag **Flags = sim->Flags;
+    const TileList *tiles = &sim->tiles;
+    int noFluidCells = sim->noFluidCells;
+    int imax = p->imax;
+    int jmax = p->jmax;
+    double dx = p->dx;
+    double dy = p->dy;
+    double t = sim->t;
+    real **U = sim->U, **V = sim->V, **P = sim->P, **T = sim->T;
+    real **F = sim->F, **G = sim->G, **RS = sim->RS;
+
+    // adaptive stepsize control based on stability conditions ensures stability of the method!
+    // dt = tau * min(cond1, cond2, cond3) where tau is a safety factor
+    // NOTE: if tau<0, stepsize is not adaptively computed!
+    if (p->tau > 0)
+    {
+        calculate_dt(p->Re, p->Pr, p->tau, &sim->dt, dx, dy, imax, jmax, U, V, sim->diffusiveFactor,
+                     sim->convectiveFactor, tiles);
+        sim->dt = fmin(sim->dt, p->dt_value); // test, to avoid a dt bigger than visualization interval
+        // Used to check the minimum time-step for convergence
+        if (sim->dt < sim->mindt)
+            sim->mindt = sim->dt;
+    }
+    double dt = sim->dt;
+
+    // ensure boundary conditions for velocity
+    // Special boundary condition are addressed here by using the boundaryInfo data.
+    // These special boundary values are configured at configuration time in read_parameters(). Still TODO !
+    boundaryvalues(imax, jmax, U, V, Flags, tiles, sim->parameters.boundaryInfo);
+    if (sim->boundarySides != 0)
+    {
+        setPatchBoundary(sim);
+    }
+
+    // momentum equations M1 and M2 - F and G are the terms arising from explicit Euler velocity update scheme
+    if (options->semiLagrangian > 0)
+    {
+        calculate_fg_semi_lagrangian(p->Re, p->GX, p->GY, p->beta, dt, dx, dy, imax, jmax, U, V, F, G, T, Flags, tiles);
+    }
+    else
+    {
+        calculate_fg(p->Re, p->GX, p->GY, p->alpha, p->beta, dt, dx, dy, imax, jmax, U, V, F, G, T, Flags, tiles);
+    }
+    if (options->timeIntegration == TIME_INTEGRATION_AB2)
+    {
+        adams_bashforth_fg(&sim->adamsBashforth, dt, imax, jmax, U, V, F, G, Flags, tiles);
+    }
+    if (options->viscousImplicit)
+    {
+        implicit_viscous_fg(p->Re, dt, dx, dy, imax, jmax, U, V, F, G, P, Flags, sim->W);
+    }
+
+    // momentum equations M1 and M2 are plugged into continuity equation C to produce PPE - depends on F and G - RS is the rhs of the implicit pressure update scheme
+    calculate_rs(dt, dx, dy, imax, jmax, F, G, RS, Flags, tiles);
+
+    // solve the system of eqs arising from implicit pressure uptate scheme using succesive overrelaxation solver
+    int it = 0;
+    double res = 1e9;
+    // warm start: initial guess extrapolated from the last steps, judged by the iterations it saves
+    int extrapolated = 0;
+    if (options->pressureExtrapolation > 0)
+    {
+        extrapolated = extrapolate_pressure(&sim->history, t, imax, jmax, P, Flags, tiles);
+    }
+    double omgStep = options->omegaAdaptive ? sim->adaptive.omg : p->omg;
+    if (options->refinementSweeps > 0)
+    {
+        // float sweeps with double residual correction, converges to the same eps
+        it = sor_refined(omgStep, dx, dy, imax, jmax, P, RS, Flags, tiles, p->eps, p->itermax, options->refinementSweeps,
+                         sor_float, sim->E, sim->R, &res, noFluidCells);
+    }
+    if (sim->directPressure)
+    {
+        fast_poisson(&sim->poisson, P, RS, Flags, tiles, &res, noFluidCells);
+        if (res > p->eps)
+        {
+            logEvent(t, "WARNING: direct pressure solve left res=%g above eps, inflow and outflow do not balance", res);
+        }
+    }
+    while (!sim->directPressure && it < p->itermax && res > p->eps)
+    {
+        if (options->pressureSolver == PRESSURE_SOLVER_LINE)
+        {
+            line_sor(omgStep, dx, dy, imax, jmax, P, RS, Flags, tiles, &sim->lines, &res, noFluidCells);
+            it++;
+        }
+        else if (options->sorBlock > 1)
+        {
+            // several iterations per pass over P, the residual is only checked between the blocks
+            int sweeps = min(options->sorBlock, p->itermax - it);
+            sor_blocked(omgStep, dx, dy, imax, jmax, P, RS, Flags, sweeps, &res, noFluidCells);
+            it += sweeps;
+        }
+        else
+        {
+            sor(omgStep, dx, dy, imax, jmax, P, RS, Flags, tiles, &res, noFluidCells);
+            it++;
+        }
+        if (options->omegaAdaptive)
+        {
+            adaptive_omega_record(&sim->adaptive, it, res);
+        }
+    }
+    if (options->omegaAdaptive)
+    {
+        adaptive_omega_end_step(&sim->adaptive, t);
+    }
+    if (it >= p->itermax)
+    {
+        logEvent(t, "WARNING: max number of iterations reached on SOR. Probably it did not converge!");
+    }
+    if (options->pressureExtrapolation > 0)
+    {
+        record_pressure_iterations(&sim->history, extrapolated, it, t);
+    }
+    sim->iterations = it;
+    sim->residual = res;
+
+    // calculate velocities acc to explicit Euler velocity update scheme - depends on F, G and P
+    calculate_uv(dt, dx, dy, imax, jmax, U, V, F, G, P, Flags, tiles);
+
+    // write visualization file for current iteration (only every dt_value step)
+    if (sim->output && t >= sim->currentOutputTime)
+    {
+        logEvent(t, "INFO: Writing visualization file n=%d", sim->n);
+        write_vtkFile(p->problem, sim->n, p->xlength, p->ylength, imax, jmax, dx, dy, U, V, P, T, Flags);
+        sim->currentOutputTime += p->dt_value;
+        // update output timestep iteration counter
+        sim->n++;
+    }
+    // Recap shell output
+    logEvent(t, "INFO: dt=%f, numSorIterations=%d, sorResidual=%f", dt, it, res);
+    // advance in time
+    sim->t = t + dt;
+}
+
+void simulation_run_until(Simulation *sim, double t)
+{
+    while (sim->t < t)
+    {
+        simulation_step(sim);
+    }
+}
+
+void simulation_check_ensemble(const SolverOptions *o)
+{
+    if (o->pressureSolver == PRESSURE_SOLVER_DCT || o->pressureSolver == PRESSURE_SOLVER_LINE || o->refinementSweeps > 0
+        || o->sorBlock > 1 || o->omegaAdaptive || o->pressureExtrapolation > 0 || o->viscousImplicit
+        || o->timeIntegration != TIME_INTEGRATION_EULER || o->semiLagrangian > 0 || o->gridLevels > 1
+        || o->steadyTolerance > 0)
+    {
+        ERROR("--ensemble only runs point SOR and explicit Euler steps, remove the other solver options");
+    }
+}
+
+// Writes the visualization file n of the first numLanes lanes, Ul, Vl, Pl and Tl are plain work fields
+static void writeLanes(const Parameters *lanes, int numLanes, int n, real **U, real **V, real **P, real **T,
+                       flag **Flags, real **Ul, real **Vl, real **Pl, real **Tl)
+{
+    const Parameters *p = lanes;
+    for (int k = 0; k < numLanes; k++)
+    {
+        get_lane(U, k, p->imax, p->jmax, Ul);
+        get_lane(V, k, p->imax, p->jmax, Vl);
+        get_lane(P, k, p->imax, p->jmax, Pl);
+        get_lane(T, k, p->imax, p->jmax, Tl);
+        write_vtkFile(lanes[k].problem, n, p->xlength, p->ylength, p->imax, p->jmax, p->dx, p->dy, Ul, Vl, Pl, Tl, Flags);
+    }
+}
+
+void simulation_run_ensemble(const Simulation *sim, const Parameters *lanes, int numLanes)
+{
+    const int K = ENSEMBLE_WIDTH;
+    const Parameters *p = lanes;
+    flag **Flags = sim->Flags;
+    const TileList *tiles = &sim->tiles;
+    int noFluidCells = sim->noFluidCells;
+    int imax = p->imax;
+    int jmax = p->jmax;
+    double dx = p->dx;
+    double dy = p->dy;
+    double dt = p->dt;
+    int n = 0;
+    double t = 0;
+    double mindt = 10000;
+    BoundaryInfo boundaryInfo[4];
+    memcpy(boundaryInfo, p->boundaryInfo, sizeof(boundaryInfo));
+    
+    // parameters of the lanes
+    double Re[ENSEMBLE_WIDTH], GX[ENSEMBLE_WIDTH], GY[ENSEMBLE_WIDTH], alpha[ENSEMBLE_WIDTH], beta[ENSEMBLE_WIDTH];
+    double Pr[ENSEMBLE_WIDTH], omg[ENSEMBLE_WIDTH], eps[ENSEMBLE_WIDTH];
+    double UI[ENSEMBLE_WIDTH], VI[ENSEMBLE_WIDTH], PI[ENSEMBLE_WIDTH], TI[ENSEMBLE_WIDTH];
+    double res[ENSEMBLE_WIDTH];
+    for (int k = 0; k < K; k++)
+    {
+        const Parameters *lane = lanes + min(k, numLanes - 1);
+        Re[k] = lane->Re;
+        GX[k] = lane->GX;
+        GY[k] = lane->GY;
+        alpha[k] = lane->alpha;
+        beta[k] = lane->beta;
+        Pr[k] = lane->Pr;
+        omg[k] = lane->omg;
+        eps[k] = lane->eps;
+        UI[k] = lane->UI;
+        VI[k] = lane->VI;
+        PI[k] = lane->PI;
+        TI[k] = lane->TI;
+        logMsg("Ensemble lane %d: %s", k, lane->problem);
+    }
+    
+    real** U = ensemble_matrix(imax, jmax);
+    real** V = ensemble_matrix(imax, jmax);
+    real** F = ensemble_matrix(imax, jmax);
+    real** G = ensemble_matrix(imax, jmax);
+    real** RS = ensemble_matrix(imax, jmax);
+    real** P = ensemble_matrix(imax, jmax);
+    real** T = ensemble_matrix(imax, jmax);
+    // plain fields of a single lane, for the output
+    real** Ul = matrix(0, imax+1, 0, jmax+1);
+    real** Vl = matrix(0, imax+1, 0, jmax+1);
+    real** Pl = matrix(0, imax+1, 0, jmax+1);
+    real** Tl = matrix(0, imax+1, 0, jmax+1);
+    
+    init_uvpt_ensemble(UI, VI, PI, TI, imax, jmax, U, V, P, T, Flags, tiles);
+    
+    // the steps of simulation_step() without the solver options
+    double currentOutputTime = 0;
+    while (t < p->t_end)
+    {
+        if (p->tau > 0)
+        {
+            calculate_dt_ensemble(Re, Pr, p->tau, &dt, dx, dy, imax, jmax, U, V, tiles);
+            dt = fmin(dt, p->dt_value);
+            if (dt < mindt)
+                mindt = dt;
+        }
+        boundaryvalues_ensemble(imax, jmax, U, V, Flags, tiles, boundaryInfo);
+        calculate_fg_ensemble(Re, GX, GY, alpha, beta, dt, dx, dy, imax, jmax, U, V, F, G, T, Flags, tiles);
+        calculate_rs_ensemble(dt, dx, dy, imax, jmax, F, G, RS, Flags, tiles);
+        
+        // the lanes are iterated together until the last one has converged
+        int it = 0;
+        int converged = 0;
+        double resMax = 0;
+        while (it < p->itermax && !converged)
+        {
+            sor_ensemble(omg, dx, dy, imax, jmax, P, RS, Flags, tiles, res, noFluidCells);
+            it++;
+            converged = 1;
+            resMax = 0;
+            for (int k = 0; k < K; k++)
+            {
+                converged = converged && res[k] <= eps[k];
+                resMax = fmax(resMax, res[k]);
+            }
+        }
+        if (it >= p->itermax)
+        {
+            logEvent(t, "WARNING: max number of iterations reached on SOR. Probably it did not converge!");
+        }
+        calculate_uv_ensemble(dt, dx, dy, imax, jmax, U, V, F, G, P, Flags, tiles);
+        
+        if (t >= currentOutputTime)
+        {
+            logEvent(t, "INFO: Writing visualization files n=%d", n);
+            writeLanes(lanes, numLanes, n, U, V, P, T, Flags, Ul, Vl, Pl, Tl);
+            currentOutputTime += p->dt_value;
+            n++;
+        }
+        logEvent(t, "INFO: dt=%f, numSorIterations=%d, largest sorResidual=%f", dt, it, resMax);
+        t += dt;
+    }
+    
+    logEvent(t, "INFO: Writing visualization files n=%d", n);
+    writeLanes(lanes, numLanes, n, U, V, P, T, Flags, Ul, Vl, Pl, Tl);
+    for (int k = 0; k < numLanes; k++)
+    {
+        get_lane(U, k, imax, jmax, Ul);
+        get_lane(V, k, imax, jmax, Vl);
+        get_lane(P, k, imax, jmax, Pl);
+        logMsg("%s: final value for U[imax/2][7*jmax/8] = %16e", lanes[k].problem, Ul[imax / 2][7 * jmax / 8]);
+        write_fields(lanes[k].problem, imax, jmax, p->xlength, p->ylength, Ul, Vl, Pl);
+    }
+    
+    free_ensemble_matrix(U, imax, jmax);
+    free_ensemble_matrix(V, imax, jmax);
+    free_ensemble_matrix(F, imax, jmax);
+    free_ensemble_matrix(G, imax, jmax);
+    free_ensemble_matrix(RS, imax, jmax);
+    free_ensemble_matrix(P, imax, jmax);
+    free_ensemble_matrix(T, imax, jmax);
+    free_matrix(Ul, 0, imax+1, 0, jmax+1);
+    free_matrix(Vl, 0, imax+1, 0, jmax+1);
+    free_matrix(Pl, 0, imax+1, 0, jmax+1);
+    free_matrix(Tl, 0, imax+1, 0, jmax+1);
+    
+    logMsg("Min dt value used: %16e", mindt);
+}
+
+// Largest change of U and V per unit time over the fluid cells, from Uold, Vold a step of dt before
+static double maxRate(real **U, real **V, real **Uold, real **Vold, flag **Flags, int imax, int jmax, double dt)
+{
+    double change = 0;
+    for (int i = 1; i <= imax; i++)
+    {
+        for (int j = 1; j <= jmax; j++)
+        {
+            if (isFluid(Flags[i][j]))
+            {
+                change = fmax(change, fabs(U[i][j] - Uold[i][j]));
+                change = fmax(change, fabs(V[i][j] - Vold[i][j]));
+            }
+        }
+    }
+    return change / dt;
+}
+
+int simulation_run_steady(Simulation *sim, double t, double tolerance)
+{
+    int imax = sim->parameters.imax;
+    int jmax = sim->parameters.jmax;
+    real **Uold = matrix(0, imax+1, 0, jmax+1);
+    real **Vold = matrix(0, imax+1, 0, jmax+1);
+    int steps = 0, steady = 0;
+    double rate = 0;
+    while (sim->t < t && !steady)
+    {
+        for (int i = 0; i <= imax + 1; i++)
+        {
+            memcpy(Uold[i], sim->U[i], (jmax + 2) * sizeof(real));
+            memcpy(Vold[i], sim->V[i], (jmax + 2) * sizeof(real));
+        }
+        simulation_step(sim);
+        steps++;
+        rate = maxRate(sim->U, sim->V, Uold, Vold, sim->Flags, imax, jmax, sim->dt);
+        steady = rate < tolerance;
+    }
+    free_matrix(Uold, 0, imax+1, 0, jmax+1);
+    free_matrix(Vold, 0, imax+1, 0, jmax+1);
+    if (steady)
+        logMsg("Steady state on %d x %d cells at t = %f after %d steps (max |dU/dt|, |dV/dt| = %e)", imax, jmax, sim->t,
+               steps, rate);
+    else
+        logMsg("No steady state on %d x %d cells by t = %f (max |dU/dt|, |dV/dt| = %e)", imax, jmax, sim->t, rate);
+    return steady;
+}
+
+void simulation_prolongate(Simulation *sim, const Simulation *coarse, double x0, double y0)
+{
+    const Parameters *p = &sim->parameters;
+    const Parameters *c = &coarse->parameters;
+    int imax = p->imax, jmax = p->jmax;
+    double dx = p->dx, dy = p->dy, DX = c->dx, DY = c->dy;
+    flag **Flags = sim->Flags;
+    // staggered grid: U on the right faces, V on the top faces, P and T at the cell centres
+    for (int i = 1; i <= imax; i++)
+    {
+        for (int j = 1; j <= jmax; j++)
+        {
+            if (isObstacle(Flags[i][j]))
+                continue;
+            double x = x0 + (i - 0.5) * dx, y = y0 + (j - 0.5) * dy;
+            if (isFluid(Flags[i + 1][j]))
+                sim->U[i][j] = interpolate_bilinear(coarse->U, c->imax, c->jmax, 0, -0.5 * DY, DX, DY, x + 0.5 * dx, y);
+            if (isFluid(Flags[i][j + 1]))
+                sim->V[i][j] = interpolate_bilinear(coarse->V, c->imax, c->jmax, -0.5 * DX, 0, DX, DY, x, y + 0.5 * dy);
+            sim->P[i][j] = interpolate_bilinear(coarse->P, c->imax, c->jmax, -0.5 * DX, -0.5 * DY, DX, DY, x, y);
+            sim->T[i][j] = interpolate_bilinear(coarse->T, c->imax, c->jmax, -0.5 * DX, -0.5 * DY, DX, DY, x, y);
+        }
+    }
+}
+
+void simulation_sequence(Simulation *sim)
+{
+    const Parameters *p = &sim->parameters;
+    if (sim->options.gridLevels <= 1)
+        return;
+    int imax = p->imax, jmax = p->jmax;
+    if (imax % 2 != 0 || jmax % 2 != 0)
+        ERROR("grid_levels: imax and jmax must be divisible by 2 on all levels but the coarsest one");
+
+    // the next coarser grid, its geometry resampled from the Flags by area (repaired as any other)
+    int **pic = imatrix(0, imax - 1, 0, jmax - 1);
+    for (int i = 0; i < imax; i++)
+    {
+        for (int j = 0; j < jmax; j++)
+        {
+            pic[i][j] = isObstacle(sim->Flags[i + 1][j + 1]);
+        }
+    }
+    int **coarsePic = resample_bitmap(pic, imax, jmax, imax / 2, jmax / 2, RESAMPLING_AREA);
+    free_imatrix(pic, 0, imax - 1, 0, jmax - 1);
+    Parameters parameters = *p;
+    parameters.imax = imax / 2;
+    parameters.jmax = jmax / 2;
+    SolverOptions options = sim->options;
+    options.gridLevels--;
+    options.tileAutotune = 0;
+    Simulation *coarse = simulation_create_bitmap(&parameters, &options, coarsePic);
+    free_imatrix(coarsePic, 0, imax / 2 - 1, 0, jmax / 2 - 1);
+    simulation_set_output(coarse, 0);
+
+    // coarsest first, each level from the steady state of the one below
+    simulation_sequence(coarse);
+    double tolerance = (sim->options.steadyTolerance > 0) ? sim->options.steadyTolerance : STEADY_TOLERANCE;
+    simulation_run_steady(coarse, p->t_end, tolerance);
+    simulation_prolongate(sim, coarse, 0, 0);
+    simulation_destroy(coarse);
+}
+
+void simulation_write_results(Simulation *sim)
+{
+    const Parameters *p = &sim->parameters;
+    int imax = p->imax;
+    int jmax = p->jmax;
+
+    // write visualisation file for the last iteration
+    logEvent(sim->t, "INFO: Writing visualization file n=%d", sim->n);
+    write_vtkFile(p->problem, sim->n, p->xlength, p->ylength, imax, jmax, p->dx, p->dy, sim->U, sim->V, sim->P, sim->T,
+                  sim->Flags);
+
+    // Check value of U[imax/2][7*jmax/8] (task6)
+    logMsg("Final value for U[imax/2][7*jmax/8] = %16e", sim->U[imax / 2][7 * jmax / 8]);
+
+    // Dump the final fields as binaries, these are compared against the golden ones by the regression suite (test.c)
+    write_fields(p->problem, imax, jmax, p->xlength, p->ylength, sim->U, sim->V, sim->P);
+
+    logMsg("Min dt value used: %16e", sim->mindt);
+}
+
+real **simulation_field(const Simulation *sim, SimulationField field)
+{
+    switch (field)
+    {
+        case SIMULATION_U: return sim->U;
+        case SIMULATION_V: return sim->V;
+        case SIMULATION_P: return sim->P;
+        case SIMULATION_T: return sim->T;
+    }
+    return NULL;
+}
+
+flag **simulation_flags(const Simulation *sim)
+{
+    return sim->Flags;
+}
+
+double simulation_time(const Simulation *sim)
+{
+    return sim->t;
+}
+
+void simulation_set_output(Simulation *sim, int output)
+{
+    sim->output = output;
+}
+
+void simulation_destroy(Simulation *sim)
+{
+    int imax = sim->parameters.imax;
+    int jmax = sim->parameters.jmax;
+    freeState(sim);
+    free_tiles(&sim->tiles);
+    free_flagmatrix(sim->Flags, 0, imax+1, 0, jmax+1);
+    if (sim->directPressure)
+    {
+        free_fast_poisson(&sim->poisson);
+    }
+    free(sim);
+}
@@ -0,0 +1,180 @@
+#ifndef __SIMULATION_H__
+#define __SIMULATION_H__
+
+#include "init.h"
+#include "sor.h"
+#include "uvp.h"
+#include "poisson.h"
+
+/*
+ * The solver as a library (libsim): a Simulation context holds everything one run needs,
+ * the set-up derived from the grid and the geometry (Flags, tiles, direct pressure solver)
+ * and the state of the time loop (fields, time, the work data of the solver options).
+ *
+ *      Simulation *sim = simulation_load("cavity100.dat");   // or simulation_create(&parameters, &options)
+ *      simulation_run_until(sim, 10.0);
+ *      real **U = simulation_field(sim, SIMULATION_U);        // no copy, valid until the next step
+ *      simulation_step(sim);
+ *      simulation_destroy(sim);
+ *
+ * The contexts share no state: several of them can run at the same time, each in a
+ * thread of its own. The log (logger.h) is per thread, a thread which has not opened
+ * one only writes to the console. Errors still end the process (ERROR()).
+ *
+ * sim itself is one context run from t = 0 to t_end, the cases of a sweep (sweep.h) are
+ * simulation_reset() of one context in the forked workers.
+ */
+
+typedef enum SimulationField
+{
+    SIMULATION_U,
+    SIMULATION_V,
+    SIMULATION_P,
+    SIMULATION_T
+} SimulationField;
+
+typedef struct Simulation
+{
+    Parameters parameters;
+    SolverOptions options;   // with the settings which do not apply to the chosen pressure solver turned off
+    // set up from the grid and the geometry
+    flag **Flags;
+    int noFluidCells;
+    TileList tiles;
+    int directPressure;      // 1 if the pressure is solved by fast_poisson()
+    FastPoisson poisson;
+    // fields
+    real **U, **V, **P, **T;
+    real **F, **G, **RS;
+    // work data of the solver options
+    LineRelaxation lines;
+    float **E, **R;          // float work matrices of the mixed precision pressure refinement
+    real **W;                // work matrix of the implicit viscous terms
+    AdamsBashforth adamsBashforth;
+    AdaptiveOmega adaptive;
+    PressureHistory history;
+    double diffusiveFactor;  // of the bound of dt, see calculate_dt()
+    double convectiveFactor;
+    // boundary of a refined patch (see amr.h): the sides in boundarySides (bits LEFT, RIGHT, BOT, TOP) take
+    // the velocities of their boundary faces and cells from boundaryU, boundaryV instead of the boundary types
+    real **boundaryU, **boundaryV;
+    int boundarySides;
+    // time loop
+    double t;
+    double dt;
+    double mindt;            // smallest dt used so far
+    int iterations;          // pressure iterations of the last step
+    double residual;         // pressure residual of the last step
+    int output;              // 1 if the steps write the visualization files every dt_value (the default)
+    int n;                   // number of the next visualization file
+    double currentOutputTime;
+} Simulation;
+
+/**
+ * Sets up a context for the parameters and solver options (reading the geometry file of
+ * parameters->geometry) and initialises it to t = 0. The options are copied, those which
+ * do not apply to the chosen pressure solver turned off; dx and dy are derived from the
+ * domain size and the number of cells.
+ */
+Simulation *simulation_create(const Parameters *parameters, const SolverOptions *options);
+
+/**
+ * simulation_create() with the geometry given as a bitmap in memory instead of the PGM
+ * file: geometry[i][j], i < imax, j < jmax, 1 for obstacle and 0 for fluid cells (the
+ * layout of read_pgm(), see init_flag_bitmap()). parameters->geometry is not read.
+ */
+Simulation *simulation_create_bitmap(const Parameters *parameters, const SolverOptions *options, int **geometry);
+
+/**
+ * simulation_create() with the parameters and solver options of the configuration file,
+ * which is read once.
+ */
+Simulation *simulation_load(const char *szFileName);
+
+/**
+ * simulation_load() of a configuration held in memory, the text of a .dat file, with the
+ * geometry bitmap of simulation_create_bitmap(), or the file of the geometry entry if NULL.
+ * Nothing is read from the disk but that file.
+ */
+Simulation *simulation_load_string(const char *text, int **geometry);
+
+/**
+ * Restarts the context from t = 0 with other scalar parameters (Re, UI, alpha, ... as
+ * for apply_sweep_case()), keeping its set-up. The grid and the geometry must not change.
+ */
+void simulation_reset(Simulation *sim, const Parameters *parameters);
+
+/**
+ * Advances the context by one time step. With output on, the visualization file of the
+ * step is written if it is due.
+ */
+void simulation_step(Simulation *sim);
+
+/**
+ * Steps until the time of the context reaches t (the last step may go beyond it).
+ */
+void simulation_run_until(Simulation *sim, double t);
+
+/**
+ * Runs ENSEMBLE_WIDTH cases in lock-step from t = 0 to t_end (see ensemble.h): the steps of
+ * simulation_step() on ensemble fields, with the common dt of calculate_dt_ensemble() and SOR
+ * iterations until every lane has converged. lanes are the parameters of numLanes cases on the
+ * grid and the geometry of sim, which only lends its set-up and is not changed. Only the
+ * numLanes cases are written out, the lanes beyond them repeat the last case.
+ */
+void simulation_run_ensemble(const Simulation *sim, const Parameters *lanes, int numLanes);
+
+/**
+ * Stops with ERROR() if the solver options ask for more than simulation_run_ensemble() runs:
+ * point SOR and explicit Euler steps only.
+ */
+void simulation_check_ensemble(const SolverOptions *options);
+
+/**
+ * Steps until the time of the context reaches t, or until the flow is steady: the largest
+ * change of U and V per unit time of a step, over the fluid cells, below tolerance.
+ * Returns 1 at a steady state.
+ */
+int simulation_run_steady(Simulation *sim, double t, double tolerance);
+
+#define STEADY_TOLERANCE 1e-3   // of the coarse grids of simulation_sequence() if steady_tolerance is not given
+
+/**
+ * Interpolates U, V, P and T of the coarse context bilinearly to the fluid cells of sim (U and
+ * V only to the faces between two fluid cells), whose domain starts at (x0, y0) of the coarse
+ * one. The other cells are left as they are.
+ */
+void simulation_prolongate(Simulation *sim, const Simulation *coarse, double x0, double y0);
+
+/**
+ * Grid sequencing (solver option grid_levels): the context at t = 0 starts from the steady
+ * state of a grid with half the cells in each direction instead of UI, VI, PI, TI. That grid
+ * is itself sequenced the same way, down to grid_levels grids in all, and run until it is
+ * steady (simulation_run_steady(), up to t_end) before U, V, P and T are interpolated
+ * bilinearly to the cells of the next finer one. The geometry of a coarse grid is that of
+ * the finer one, resampled by area (see geometry.h). Does nothing if grid_levels < 2.
+ */
+void simulation_sequence(Simulation *sim);
+
+/**
+ * Writes the outputs of the end of a run: the last visualization file, the final fields
+ * (write_fields()) and a summary in the log.
+ */
+void simulation_write_results(Simulation *sim);
+
+/**
+ * The field of the context over the cells 0..imax+1 x 0..jmax+1, not a copy: it stays
+ * valid until the context is destroyed, and changes with the steps.
+ */
+real **simulation_field(const Simulation *sim, SimulationField field);
+
+flag **simulation_flags(const Simulation *sim);
+
+double simulation_time(const Simulation *sim);
+
+// 0 to stop the steps from writing visualization files, 1 to resume
+void simulation_set_output(Simulation *sim, int output);
+
+void simulation_destroy(Simulation *sim);
+
+#endif
@@ -1,90 +1,865 @@
 #include "sor.h"
 #include "helper.h"
+#include "logger.h"
 #include <math.h>
+#include <time.h>
 
-void sor(double omg, double dx, double dy, int imax, int jmax, double **P, double **RS, int **Flags, double *res, int noFluidCells)
+/*
+ * The pressure stencils on the rows pm, p and pp (i - 1, i and i + 1) of P and rs of RS, the neighbours j -+ 1 of the
+ * entry c lying at c -+ s: s = 1 in plain fields, ENSEMBLE_WIDTH in ensemble fields (see ensemble.h).
+ */
+/* SOR update of the entry c, coeff being omg / (2 (1/dx^2 + 1/dy^2)) */
+static inline double relaxCell(const real *pm, const real *p, const real *pp, const real *rs, int c, int s, double omg,
+                               double coeff, double dx, double dy)
 {
-    int i, j;
-    double rloc;
-    double coeff = omg / (2.0 * (1.0 / (dx * dx) + 1.0 / (dy * dy)));
+    return (1.0 - omg) * p[c]
+           + coeff *
+             ((pp[c] + pm[c]) / (dx * dx) + (p[c + s] + p[c - s]) / (dy * dy) -
+              rs[c]);
+}
+
+/* residual of the pressure equation at the entry c */
+static inline double residualCell(const real *pm, const real *p, const real *pp, const real *rs, int c, int s,
+                                  double dx, double dy)
+{
+    return (pp[c] - 2.0 * p[c] + pm[c]) / (dx * dx) +
+           (p[c + s] - 2.0 * p[c] + p[c - s]) / (dy * dy) - rs[c];
+}
+
+/* boundary value of the obstacle cell C at the entry c of row i: from its fluid neighbours, averaged at corners */
+static inline real obstaclePressure(real **P, flag C, int i, int c, int s)
+{
+    if (isCorner(C))
+    {
+        return (P[i + isNeighbourObstacle(C, LEFT) - isNeighbourObstacle(C, RIGHT)][c] +
+                P[i][c + (isNeighbourObstacle(C, BOT) - isNeighbourObstacle(C, TOP)) * s]) / 2;
+    }
+    return (!isNeighbourObstacle(C, TOP)) * P[i][c + s]
+           + (!isNeighbourObstacle(C, BOT)) * P[i][c - s]
+           + (!isNeighbourObstacle(C, RIGHT)) * P[i + 1][c]
+           + (!isNeighbourObstacle(C, LEFT)) * P[i - 1][c];
+}
+
+/* set_pressure_boundary() on K lanes of P (K = 1: plain fields, ENSEMBLE_WIDTH: ensemble fields) */
+static inline void pressureBoundaryLanes(int K, int imax, int jmax, real **P, flag **Flags, const TileList *tiles)
+{
+    /* set boundary values on the domain */
+    for (int i = 1; i <= imax; i++)
+    {
+        for (int k = 0; k < K; k++)
+        {
+            P[i][k] = P[i][K + k];
+            P[i][(jmax + 1) * K + k] = P[i][jmax * K + k];
+        }
+    }
+    for (int j = 1; j <= jmax; j++)
+    {
+        for (int k = 0; k < K; k++)
+        {
+            P[0][j * K + k] = P[1][j * K + k];
+            P[imax + 1][j * K + k] = P[imax][j * K + k];
+        }
+    }
     
-    /* SOR iteration */
-    for (i = 1; i <= imax; i++)
+    /* set boundary values on obstacle interface */
+    for (int t = 0; t < tiles->numTiles; t++)
     {
-        for (j = 1; j <= jmax; j++)
+        const Tile *tile = tiles->tiles + t;
+        for (int i = max(tile->ilo, 1); i <= min(tile->ihi, imax); i++)
         {
-            int cell = Flags[i][j];
-            // proceed if fluid
-            if (isFluid(cell))
+            for (int j = max(tile->jlo, 1); j <= min(tile->jhi, jmax); j++)
             {
-                P[i][j] = (1.0 - omg) * P[i][j]
-                          + coeff *
-                            ((P[i + 1][j] + P[i - 1][j]) / (dx * dx) + (P[i][j + 1] + P[i][j - 1]) / (dy * dy) -
-                             RS[i][j]);
+                flag C = Flags[i][j];
+                // proceed if obstacle
+                if (isObstacle(C))
+                {
+                    for (int k = 0; k < K; k++)
+                        P[i][j * K + k] = obstaclePressure(P, C, i, j * K + k, K);
+                }
             }
         }
     }
+}
 
+/*
+ * sor() on K lanes of the fields, lane k relaxed with omg[k] and its residual in res[k]. sor() and sor_ensemble()
+ * inline it with their constant K.
+ */
+static inline void sorLanes(int K, const double *omg, double dx, double dy, int imax, int jmax, real **P, real **RS,
+                            flag **Flags, const TileList *tiles, double *res, int noFluidCells)
+{
+    double coeff[ENSEMBLE_WIDTH];
+    for (int k = 0; k < K; k++)
+        coeff[k] = omg[k] / (2.0 * (1.0 / (dx * dx) + 1.0 / (dy * dy)));
+    
+    /* SOR iteration, tile by tile */
+    // the lanes of a cell are independent, so the ensemble sweep vectorises over them despite the Gauss-Seidel order
+    for (int t = 0; t < tiles->numTiles; t++)
+    {
+        const Tile *tile = tiles->tiles + t;
+        for (int i = max(tile->ilo, 1); i <= min(tile->ihi, imax); i++)
+        {
+            real *p = P[i], *pm = P[i - 1], *pp = P[i + 1], *rs = RS[i];
+            for (int j = max(tile->jlo, 1); j <= min(tile->jhi, jmax); j++)
+            {
+                // proceed if fluid
+                if (isPCell(Flags[i][j]))
+                {
+                    for (int k = 0; k < K; k++)
+                        p[j * K + k] = relaxCell(pm, p, pp, rs, j * K + k, K, omg[k], coeff[k], dx, dy);
+                }
+            }
+        }
+    }
     
     /* compute the residual */
-    rloc = 0;
-    for (i = 1; i <= imax; i++)
+    real_acc rloc[ENSEMBLE_WIDTH] = {0}; // double also in the mixed precision build, where P and RS are float
+    for (int t = 0; t < tiles->numTiles; t++)
     {
-        for (j = 1; j <= jmax; j++)
+        const Tile *tile = tiles->tiles + t;
+        for (int i = max(tile->ilo, 1); i <= min(tile->ihi, imax); i++)
         {
-            int cell = Flags[i][j];
-            // proceed if fluid
-            if (isFluid(cell))
+            real *p = P[i], *pm = P[i - 1], *pp = P[i + 1], *rs = RS[i];
+            for (int j = max(tile->jlo, 1); j <= min(tile->jhi, jmax); j++)
             {
-                rloc += ((P[i + 1][j] - 2.0 * P[i][j] + P[i - 1][j]) / (dx * dx) +
-                         (P[i][j + 1] - 2.0 * P[i][j] + P[i][j - 1]) / (dy * dy) - RS[i][j]) *
-                        ((P[i + 1][j] - 2.0 * P[i][j] + P[i - 1][j]) / (dx * dx) +
-                         (P[i][j + 1] - 2.0 * P[i][j] + P[i][j - 1]) / (dy * dy) - RS[i][j]);
+                // proceed if fluid
+                if (isPCell(Flags[i][j]))
+                {
+                    for (int k = 0; k < K; k++)
+                    {
+                        double r = residualCell(pm, p, pp, rs, j * K + k, K, dx, dy);
+                        rloc[k] += r * r;
+                    }
+                }
             }
         }
     }
-    rloc = rloc / noFluidCells;
-    rloc = sqrt(rloc);
     /* set residual */
-    *res = rloc;
+    for (int k = 0; k < K; k++)
+    {
+        real_acc r = sqrt(rloc[k] / noFluidCells);
+        res[k] = r;
+    }
     
+    pressureBoundaryLanes(K, imax, jmax, P, Flags, tiles);
+}
+
+void sor(double omg, double dx, double dy, int imax, int jmax, real **P, real **RS, flag **Flags,
+         const TileList *tiles, double *res, int noFluidCells)
+{
+    sorLanes(1, &omg, dx, dy, imax, jmax, P, RS, Flags, tiles, res, noFluidCells);
+}
+
+void set_pressure_boundary(int imax, int jmax, real **P, flag **Flags, const TileList *tiles)
+{
+    pressureBoundaryLanes(1, imax, jmax, P, Flags, tiles);
+}
+
+/* one SOR relaxation of the fluid cells of row i */
+static void relax_row(int i, double omg, double coeff, double dx, double dy, int jmax, real **P, real **RS, flag **Flags)
+{
+    for (int j = 1; j <= jmax; j++)
+    {
+        if (isPCell(Flags[i][j]))
+        {
+            P[i][j] = relaxCell(P[i - 1], P[i], P[i + 1], RS[i], j, 1, omg, coeff, dx, dy);
+        }
+    }
+}
+
+/* the part of set_pressure_boundary() belonging to row i, the ghost rows 0 and imax+1 go with rows 1 and imax */
+static void set_pressure_boundary_row(int i, int imax, int jmax, real **P, flag **Flags)
+{
+    if (i == 1)
+    {
+        for (int j = 1; j <= jmax; j++)
+            P[0][j] = P[1][j];
+    }
+    if (i == imax)
+    {
+        for (int j = 1; j <= jmax; j++)
+            P[imax + 1][j] = P[imax][j];
+    }
+    P[i][0] = P[i][1];
+    P[i][jmax + 1] = P[i][jmax];
+    for (int j = 1; j <= jmax; j++)
+    {
+        flag C = Flags[i][j];
+        if (isObstacle(C))
+        {
+            P[i][j] = obstaclePressure(P, C, i, j, 1);
+        }
+    }
+}
+
+void sor_blocked(double omg, double dx, double dy, int imax, int jmax, real **P, real **RS, flag **Flags, int sweeps,
+                 double *res, int noFluidCells)
+{
+    double coeff = omg / (2.0 * (1.0 / (dx * dx) + 1.0 / (dy * dy)));
     
-    /* set boundary values on the domain */
+    /*
+     * Wavefront over the rows: at step r, sweep s relaxes row r - 2s and then sets the boundary values of
+     * row r - 2s - 1, which has now all its neighbours at sweep s. Row i+1 is thus always one sweep behind
+     * row i and row i-1 one sweep ahead, exactly as with consecutive calls of sor(), but only the 2*sweeps+3
+     * rows around the wavefront are touched at a time instead of the whole P once per sweep.
+     */
+    for (int r = 1; r <= imax + 2 * sweeps - 1; r++)
+    {
+        for (int s = 0; s < sweeps; s++)
+        {
+            int i = r - 2 * s;
+            if (i >= 1 && i <= imax)
+            {
+                relax_row(i, omg, coeff, dx, dy, jmax, P, RS, Flags);
+            }
+            if (i - 1 >= 1 && i - 1 <= imax)
+            {
+                set_pressure_boundary_row(i - 1, imax, jmax, P, Flags);
+            }
+        }
+    }
+    
+    /* the residual only at the end of the block */
+    *res = pressure_residual(dx, dy, imax, jmax, P, RS, Flags, NULL, noFluidCells);
+}
+
+void init_line_relaxation(LineRelaxation *lines, int imax, int jmax)
+{
+    lines->upper = matrix(0, imax + 1, 0, jmax + 1);
+    lines->rhs = matrix(0, imax + 1, 0, jmax + 1);
+    init_matrix(lines->upper, 0, imax + 1, 0, jmax + 1, 0);
+    init_matrix(lines->rhs, 0, imax + 1, 0, jmax + 1, 0);
+}
+
+void free_line_relaxation(LineRelaxation *lines, int imax, int jmax)
+{
+    free_matrix(lines->upper, 0, imax + 1, 0, jmax + 1);
+    free_matrix(lines->rhs, 0, imax + 1, 0, jmax + 1);
+}
+
+/*
+ * Row of the tridiagonal system of a cell, along the line through prev, P and next (crossSum is the sum of the
+ * neighbours on the adjacent lines). A non fluid cell keeps its value. The value of a non fluid neighbour on the
+ * line depends on the cell as set_pressure_boundary() has it: that part (all of it on the domain boundary and the
+ * obstacle sides, half of it on the obstacle corners) is implicit, the rest, the other fluid cell of a corner, is
+ * taken from the last boundary values. Lagging the whole corner value instead diverges on strongly stretched cells.
+ */
+static inline void lineRow(flag C, flag prevFlag, flag nextFlag, double along, double cross, double p, double prev,
+                           double next, double crossSum, double rs, double *a, double *b, double *c, double *r)
+{
+    if (isPCell(C))
+    {
+        int prevFluid = isPCell(prevFlag), nextFluid = isPCell(nextFlag);
+        double prevSelf = prevFluid ? 0.0 : (isCorner(prevFlag) ? 0.5 : 1.0);
+        double nextSelf = nextFluid ? 0.0 : (isCorner(nextFlag) ? 0.5 : 1.0);
+        *a = prevFluid ? along : 0.0;
+        *c = nextFluid ? along : 0.0;
+        *b = -2.0 * (along + cross) + (prevSelf + nextSelf) * along;
+        *r = rs - cross * crossSum - (!prevFluid) * along * (prev - prevSelf * p) - (!nextFluid) * along * (next - nextSelf * p);
+    }
+    else
+    {
+        *a = *c = 0.0;
+        *b = 1.0;
+        *r = p;
+    }
+}
+
+void line_sor(double omg, double dx, double dy, int imax, int jmax, real **P, real **RS, flag **Flags,
+              const TileList *tiles, LineRelaxation *lines, double *res, int noFluidCells)
+{
+    real **upper = lines->upper;
+    real **rhs = lines->rhs;
+    double ax = 1.0 / (dx * dx), ay = 1.0 / (dy * dy);
+    double a, b, c, r;
+
+    /* lines in y-direction (i fixed), odd then even i, eliminated one by one along the contiguous index */
+    for (int colour = 1; colour <= 2; colour++)
+    {
+        for (int i = colour; i <= imax; i += 2)
+        {
+            double upperPrev = 0.0, rhsPrev = 0.0;
+            for (int j = 1; j <= jmax; j++)
+            {
+                lineRow(Flags[i][j], Flags[i][j - 1], Flags[i][j + 1], ay, ax, P[i][j], P[i][j - 1], P[i][j + 1],
+                        P[i - 1][j] + P[i + 1][j], RS[i][j], &a, &b, &c, &r);
+                double m = 1.0 / (b - a * upperPrev);
+                upper[i][j] = upperPrev = c * m;
+                rhs[i][j] = rhsPrev = (r - a * rhsPrev) * m;
+            }
+            double x = 0.0;
+            for (int j = jmax; j >= 1; j--)
+            {
+                x = rhs[i][j] - upper[i][j] * x;
+                if (isPCell(Flags[i][j]))
+                    P[i][j] += omg * (x - P[i][j]);
+            }
+        }
+    }
+    // the boundary values of the new P, so that the Neumann ends of the next lines carry no stale difference
+    set_pressure_boundary(imax, jmax, P, Flags, tiles);
+
+    /* lines in x-direction (j fixed), odd then even j, all the lines of a colour eliminated together */
+    for (int colour = 1; colour <= 2; colour++)
+    {
+        for (int i = 1; i <= imax; i++)
+        {
+            for (int j = colour; j <= jmax; j += 2)
+            {
+                lineRow(Flags[i][j], Flags[i - 1][j], Flags[i + 1][j], ax, ay, P[i][j], P[i - 1][j], P[i + 1][j],
+                        P[i][j - 1] + P[i][j + 1], RS[i][j], &a, &b, &c, &r);
+                // row 0 of the work matrices stays 0, the start of the lines
+                double m = 1.0 / (b - a * upper[i - 1][j]);
+                upper[i][j] = c * m;
+                rhs[i][j] = (r - a * rhs[i - 1][j]) * m;
+            }
+        }
+        // the solution overwrites rhs, then P is relaxed towards it
+        for (int i = imax - 1; i >= 1; i--)
+        {
+            for (int j = colour; j <= jmax; j += 2)
+            {
+                rhs[i][j] -= upper[i][j] * rhs[i + 1][j];
+            }
+        }
+        for (int i = 1; i <= imax; i++)
+        {
+            for (int j = colour; j <= jmax; j += 2)
+            {
+                if (isPCell(Flags[i][j]))
+                    P[i][j] += omg * (rhs[i][j] - P[i][j]);
+            }
+        }
+    }
+
+    set_pressure_boundary(imax, jmax, P, Flags, tiles);
+    *res = pressure_residual(dx, dy, imax, jmax, P, RS, Flags, tiles, noFluidCells);
+}
+
+double pressure_residual(double dx, double dy, int imax, int jmax, real **P, real **RS, flag **Flags,
+                         const TileList *tiles, int noFluidCells)
+{
+    Tile whole = {1, imax, 1, jmax};
+    int numTiles = tiles ? tiles->numTiles : 1;
+    real_acc rloc = 0;
+    for (int t = 0; t < numTiles; t++)
+    {
+        const Tile *tile = tiles ? tiles->tiles + t : &whole;
+        for (int i = max(tile->ilo, 1); i <= min(tile->ihi, imax); i++)
+        {
+            for (int j = max(tile->jlo, 1); j <= min(tile->jhi, jmax); j++)
+            {
+                if (isPCell(Flags[i][j]))
+                {
+                    double r = residualCell(P[i - 1], P[i], P[i + 1], RS[i], j, 1, dx, dy);
+                    rloc += r * r;
+                }
+            }
+        }
+    }
+    return sqrt(rloc / noFluidCells);
+}
+
+/* set the homogeneous boundary values of the correction, same rules as set_pressure_boundary() */
+static void set_correction_boundary(int imax, int jmax, float **E, flag **Flags, const TileList *tiles)
+{
+    int i, j;
     for (i = 1; i <= imax; i++)
     {
-        P[i][0] = P[i][1];
-        P[i][jmax + 1] = P[i][jmax];
+        E[i][0] = E[i][1];
+        E[i][jmax + 1] = E[i][jmax];
     }
     for (j = 1; j <= jmax; j++)
     {
-        P[0][j] = P[1][j];
-//        P[0][j] = 0; // debug test
-        P[imax + 1][j] = P[imax][j];
+        E[0][j] = E[1][j];
+        E[imax + 1][j] = E[imax][j];
+    }
+    for (int t = 0; t < tiles->numTiles; t++)
+    {
+        const Tile *tile = tiles->tiles + t;
+        for (i = max(tile->ilo, 1); i <= min(tile->ihi, imax); i++)
+        {
+            for (j = max(tile->jlo, 1); j <= min(tile->jhi, jmax); j++)
+            {
+                flag C = Flags[i][j];
+                if (isObstacle(C))
+                {
+                    if (isCorner(C))
+                    {
+                        E[i][j] = (E[i + isNeighbourObstacle(C, LEFT) - isNeighbourObstacle(C, RIGHT)][j] +
+                                   E[i][j + isNeighbourObstacle(C, BOT) - isNeighbourObstacle(C, TOP)]) / 2;
+                    }
+                    else
+                    {
+                        E[i][j] = (!isNeighbourObstacle(C, TOP)) * E[i][j + 1];
+                        E[i][j] += (!isNeighbourObstacle(C, BOT)) * E[i][j - 1];
+                        E[i][j] += (!isNeighbourObstacle(C, RIGHT)) * E[i + 1][j];
+                        E[i][j] += (!isNeighbourObstacle(C, LEFT)) * E[i - 1][j];
+                    }
+                }
+            }
+        }
+    }
+}
+
+void sor_float(double omg, double dx, double dy, int imax, int jmax, float **E, float **R, flag **Flags,
+               const TileList *tiles, int sweeps)
+{
+    // All the arithmetic in float, so that the sweep only moves float data around.
+    const float omgf = (float) omg;
+    const float idx2 = (float) (1.0 / (dx * dx));
+    const float idy2 = (float) (1.0 / (dy * dy));
+    const float coeff = (float) (omg / (2.0 * (1.0 / (dx * dx) + 1.0 / (dy * dy))));
+    
+    for (int s = 0; s < sweeps; s++)
+    {
+        for (int t = 0; t < tiles->numTiles; t++)
+        {
+            const Tile *tile = tiles->tiles + t;
+            for (int i = max(tile->ilo, 1); i <= min(tile->ihi, imax); i++)
+            {
+                for (int j = max(tile->jlo, 1); j <= min(tile->jhi, jmax); j++)
+                {
+                    if (isPCell(Flags[i][j]))
+                    {
+                        E[i][j] = (1.0f - omgf) * E[i][j]
+                                  + coeff * ((E[i + 1][j] + E[i - 1][j]) * idx2 + (E[i][j + 1] + E[i][j - 1]) * idy2 - R[i][j]);
+                    }
+                }
+            }
+        }
+        set_correction_boundary(imax, jmax, E, Flags, tiles);
     }
+}
+
+int sor_refined(double omg, double dx, double dy, int imax, int jmax, real **P, real **RS, flag **Flags,
+                const TileList *tiles, double eps, int itermax, int sweeps, InnerPressureSolver inner, float **E, float **R,
+                double *res, int noFluidCells)
+{
+    int it = 0;
     
-    /* set boundary values on obstacle interface */
-    for (i = 1; i <= imax; i++)
+    set_pressure_boundary(imax, jmax, P, Flags, tiles);
+    while (1)
     {
-        for (j = 1; j <= jmax; j++)
+        /* residual R = RS - A P of the current pressure, computed and reduced in double */
+        double rloc = 0;
+        for (int t = 0; t < tiles->numTiles; t++)
+        {
+            const Tile *tile = tiles->tiles + t;
+            for (int i = max(tile->ilo, 1); i <= min(tile->ihi, imax); i++)
+            {
+                for (int j = max(tile->jlo, 1); j <= min(tile->jhi, jmax); j++)
+                {
+                    if (isPCell(Flags[i][j]))
+                    {
+                        double r = RS[i][j]
+                                   - ((P[i + 1][j] - 2.0 * P[i][j] + P[i - 1][j]) / (dx * dx) +
+                                      (P[i][j + 1] - 2.0 * P[i][j] + P[i][j - 1]) / (dy * dy));
+                        R[i][j] = (float) r;
+                        rloc += r * r;
+                    }
+                }
+            }
+        }
+        *res = sqrt(rloc / noFluidCells);
+        if (*res <= eps || it >= itermax)
+        {
+            return it;
+        }
+        
+        /* solve A E = R approximately in float, the correction starts from 0 at every refinement step */
+        for (int t = 0; t < tiles->numTiles; t++)
         {
-            int C = Flags[i][j];
-            // proceed if obstacle
-            if (isObstacle(C))
+            const Tile *tile = tiles->tiles + t;
+            for (int i = tile->ilo; i <= tile->ihi; i++)
             {
-                if (isCorner(C))
+                for (int j = tile->jlo; j <= tile->jhi; j++)
                 {
-                    P[i][j] = (P[i + isNeighbourObstacle(C, LEFT) - isNeighbourObstacle(C, RIGHT)][j] +
-                               P[i][j + isNeighbourObstacle(C, BOT) - isNeighbourObstacle(C, TOP)]) / 2;
+                    E[i][j] = 0.0f;
                 }
-                else
+            }
+        }
+        /* the outer ghost layer is not necessarily covered by the sparse tiles */
+        for (int i = 0; i <= imax + 1; i++)
+        {
+            E[i][0] = E[i][jmax + 1] = 0.0f;
+        }
+        for (int j = 0; j <= jmax + 1; j++)
+        {
+            E[0][j] = E[imax + 1][j] = 0.0f;
+        }
+        inner(omg, dx, dy, imax, jmax, E, R, Flags, tiles, sweeps);
+        it += sweeps;
+        
+        /* P += E on the fluid cells in full precision, then restore the boundary values */
+        for (int t = 0; t < tiles->numTiles; t++)
+        {
+            const Tile *tile = tiles->tiles + t;
+            for (int i = max(tile->ilo, 1); i <= min(tile->ihi, imax); i++)
+            {
+                for (int j = max(tile->jlo, 1); j <= min(tile->jhi, jmax); j++)
                 {
-                    P[i][j] = (!isNeighbourObstacle(C, TOP)) * P[i][j + 1];
-                    P[i][j] += (!isNeighbourObstacle(C, BOT)) * P[i][j - 1];
-                    P[i][j] += (!isNeighbourObstacle(C, RIGHT)) * P[i + 1][j];
-                    P[i][j] += (!isNeighbourObstacle(C, LEFT)) * P[i - 1][j];
+                    if (isPCell(Flags[i][j]))
+                    {
+                        P[i][j] += E[i][j];
+                    }
                 }
             }
         }
+        set_pressure_boundary(imax, jmax, P, Flags, tiles);
     }
 }
 
+void tune_tiles(double omg, double dx, double dy, int imax, int jmax, flag **Flags, int sparse, int *tileI, int *tileJ)
+{
+    // Candidate tile sizes (0 = whole extent). The fields are stored row-wise in j, so short rows are what keeps
+    // the three rows of P read by the stencil in cache.
+    static const int DENSE[][2] = {{0, 0}, {0, 1024}, {0, 512}, {0, 256}, {0, 128}, {256, 256}, {128, 128}, {64, 64}};
+    static const int SPARSE[][2] = {{8, 8}, {16, 16}, {32, 32}, {64, 64}, {128, 128}};
+    const int (*candidates)[2] = sparse ? SPARSE : DENSE;
+    int numCandidates = sparse ? sizeof(SPARSE) / sizeof(SPARSE[0]) : sizeof(DENSE) / sizeof(DENSE[0]);
+    
+    // Scratch fields, written once so that the timings do not include the first touch of the pages
+    real **P = matrix(0, imax + 1, 0, jmax + 1);
+    real **RS = matrix(0, imax + 1, 0, jmax + 1);
+    init_matrix(P, 0, imax + 1, 0, jmax + 1, 0);
+    init_matrix(RS, 0, imax + 1, 0, jmax + 1, 0);
+    
+    // Enough sweeps for about 4M cell updates per measurement, at least 2
+    int sweeps = max(2, (int) (4e6 / ((imax + 2.0) * (jmax + 2.0))));
+    double bestTime = -1;
+    int tested[8][2];
+    int numTested = 0;
+    for (int c = 0; c < numCandidates; c++)
+    {
+        TileList tiles;
+        double res;
+        build_tiles(&tiles, Flags, imax, jmax, candidates[c][0], candidates[c][1], sparse);
+        
+        // On small grids several candidates are clipped to the same tiles
+        int duplicate = 0;
+        for (int k = 0; k < numTested; k++)
+            duplicate |= (tested[k][0] == tiles.tileI && tested[k][1] == tiles.tileJ);
+        if (duplicate)
+        {
+            free_tiles(&tiles);
+            continue;
+        }
+        tested[numTested][0] = tiles.tileI;
+        tested[numTested][1] = tiles.tileJ;
+        numTested++;
+        
+        double time = -1;
+        for (int repeat = 0; repeat < 2; repeat++)
+        {
+            clock_t start = clock();
+            for (int s = 0; s < sweeps; s++)
+            {
+                sor(omg, dx, dy, imax, jmax, P, RS, Flags, &tiles, &res, 1);
+            }
+            double elapsed = (double) (clock() - start) / CLOCKS_PER_SEC;
+            if (time < 0 || elapsed < time)
+                time = elapsed;
+        }
+        logMsg("Tile autotuning: %dx%d tiles, %.3f ms per SOR sweep", tiles.tileI, tiles.tileJ, 1e3 * time / sweeps);
+        if (bestTime < 0 || time < bestTime)
+        {
+            bestTime = time;
+            *tileI = candidates[c][0];
+            *tileJ = candidates[c][1];
+        }
+        free_tiles(&tiles);
+    }
+    
+    free_matrix(P, 0, imax + 1, 0, jmax + 1);
+    free_matrix(RS, 0, imax + 1, 0, jmax + 1);
+}
+
+// Sweeps discarded before measuring the reduction rate, the first ones damp the fast modes
+#define ADAPTIVE_OMEGA_BURN_IN 3
+// Minimum number of measured sweeps for a step to give an estimate
+#define ADAPTIVE_OMEGA_MIN_SWEEPS 5
+// Steps per phase, at most ADAPTIVE_OMEGA_MAX_STEPS are spent looking for usable estimates
+#define ADAPTIVE_OMEGA_STEPS 5
+#define ADAPTIVE_OMEGA_MAX_STEPS 20
+// Steps after which the choice is made again, the solves get shorter as the flow settles
+#define ADAPTIVE_OMEGA_PERIOD 500
+// Upper bound of omg: the pure Neumann problem has rho_J -> 1, i.e. an optimum -> 2
+#define ADAPTIVE_OMEGA_MAX 1.95
+
+static void adaptive_omega_restart(AdaptiveOmega *adaptive)
+{
+    adaptive->omg = adaptive->configured;
+    adaptive->trial = adaptive->configured;
+    adaptive->averageIterations = 0;
+    adaptive->phase = 0;
+    adaptive->phaseSteps = 0;
+    adaptive->samples = 0;
+    adaptive->sumRate = 0;
+    adaptive->sumIterations[0] = adaptive->sumIterations[1] = 0;
+    adaptive->iterStart = adaptive->iterLast = 0;
+    adaptive->resStart = adaptive->resLast = 0;
+}
+
+void adaptive_omega_init(AdaptiveOmega *adaptive, double omg)
+{
+    adaptive->configured = omg;
+    adaptive_omega_restart(adaptive);
+}
+
+void adaptive_omega_record(AdaptiveOmega *adaptive, int it, double res)
+{
+    if (adaptive->phase > 1)
+        return;
+    if (adaptive->iterStart == 0 && it >= ADAPTIVE_OMEGA_BURN_IN)
+    {
+        adaptive->iterStart = it;
+        adaptive->resStart = res;
+    }
+    adaptive->iterLast = it;
+    adaptive->resLast = res;
+}
+
+void adaptive_omega_end_step(AdaptiveOmega *adaptive, double t)
+{
+    if (adaptive->phase > 1)
+    {
+        if (++adaptive->phaseSteps >= ADAPTIVE_OMEGA_PERIOD)
+        {
+            adaptive_omega_restart(adaptive);
+        }
+        return;
+    }
+    
+    int phase = adaptive->phase;
+    int sweeps = adaptive->iterLast - adaptive->iterStart;
+    adaptive->phaseSteps++;
+    adaptive->sumIterations[phase] += adaptive->iterLast;
+    if (phase == 0 && adaptive->iterStart > 0 && sweeps >= ADAPTIVE_OMEGA_MIN_SWEEPS && adaptive->resStart > 0)
+    {
+        double rate = pow(adaptive->resLast / adaptive->resStart, 1.0 / sweeps);
+        if (rate > 0 && rate < 1)
+        {
+            adaptive->sumRate += rate;
+            adaptive->samples++;
+        }
+    }
+    adaptive->iterStart = adaptive->iterLast = 0;
+    
+    if (phase == 0)
+    {
+        if (adaptive->samples < ADAPTIVE_OMEGA_STEPS && adaptive->phaseSteps < ADAPTIVE_OMEGA_MAX_STEPS)
+            return;
+        if (adaptive->samples == 0)
+        {
+            adaptive->phase = 2;
+            adaptive->phaseSteps = 0;
+            logEvent(t, "INFO: adaptive omega: no estimate of the convergence rate, keeping omg=%f", adaptive->omg);
+            return;
+        }
+        
+        // Young's theory: the dominant eigenvalue lambda of SOR(omg) and the spectral radius mu of Jacobi
+        // satisfy (lambda + omg - 1)^2 = lambda omg^2 mu^2 as long as omg is below the optimum, above it
+        // |lambda| = omg - 1 and mu can not be recovered.
+        double omg = adaptive->configured;
+        double lambda = adaptive->sumRate / adaptive->samples;
+        double young = omg;
+        if (lambda > omg - 1)
+        {
+            double mu2 = fmin((lambda + omg - 1) * (lambda + omg - 1) / (lambda * omg * omg), 1.0);
+            young = fmin(2.0 / (1.0 + sqrt(1.0 - mu2)), ADAPTIVE_OMEGA_MAX);
+            logEvent(t, "INFO: adaptive omega: SOR rate %f at omg=%f, rho_J=%f, optimum omg=%f", lambda, omg,
+                     sqrt(mu2), young);
+        }
+        else
+        {
+            logEvent(t, "INFO: adaptive omega: SOR rate %f at omg=%f, omg is already above the optimum", lambda, omg);
+        }
+        if (fabs(young - omg) < 1e-3)
+        {
+            adaptive->phase = 2;
+            adaptive->phaseSteps = 0;
+            logEvent(t, "INFO: adaptive omega: omg set to %f", adaptive->omg);
+            return;
+        }
+        // Trial of the estimated optimum: it is asymptotic, the short warm started solves of the single steps
+        // may well prefer a smaller omg, so it is only kept if it actually takes fewer iterations
+        adaptive->averageIterations = adaptive->sumIterations[0] / adaptive->phaseSteps;
+        adaptive->trial = young;
+        adaptive->omg = young;
+        adaptive->phase = 1;
+        adaptive->phaseSteps = 0;
+        return;
+    }
+    
+    if (adaptive->phaseSteps < ADAPTIVE_OMEGA_STEPS)
+        return;
+    double trialIterations = adaptive->sumIterations[1] / adaptive->phaseSteps;
+    if (trialIterations >= adaptive->averageIterations)
+    {
+        adaptive->omg = adaptive->configured;
+    }
+    adaptive->phase = 2;
+    adaptive->phaseSteps = 0;
+    logEvent(t, "INFO: adaptive omega: %.1f iterations per step with omg=%f, %.1f with omg=%f, omg set to %f",
+             adaptive->averageIterations, adaptive->configured, trialIterations, adaptive->trial, adaptive->omg);
+}
+
+// Steps of the measurement windows (the first PRESSURE_SETTLE ones are not counted, the previous choice still
+// shows in them) and steps the cheaper choice is kept for before measuring again, doubled every time the
+// choice does not change
+#define PRESSURE_WINDOW 32
+#define PRESSURE_SETTLE 8
+#define PRESSURE_HOLD 256
+#define PRESSURE_HOLD_MAX 8192
+
+void init_pressure_history(PressureHistory *history, int order, int imax, int jmax)
+{
+    history->order = min(max(order, 1), 2);
+    history->count = 0;
+    history->havePressure = 0;
+    history->timeP = 0;
+    for (int k = 0; k < 2; k++)
+    {
+        history->fields[k] = (k < history->order) ? matrix(0, imax + 1, 0, jmax + 1) : NULL;
+        history->times[k] = 0;
+        history->sumIterations[k] = 0;
+        history->numSteps[k] = 0;
+    }
+    history->enabled = 1;
+    history->phase = 0;
+    history->phaseSteps = 0;
+    history->hold = PRESSURE_HOLD;
+    history->choice = -1;
+}
+
+int extrapolate_pressure(PressureHistory *history, double t, int imax, int jmax, real **P, flag **Flags,
+                         const TileList *tiles)
+{
+    if (!history->havePressure)
+    {
+        // P is still the initial condition, it becomes a solution with the first solve
+        history->havePressure = 1;
+        history->timeP = t;
+        return 0;
+    }
+    
+    // Lagrange weights of P (node 0) and of the stored fields (nodes 1..k) at time t
+    int k = history->enabled ? min(history->order, history->count) : 0;
+    double nodes[3] = {history->timeP, history->times[0], history->times[1]};
+    double w[3];
+    for (int a = 0; a <= k; a++)
+    {
+        w[a] = 1;
+        for (int b = 0; b <= k; b++)
+        {
+            if (b != a)
+                w[a] *= (t - nodes[b]) / (nodes[a] - nodes[b]);
+        }
+    }
+    
+    // The oldest buffer receives the current P once its own value has been read
+    real **oldest = history->fields[history->order - 1];
+    real **f0 = history->fields[0];
+    real **f1 = history->fields[1];
+    for (int tt = 0; tt < tiles->numTiles; tt++)
+    {
+        const Tile *tile = tiles->tiles + tt;
+        for (int i = max(tile->ilo, 1); i <= min(tile->ihi, imax); i++)
+        {
+            for (int j = max(tile->jlo, 1); j <= min(tile->jhi, jmax); j++)
+            {
+                if (isPCell(Flags[i][j]))
+                {
+                    double p = P[i][j];
+                    double guess = w[0] * p;
+                    if (k >= 1)
+                        guess += w[1] * f0[i][j];
+                    if (k >= 2)
+                        guess += w[2] * f1[i][j];
+                    oldest[i][j] = p;
+                    P[i][j] = guess;
+                }
+            }
+        }
+    }
+    
+    // Rotate the buffers, the last pressure becomes the most recent field
+    if (history->order == 2)
+    {
+        history->fields[1] = history->fields[0];
+        history->times[1] = history->times[0];
+    }
+    history->fields[0] = oldest;
+    history->times[0] = history->timeP;
+    history->count = min(history->count + 1, history->order);
+    history->timeP = t;
+    
+    if (k == 0)
+        return 0;
+    set_pressure_boundary(imax, jmax, P, Flags, tiles);
+    return 1;
+}
+
+void free_pressure_history(PressureHistory *history, int imax, int jmax)
+{
+    for (int k = 0; k < history->order; k++)
+    {
+        free_matrix(history->fields[k], 0, imax + 1, 0, jmax + 1);
+        history->fields[k] = NULL;
+    }
+}
+
+void record_pressure_iterations(PressureHistory *history, int extrapolated, int iterations, double t)
+{
+    if (!history->havePressure || history->count == 0)
+        return;
+    history->phaseSteps++;
+    if (history->phase == 2)
+    {
+        if (history->phaseSteps >= history->hold)
+        {
+            history->enabled = 1;
+            history->phase = 0;
+            history->phaseSteps = 0;
+        }
+        return;
+    }
+    
+    if (history->phaseSteps > PRESSURE_SETTLE)
+    {
+        history->sumIterations[extrapolated] += iterations;
+        history->numSteps[extrapolated]++;
+    }
+    if (history->phaseSteps < PRESSURE_WINDOW)
+        return;
+    history->phaseSteps = 0;
+    if (history->phase == 0)
+    {
+        history->enabled = 0;
+        history->phase = 1;
+        return;
+    }
+    
+    double extrapolation = (double) history->sumIterations[1] / history->numSteps[1];
+    double plain = (double) history->sumIterations[0] / history->numSteps[0];
+    int enabled = extrapolation < plain;
+    history->hold = (enabled == history->choice) ? min(2 * history->hold, PRESSURE_HOLD_MAX) : PRESSURE_HOLD;
+    history->choice = enabled;
+    history->enabled = enabled;
+    history->phase = 2;
+    logEvent(t, "INFO: pressure extrapolation: %.1f SOR iterations per step extrapolated, %.1f plain, "
+                "%.1f saved per step, extrapolation %s", extrapolation, plain, plain - extrapolation,
+             history->enabled ? "on" : "off");
+    for (int k = 0; k < 2; k++)
+    {
+        history->sumIterations[k] = 0;
+        history->numSteps[k] = 0;
+    }
+}
+
+void sor_ensemble(const double *omg, double dx, double dy, int imax, int jmax, real **P, real **RS, flag **Flags,
+                  const TileList *tiles, double *res, int noFluidCells)
+{
+    sorLanes(ENSEMBLE_WIDTH, omg, dx, dy, imax, jmax, P, RS, Flags, tiles, res, noFluidCells);
+}
@@ -1,14 +1,212 @@
 #ifndef __SOR_H_
 #define __SOR_H_
 
+#include "precision.h"
+#include "flags.h"
+#include "tiles.h"
+#include "ensemble.h"
+
 /**
  * One GS iteration for the pressure Poisson equation. Besides, the routine must 
  * also set the boundary values for P according to the specification. The 
  * residual for the termination criteria has to be stored in res.
  * 
  * An \omega = 1 GS - implementation is given within sor.c.
+ *
+ * The cells are relaxed tile by tile (see tiles.h), so with several tiles the
+ * Gauss-Seidel ordering follows the tiles rather than the plain row order.
+ */
+void sor(double omg, double dx, double dy, int imax, int jmax, real **P, real **RS, flag **Flags,
+         const TileList *tiles, double *res, int noFluidCells);
+
+/**
+ * Sets the boundary values of P: homogeneous Neumann on the domain boundary and
+ * averages of the fluid neighbours on the obstacle cells. Called at the end of sor().
+ */
+void set_pressure_boundary(int imax, int jmax, real **P, flag **Flags, const TileList *tiles);
+
+/**
+ * Temporally blocked SOR: performs sweeps iterations of sor() in one pass over P,
+ * advancing a wavefront of 2*sweeps+3 rows that stays in cache, and computes the
+ * residual (stored in res) only after the last one. P is the same as after sweeps
+ * calls of sor() on a single tile (the tiles are not used). The residual is taken
+ * with the boundary values already updated, unlike in sor().
  */
-void sor(double omg, double dx, double dy, int imax, int jmax, double **P, double **RS, int **Flags, double *res, int noFluidCells);
+void sor_blocked(double omg, double dx, double dy, int imax, int jmax, real **P, real **RS, flag **Flags, int sweeps,
+                 double *res, int noFluidCells);
 
+/**
+ * Work matrices of line_sor(), the eliminated coefficients of the tridiagonal systems.
+ */
+typedef struct LineRelaxation
+{
+    real **upper;   // modified superdiagonal of the Thomas algorithm, 0..imax+1 x 0..jmax+1
+    real **rhs;     // modified rhs
+} LineRelaxation;
+
+void init_line_relaxation(LineRelaxation *lines, int imax, int jmax);
+
+void free_line_relaxation(LineRelaxation *lines, int imax, int jmax);
+
+/**
+ * Line SOR: one iteration solves every grid line exactly for its own cells, the
+ * neighbours on the adjacent lines being taken as known (a tridiagonal system per
+ * line, Thomas algorithm), first the lines in y-direction, then the ones in
+ * x-direction, each time over-relaxed by omg. The lines are visited in zebra order
+ * (odd lines, then even ones), so those of one colour are independent and the
+ * lines in x-direction are eliminated all together, the innermost loop running
+ * over the contiguous index.
+ *
+ * Point SOR only couples the cells through their neighbours' old values, which
+ * makes it crawl when 1/dx^2 and 1/dy^2 differ a lot (stretched cells, or the long
+ * thin channels resolved with fewer cells across): the strongly coupled direction
+ * is solved exactly here, and the error left is smooth along it. The obstacle and
+ * ghost neighbours of a line enter as Neumann conditions plus the lag of their
+ * boundary value, so P converges to the same solution as with sor().
+ *
+ * Same arguments, boundary values and residual as sor(), of which it is a drop-in
+ * replacement, also as the smoother of a coarse grid correction. The tiles only
+ * restrict the boundary update and the residual, the lines always span the grid.
+ */
+void line_sor(double omg, double dx, double dy, int imax, int jmax, real **P, real **RS, flag **Flags,
+              const TileList *tiles, LineRelaxation *lines, double *res, int noFluidCells);
+
+/**
+ * One SOR iteration of the ENSEMBLE_WIDTH lanes of the ensemble fields P and RS (see
+ * ensemble.h), with the relaxation factor omg[k] for lane k: the same iteration, residual
+ * (res[k]) and boundary values as sor() for every lane.
+ */
+void sor_ensemble(const double *omg, double dx, double dy, int imax, int jmax, real **P, real **RS, flag **Flags,
+                  const TileList *tiles, double *res, int noFluidCells);
+
+/**
+ * Residual of the pressure Poisson equation, as computed by sor(), over the tiles
+ * (the whole grid if tiles is NULL).
+ */
+double pressure_residual(double dx, double dy, int imax, int jmax, real **P, real **RS, flag **Flags,
+                         const TileList *tiles, int noFluidCells);
+
+/**
+ * Inner solver for the mixed precision refinement: performs sweeps relaxation
+ * steps on A E = R, with float E and R and the homogeneous boundary conditions of P.
+ */
+typedef void (*InnerPressureSolver)(double omg, double dx, double dy, int imax, int jmax, float **E, float **R,
+                                    flag **Flags, const TileList *tiles, int sweeps);
+
+/**
+ * Float SOR sweeps, the default InnerPressureSolver.
+ */
+void sor_float(double omg, double dx, double dy, int imax, int jmax, float **E, float **R, flag **Flags,
+               const TileList *tiles, int sweeps);
+
+/**
+ * Mixed precision iterative refinement of the pressure Poisson equation.
+ * The residual @f$ R = RS - A P @f$ is computed in double, the correction equation
+ * @f$ A E = R @f$ is relaxed by inner() in float and P += E is applied in the
+ * precision of P, until the residual drops below eps. The converged P is thus as
+ * accurate as with sor() alone, while the bulk of the sweeps only moves float data.
+ *
+ * E and R are float work matrices (0..imax+1, 0..jmax+1). The residual is stored in res.
+ * Returns the number of inner sweeps performed (at most itermax plus one block of sweeps).
+ */
+int sor_refined(double omg, double dx, double dy, int imax, int jmax, real **P, real **RS, flag **Flags,
+                const TileList *tiles, double eps, int itermax, int sweeps, InnerPressureSolver inner, float **E, float **R,
+                double *res, int noFluidCells);
+
+/**
+ * Adaptive relaxation factor, for runs over many geometries without hand tuning of omg.
+ *
+ * - phase 0: the first steps run with the configured omg, the residual reduction per sweep
+ *   lambda is measured after a few burn-in sweeps and the spectral radius of the Jacobi
+ *   iteration rho_J is recovered from it (Young's theory), giving the asymptotically
+ *   optimal omg = 2 / (1 + sqrt(1 - rho_J^2))
+ * - phase 1: a few steps run with that estimate, which is kept if it needs fewer SOR
+ *   iterations per step than the configured omg, since the warm started solves of the
+ *   single steps are often too short for the asymptotic optimum to pay off
+ * - phase 2: omg is kept for a few hundred steps, then the choice is made again, as the
+ *   solves get shorter while the flow settles
+ *
+ * The estimates and the chosen omg are logged. Usage: adaptive_omega_init() once, then at
+ * every step solve with omg, pass the residual after every SOR call with the iteration
+ * count so far to adaptive_omega_record() and call adaptive_omega_end_step().
+ */
+typedef struct AdaptiveOmega
+{
+    double omg;                 // relaxation factor to use for the current step
+    double configured;          // factor of the configuration file
+    double trial;               // estimated optimum, tried in phase 1
+    int phase;
+    int phaseSteps;             // steps done in the current phase
+    int samples;                // steps of phase 0 which gave a usable rate
+    double sumRate;             // sum of the measured rates
+    double sumIterations[2];    // SOR iterations of the phases 0 and 1
+    double averageIterations;   // iterations per step of phase 0
+    int iterStart;              // iteration and residual at the end of the burn-in of the current step
+    double resStart;
+    int iterLast;               // last iteration and residual of the current step
+    double resLast;
+} AdaptiveOmega;
+
+void adaptive_omega_init(AdaptiveOmega *adaptive, double omg);
+
+void adaptive_omega_record(AdaptiveOmega *adaptive, int it, double res);
+
+void adaptive_omega_end_step(AdaptiveOmega *adaptive, double t);
+
+/**
+ * Warm start of the pressure solve: the initial guess of every step is extrapolated in
+ * time from the pressure of the last order + 1 steps (order 1 linear, 2 quadratic,
+ * Lagrange polynomials on the actual, possibly varying, step times) instead of being the
+ * pressure of the last step. The previous fields are kept in a history buffer.
+ *
+ * The extrapolation also amplifies the part of the previous solutions that SOR left
+ * unconverged (mostly smooth error modes, which then persist from step to step), so it
+ * only pays off while the pressure really changes between the steps. The run therefore
+ * alternates a window of extrapolated steps and a window of plain ones, compares their
+ * SOR iterations per step (logged), keeps the cheaper choice for a while and measures again.
+ */
+typedef struct PressureHistory
+{
+    int order;          // 1 linear, 2 quadratic extrapolation
+    int count;          // number of valid fields in the buffer
+    int havePressure;   // 0 as long as P is the initial condition, not a solution
+    double timeP;       // time of the pressure currently in P
+    real **fields[2];   // pressure of the previous steps, most recent first
+    double times[2];
+    int enabled;        // 1 if the steps are extrapolated
+    int phase;          // 0: extrapolated window, 1: plain window, 2: the cheaper choice is kept
+    int phaseSteps;     // steps done in the current phase
+    int hold;           // steps of the phase 2
+    int choice;         // outcome of the last measurement, -1 before the first one
+    int sumIterations[2]; // SOR iterations of the plain (0) and extrapolated (1) windows
+    int numSteps[2];
+} PressureHistory;
+
+void init_pressure_history(PressureHistory *history, int order, int imax, int jmax);
+
+/**
+ * Pushes the last pressure into the history and, if the current step is an extrapolated
+ * one, replaces it in P by the extrapolation to time t (boundary values included).
+ * Returns 1 if P has been extrapolated.
+ */
+int extrapolate_pressure(PressureHistory *history, double t, int imax, int jmax, real **P, flag **Flags,
+                         const TileList *tiles);
+
+/**
+ * Records the SOR iterations of the step, after the two measurement windows logs the
+ * iterations per step with and without extrapolation and chooses between the two.
+ */
+void record_pressure_iterations(PressureHistory *history, int extrapolated, int iterations, double t);
+
+void free_pressure_history(PressureHistory *history, int imax, int jmax);
+
+/**
+ * Tile size autotuning: times a few sweeps of sor() on scratch fields for a set of
+ * candidate tile shapes and stores the fastest one in tileI and tileJ. The pressure
+ * solve dominates the run time and the other kernels share its access pattern, so
+ * its best tiling is used for all of them. With sparse = 1 only square tiles are
+ * tried, so that the blocks inside obstacles can still be dropped.
+ */
+void tune_tiles(double omg, double dx, double dy, int imax, int jmax, flag **Flags, int sparse, int *tileI, int *tileJ);
 
 #endif
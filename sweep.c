@@ -0,0 +1,191 @@
+#include "sweep.h"
+#include "helper.h"
+#include "logger.h"
+#include <stddef.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+// Parameters which may be overridden, with their offset in Parameters
+typedef struct SweepParameter
+{
+    const char *name;
+    size_t offset;
+    int isInt;
+} SweepParameter;
+
+static const SweepParameter PARAMETERS[] = {
+        {"Re",       offsetof(Parameters, Re),       0},
+        {"UI",       offsetof(Parameters, UI),       0},
+        {"VI",       offsetof(Parameters, VI),       0},
+        {"PI",       offsetof(Parameters, PI),       0},
+        {"GX",       offsetof(Parameters, GX),       0},
+        {"GY",       offsetof(Parameters, GY),       0},
+        {"t_end",    offsetof(Parameters, t_end),    0},
+        {"alpha",    offsetof(Parameters, alpha),    0},
+        {"omg",      offsetof(Parameters, omg),      0},
+        {"tau",      offsetof(Parameters, tau),      0},
+        {"eps",      offsetof(Parameters, eps),      0},
+        {"dt_value", offsetof(Parameters, dt_value), 0},
+        {"beta",     offsetof(Parameters, beta),     0},
+        {"TI",       offsetof(Parameters, TI),       0},
+        {"T_h",      offsetof(Parameters, T_h),      0},
+        {"T_c",      offsetof(Parameters, T_c),      0},
+        {"Pr",       offsetof(Parameters, Pr),       0},
+        {"itermax",  offsetof(Parameters, itermax),  1},
+};
+static const int NUM_PARAMETERS = sizeof(PARAMETERS) / sizeof(PARAMETERS[0]);
+
+static const SweepParameter *findParameter(const char *name)
+{
+    for (int p = 0; p < NUM_PARAMETERS; p++)
+    {
+        if (strcmp(PARAMETERS[p].name, name) == 0)
+            return PARAMETERS + p;
+    }
+    return NULL;
+}
+
+static double wallTime()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + 1e-9 * ts.tv_nsec;
+}
+
+int read_sweep(const char *fileName, SweepCase **cases)
+{
+    char szBuff[1024];
+    FILE *fh = fopen(fileName, "rt");
+    if (fh == NULL)
+    {
+        sprintf(szBuff, "Can not read sweep file %s", fileName);
+        ERROR(szBuff);
+    }
+    int numCases = 0, capacity = 16;
+    *cases = (SweepCase *) malloc(capacity * sizeof(SweepCase));
+    char line[1024];
+    int lineNumber = 0;
+    while (fgets(line, sizeof(line), fh) != NULL)
+    {
+        lineNumber++;
+        char *comment = strchr(line, '#');
+        if (comment != NULL)
+            *comment = '\0';
+        char *token = strtok(line, " \t\r\n");
+        if (token == NULL)
+            continue;
+        if (numCases == capacity)
+        {
+            capacity *= 2;
+            *cases = (SweepCase *) realloc(*cases, capacity * sizeof(SweepCase));
+        }
+        SweepCase *sweepCase = *cases + numCases++;
+        snprintf(sweepCase->name, sizeof(sweepCase->name), "%s", token);
+        sweepCase->numOverrides = 0;
+        while ((token = strtok(NULL, " \t\r\n")) != NULL)
+        {
+            char *value = strtok(NULL, " \t\r\n");
+            char *end = NULL;
+            if (findParameter(token) == NULL || value == NULL || sweepCase->numOverrides == SWEEP_MAX_OVERRIDES)
+            {
+                sprintf(szBuff, "%s:%d: %s cannot be overridden (or has no value)", fileName, lineNumber, token);
+                ERROR(szBuff);
+            }
+            sweepCase->values[sweepCase->numOverrides] = strtod(value, &end);
+            if (*end != '\0')
+            {
+                sprintf(szBuff, "%s:%d: %s is no number", fileName, lineNumber, value);
+                ERROR(szBuff);
+            }
+            snprintf(sweepCase->keys[sweepCase->numOverrides], sizeof(sweepCase->keys[0]), "%s", token);
+            sweepCase->numOverrides++;
+        }
+    }
+    fclose(fh);
+    if (numCases == 0)
+    {
+        sprintf(szBuff, "No cases in sweep file %s", fileName);
+        ERROR(szBuff);
+    }
+    return numCases;
+}
+
+void free_sweep(SweepCase *cases)
+{
+    free(cases);
+}
+
+void apply_sweep_case(const SweepCase *sweepCase, Parameters *parameters)
+{
+    for (int o = 0; o < sweepCase->numOverrides; o++)
+    {
+        const SweepParameter *parameter = findParameter(sweepCase->keys[o]);
+        char *field = (char *) parameters + parameter->offset;
+        if (parameter->isInt)
+            *(int *) field = (int) sweepCase->values[o];
+        else
+            *(double *) field = sweepCase->values[o];
+    }
+    size_t length = strlen(parameters->problem);
+    snprintf(parameters->problem + length, sizeof(parameters->problem) - length, "_%s", sweepCase->name);
+}
+
+int run_sweep(const SweepCase *cases, int numCases, int casesPerJob, int jobs, SweepRunner run, void *data)
+{
+    int numJobs = (numCases + casesPerJob - 1) / casesPerJob;
+    jobs = max(1, min(jobs, numJobs));
+    logMsg("Parameter sweep: %d cases, %d per worker, %d workers at a time", numCases, casesPerJob, jobs);
+    pid_t *pids = (pid_t *) malloc(jobs * sizeof(pid_t));
+    int *running = (int *) malloc(jobs * sizeof(int));
+    double *starts = (double *) malloc(jobs * sizeof(double));
+    double start = wallTime();
+    int next = 0, active = 0, failed = 0;
+    while (next < numJobs || active > 0)
+    {
+        // fill the free workers
+        while (active < jobs && next < numJobs)
+        {
+            // no buffered output may be duplicated into the child
+            fflush(NULL);
+            pid_t pid = fork();
+            if (pid < 0)
+                ERROR("Cannot fork the worker of a sweep case");
+            if (pid == 0)
+            {
+                run(cases + next * casesPerJob, min(casesPerJob, numCases - next * casesPerJob), data);
+                exit(0);
+            }
+            pids[active] = pid;
+            running[active] = next++;
+            starts[active] = wallTime();
+            active++;
+        }
+        // wait for any worker, compact the list of running ones
+        int status;
+        pid_t pid = wait(&status);
+        if (pid < 0)
+            ERROR("Lost the workers of the sweep");
+        for (int w = 0; w < active; w++)
+        {
+            if (pids[w] != pid)
+                continue;
+            int first = running[w] * casesPerJob, count = min(casesPerJob, numCases - first);
+            int ok = WIFEXITED(status) && WEXITSTATUS(status) == 0;
+            failed += ok ? 0 : count;
+            logMsg("Sweep case%s %s%s%s %s after %.2f s", (count > 1) ? "s" : "", cases[first].name,
+                   (count > 1) ? " to " : "", (count > 1) ? cases[first + count - 1].name : "",
+                   ok ? "finished" : "FAILED", wallTime() - starts[w]);
+            active--;
+            pids[w] = pids[active];
+            running[w] = running[active];
+            starts[w] = starts[active];
+            break;
+        }
+    }
+    logMsg("Parameter sweep: %d cases in %.2f s, %d failed", numCases, wallTime() - start, failed);
+    free(pids);
+    free(running);
+    free(starts);
+    return failed;
+}
@@ -0,0 +1,70 @@
+#ifndef __SWEEP_H__
+#define __SWEEP_H__
+
+#include "init.h"
+
+/*
+ * Parameter sweeps: many variants of one .dat file run by a single sim process,
+ *
+ *      ./sim problem --sweep cases.sweep [--jobs N] [--ensemble]
+ *
+ * The sweep file lists one case per line, its name followed by the parameters it
+ * overrides ('#' starts a comment):
+ *
+ *      base
+ *      re200      Re 200
+ *      slow       UI 0.5  alpha 0.9
+ *
+ * Only the scalar physical and numerical parameters can be overridden (see
+ * apply_sweep_case()), never the grid, the geometry or the boundary types: the .dat
+ * file is parsed, the PGM read and the Flags, tiles and direct pressure solver set up
+ * once, then the cases run in worker processes forked from that state, sharing its
+ * memory copy-on-write (nothing of it is written by the time steps). Every case writes
+ * its own outputs, prefixed with problem_name (problem_name.log instead of sim.log).
+ *
+ * The cases are handed out one at a time to the first free worker, so with more cases
+ * than workers the load evens out even if the cases run for different times.
+ *
+ * With --ensemble the workers take ENSEMBLE_WIDTH cases at a time and advance them in
+ * lock-step in the interleaved layout of ensemble.h, one case per SIMD lane. Their cases
+ * must then agree on t_end, dt_value, tau and itermax, and the plain algorithm is run
+ * (see ensemble.h), so the solver options of the .dat file must not ask for more.
+ */
+
+#define SWEEP_MAX_OVERRIDES 16
+
+typedef struct SweepCase
+{
+    char name[64];
+    int numOverrides;
+    char keys[SWEEP_MAX_OVERRIDES][16];   // parameter names, as in the .dat file
+    double values[SWEEP_MAX_OVERRIDES];
+} SweepCase;
+
+/**
+ * Reads the cases of the sweep file. Stops with ERROR() on an unknown parameter,
+ * before anything is run. Returns the number of cases, *cases is freed with free_sweep().
+ */
+int read_sweep(const char *fileName, SweepCase **cases);
+
+void free_sweep(SweepCase *cases);
+
+/**
+ * Overrides the parameters of the case in parameters and appends _name to the problem
+ * name. Re, UI, VI, PI, GX, GY, t_end, alpha, omg, tau, eps, dt_value, beta, TI, T_h,
+ * T_c, Pr and itermax can be overridden.
+ */
+void apply_sweep_case(const SweepCase *sweepCase, Parameters *parameters);
+
+typedef void (*SweepRunner)(const SweepCase *cases, int numCases, void *data);
+
+/**
+ * Runs the cases in groups of casesPerJob (1 but with --ensemble), with at most jobs
+ * groups at the same time, each in a process of its own forked from the caller, which
+ * calls run(cases of the group, their number, data) and exits. The completion and wall
+ * time of every group are logged. Returns the number of failed cases (the cases of a
+ * group fail if its process does not exit normally with status 0, e.g. on ERROR()).
+ */
+int run_sweep(const SweepCase *cases, int numCases, int casesPerJob, int jobs, SweepRunner run, void *data);
+
+#endif
@@ -1,22 +1,253 @@
+#define _POSIX_C_SOURCE 200112L
 #include "helper.h"
-#include "visual.h"
-#include "init.h"
-#include "sor.h"
-#include "boundary_val.h"
-#include "uvp.h"
 #include <stdio.h>
+#include <time.h>
 
+/*
+ * Regression suite - how to:
+ * 1) Build sim and regression, the canonical .dat/.pgm files are copied next to the binaries.
+ * 2) From the binary folder run:
+ *      ./regression /path/to/golden CASE
+ *   this runs ./sim CASE, compares the final U, V, P fields (dumped by write_fields()) against
+ *   the golden ones and checks the wall time against the budget of the case (in builds with NDEBUG, i.e. not Debug).
+ * 3) After an intended change of the physics, regenerate the golden fields with:
+ *      ./regression /path/to/golden CASE --update
+ *
+ * ctest runs all the cases (see CMakeLists.txt).
+ */
 
-int main(int argn, char** args){
-	int** Flag = read_pgm("P1.pgm");
+typedef struct RegressionCase
+{
+    const char *name;     // Name of the .dat file (without extension), passed to sim
+    const char *problem;  // Problem name inside the .dat file, prefix of the field dumps
+    const char *golden;   // Case whose golden fields are compared against (variants of a case share them)
+    int imax;
+    int jmax;
+    double budget;        // Wall time budget in seconds, about twice the Release time of the slowest precision
+    double atol;          // Absolute tolerance on U, V
+    double atolP;         // Absolute tolerance on P (only converged up to eps by SOR)
+    double rtol;          // Relative tolerance on all fields
+    double floatScale;    // Tolerance multiplier for float fields (see precision.h)
+    const char *arguments; // Arguments of sim if not just the name, e.g. a parameter sweep (see sweep.h)
+} RegressionCase;
+
+// The golden fields come from the double build. In the float builds the SOR residual of the channel stalls
+// above eps (the pure Neumann pressure drifts to large values), so its fields drift further from the golden ones.
+// The canonical cases use the default pressure solver, the direct one (poisson.h) for the closed cavity and SOR
+// for the channel, whose inflow and outflow the direct solver does not take.
+static const RegressionCase CASES[] = {
+        // name                problem               golden       imax jmax budget atol  atolP rtol  floatScale
+        {"cavity100",         "cavity100",         "cavity100", 50,  50,  8.0,   1e-3, 1e-2, 1e-3, 1.0},
+        {"problem",           "testProblem",       "problem",   100, 40,  95.0,  1e-3, 1e-2, 1e-3, 50.0},
+        // Obstacles in the closed cavity, the golden fields from SOR
+        {"cavity100_obstacles", "cavity100_obstacles", "cavity100_obstacles", 50, 50, 9.0,  1e-3, 1e-2, 1e-3, 1.0},
+        // Variants of the canonical cases with other solver options, these must reproduce the same fields
+        {"cavity100_refined", "cavity100_refined", "cavity100", 50,  50,  7.0,   1e-3, 1e-2, 1e-3, 1.0},
+        // The direct solver with the capacitance matrix of the obstacles, exact in the closed cavity
+        {"cavity100_obstacles_dct", "cavity100_obstacles_dct", "cavity100_obstacles", 50, 50, 9.0,  1e-3, 1e-2, 1e-3,
+                1.0},
+        {"problem_sparse",    "testProblem_sparse", "problem",  100, 40,  70.0,  1e-3, 1e-2, 1e-3, 50.0},
+        {"cavity100_tiled",   "cavity100_tiled",   "cavity100", 50,  50,  10.0,  1e-3, 1e-2, 1e-3, 1.0},
+        {"cavity100_blocked", "cavity100_blocked", "cavity100", 50,  50,  15.0,  1e-3, 1e-2, 1e-3, 1.0},
+        {"cavity100_omega",   "cavity100_omega",   "cavity100", 50,  50,  9.0,   1e-3, 1e-2, 1e-3, 1.0},
+        {"cavity100_extrapolated", "cavity100_extrapolated", "cavity100", 50, 50, 11.0, 1e-3, 1e-2, 1e-3, 1.0},
+        {"cavity100_line",    "cavity100_line",    "cavity100", 50,  50,  22.0,  1e-3, 1e-2, 1e-3, 1.0},
+        {"cavity100_viscous", "cavity100_viscous", "cavity100", 50,  50,  5.0,   1e-3, 1e-2, 1e-3, 1.0},
+        {"cavity100_ab2",     "cavity100_ab2",     "cavity100", 50,  50,  13.0,  1e-3, 1e-2, 1e-3, 1.0},
+        // Started from the steady state of 25 x 25 cells and stopped at the steady state instead of t_end
+        {"cavity100_sequenced", "cavity100_sequenced", "cavity100", 50, 50, 1.5,  1e-3, 1e-2, 1e-3, 1.0},
+        // The semi-Lagrangian steady state depends on dt (see calculate_fg_semi_lagrangian()), hence its own golden
+        {"cavity100_semilagrangian", "cavity100_semilagrangian", "cavity100_semilagrangian", 50, 50, 4.0,  1e-3, 1e-2,
+                1e-3, 1.0},
+        // The step of the channel described by a shape instead of the PGM file, rasterised to the same cells
+        {"problem_shapes",    "testProblem_shapes", "problem",  100, 40,  93.0,  1e-3, 1e-2, 1e-3, 50.0},
+        // The step of the channel from a 250 x 100 image, resampled to the same cells
+        {"problem_resampled", "testProblem_resampled", "problem", 100, 40, 98.0,  1e-3, 1e-2, 1e-3, 50.0},
+        // The step and a plate one cell thick, which the geometry repair removes
+        {"problem_repaired",  "testProblem_repaired", "problem", 100, 40,  93.0,  1e-3, 1e-2, 1e-3, 50.0},
+        // The step and the start of the channel refined twice (see amr.h), the fields of the base grid
+        {"problem_amr",       "testProblem_amr",   "problem_amr", 100, 40, 153.0, 1e-3, 1e-2, 1e-3, 50.0},
+        // Sweep over the cavity, its case without overrides must give the fields of the plain run
+        {"cavity100_sweep",   "cavity100_base",    "cavity100", 50,  50,  32.0,  1e-3, 1e-2, 1e-3, 1.0,
+                "cavity100 --sweep cavity100.sweep"},
+        // Same sweep in lock-step SIMD lanes (ensemble.h), with SOR and the smallest dt of the lanes
+        {"cavity100_ensemble", "cavity100_base",   "cavity100", 50,  50,  42.0,  1e-3, 1e-2, 1e-3, 1.0,
+                "cavity100 --sweep cavity100.sweep --ensemble"},
+};
+static const int NUM_CASES = sizeof(CASES) / sizeof(CASES[0]);
+
+static double wallTime()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + 1e-9 * ts.tv_nsec;
+}
+
+static const RegressionCase *findCase(const char *name)
+{
+    for (int c = 0; c < NUM_CASES; ++c)
+    {
+        if (strcmp(CASES[c].name, name) == 0)
+        {
+            return CASES + c;
+        }
+    }
+    return NULL;
+}
+
+static void copyFile(const char *src, const char *dst)
+{
+    char buffer[4096];
+    size_t n;
+    FILE *in = fopen(src, "rb");
+    FILE *out = fopen(dst, "wb");
+    if (in == NULL || out == NULL)
+    {
+        ERROR("Cannot copy field dump to the golden folder");
+    }
+    while ((n = fread(buffer, 1, sizeof(buffer), in)) > 0)
+    {
+        fwrite(buffer, 1, n, out);
+    }
+    fclose(in);
+    fclose(out);
+}
+
+// Returns the number of entries out of tolerance.
+static int compareField(const RegressionCase *rc, const char *goldenDir, const char *field, double atol,
+                        real **Golden, real **Result)
+{
+    char szResult[256];
+    char szGolden[1024];
+    sprintf(szResult, "%s.%s.bin", rc->problem, field);
+    sprintf(szGolden, "%s/%s.%s.bin", goldenDir, rc->golden, field);
+    read_matrix(szResult, Result, 0, rc->imax + 1, 0, rc->jmax + 1);
+    read_matrix(szGolden, Golden, 0, rc->imax + 1, 0, rc->jmax + 1);
+
+    if (sizeof(real) < sizeof(double))
+    {
+        atol *= rc->floatScale;
+    }
+
+    int failures = 0;
+    double maxDiff = 0;
+    for (int i = 0; i <= rc->imax + 1; ++i)
+    {
+        for (int j = 0; j <= rc->jmax + 1; ++j)
+        {
+            double diff = fabs(Result[i][j] - Golden[i][j]);
+            maxDiff = fmax(maxDiff, diff);
+            if (!(diff <= atol + rc->rtol * fabs(Golden[i][j])))
+            {
+                failures++;
+            }
+        }
+    }
+    printf("%-18s %s: max abs diff = %e, %d entries out of tolerance\n", rc->name, field, maxDiff, failures);
+    return failures;
+}
+
+static int runCase(const RegressionCase *rc, const char *goldenDir, int update)
+{
+    char command[512];
+    sprintf(command, "./sim %s > %s.regression.out", rc->arguments ? rc->arguments : rc->name, rc->name);
 
-	for(int i = 0; i < 53; i++){
-		for(int j = 0; j < 53; j++){
-			printf("%d", Flag[i][j]);
-		}
-		printf("\n");
-	}
+    double start = wallTime();
+    int status = system(command);
+    double elapsed = wallTime() - start;
+
+    if (status != 0)
+    {
+        printf("%-18s FAILED: sim exited with status %d (see %s.regression.out)\n", rc->name, status, rc->name);
+        return 1;
+    }
+    printf("%-18s wall time = %.2fs (budget %.2fs)\n", rc->name, elapsed, rc->budget);
+
+    if (update && strcmp(rc->name, rc->golden) != 0)
+    {
+        printf("%-18s variant of %s, golden fields not updated\n", rc->name, rc->golden);
+        return 0;
+    }
+    if (update)
+    {
+        const char *fields[] = {"U", "V", "P"};
+        for (int f = 0; f < 3; ++f)
+        {
+            char szResult[256];
+            char szGolden[1024];
+            sprintf(szResult, "%s.%s.bin", rc->problem, fields[f]);
+            sprintf(szGolden, "%s/%s.%s.bin", goldenDir, rc->name, fields[f]);
+            copyFile(szResult, szGolden);
+        }
+        printf("%-18s golden fields updated in %s\n", rc->name, goldenDir);
+        return 0;
+    }
+
+    real **Golden = matrix(0, rc->imax + 1, 0, rc->jmax + 1);
+    real **Result = matrix(0, rc->imax + 1, 0, rc->jmax + 1);
+    int failures = 0;
+
+    failures += compareField(rc, goldenDir, "V", rc->atol, Golden, Result);
+    failures += compareField(rc, goldenDir, "P", rc->atolP, Golden, Result);
+    // U last, so that the monitored value below can be taken from the matrices
+    failures += compareField(rc, goldenDir, "U", rc->atol, Golden, Result);
+
+    // Same value logged at the end of main.c (task6)
+    int im = rc->imax / 2;
+    int jm = 7 * rc->jmax / 8;
+    double atol = (sizeof(real) < sizeof(double)) ? rc->atol * rc->floatScale : rc->atol;
+    double diff = fabs(Result[im][jm] - Golden[im][jm]);
+    printf("%-18s U[imax/2][7*jmax/8] = %16e (golden %16e)\n", rc->name, Result[im][jm], Golden[im][jm]);
+    if (!(diff <= atol + rc->rtol * fabs(Golden[im][jm])))
+    {
+        printf("%-18s FAILED: U[imax/2][7*jmax/8] out of tolerance\n", rc->name);
+        failures++;
+    }
+
+    free_matrix(Golden, 0, rc->imax + 1, 0, rc->jmax + 1);
+    free_matrix(Result, 0, rc->imax + 1, 0, rc->jmax + 1);
+
+#ifdef NDEBUG
+    // The budgets are Release times, an unoptimised build only compares the fields
+    if (elapsed > rc->budget)
+    {
+        printf("%-18s FAILED: wall time budget exceeded\n", rc->name);
+        failures++;
+    }
+#endif
+    if (failures)
+    {
+        printf("%-18s FAILED\n", rc->name);
+        return 1;
+    }
+    printf("%-18s PASSED\n", rc->name);
+    return 0;
+}
+
+int main(int argn, char** args){
+    if (argn < 3)
+    {
+        printf("Usage: %s GOLDEN_DIR CASE|all [--update]\n", args[0]);
+        return 1;
+    }
+    const char *goldenDir = args[1];
+    int update = (argn > 3 && strcmp(args[3], "--update") == 0);
 
-	free_imatrix(Flag, 0, 52, 0, 52);
+    if (strcmp(args[2], "all") == 0)
+    {
+        int failed = 0;
+        for (int c = 0; c < NUM_CASES; ++c)
+        {
+            failed += runCase(CASES + c, goldenDir, update);
+        }
+        return failed != 0;
+    }
 
-}
\ No newline at end of file
+    const RegressionCase *rc = findCase(args[2]);
+    if (rc == NULL)
+    {
+        printf("Unknown regression case %s\n", args[2]);
+        return 1;
+    }
+    return runCase(rc, goldenDir, update);
+}
@@ -0,0 +1,139 @@
+#include "simulation.h"
+#include "helper.h"
+#include "logger.h"
+#include <pthread.h>
+
+/*
+ * Test of the solver library (see simulation.h), run by ctest next to the regression suite:
+ *      ./library_test [CASE]
+ * Two contexts of the case (cavity100 by default), one of them with other parameters, are
+ * first run one after the other in one context (the second after simulation_reset()), then
+ * at the same time in two threads, each with a context of its own. As the contexts share
+ * no state, the concurrent runs must give exactly the fields of the sequential ones. The
+ * sequential context is set up in memory (the .dat text and the geometry bitmap), the
+ * concurrent ones from the files, which must not make any difference either.
+ */
+
+static const double T_RUN = 5.0;   // time run, the steady state is not needed to compare the runs
+
+typedef struct Run
+{
+    Parameters parameters;
+    SolverOptions options;
+    const char *logName;  // of the thread running it
+    real **U, **V, **P;   // fields at T_RUN, copies
+} Run;
+
+static real **copyField(real **A, int imax, int jmax)
+{
+    real **B = matrix(0, imax+1, 0, jmax+1);
+    for (int i = 0; i <= imax + 1; i++)
+    {
+        memcpy(B[i], A[i], (jmax + 2) * sizeof(real));
+    }
+    return B;
+}
+
+static void keepFields(Run *run, const Simulation *sim)
+{
+    int imax = run->parameters.imax, jmax = run->parameters.jmax;
+    run->U = copyField(simulation_field(sim, SIMULATION_U), imax, jmax);
+    run->V = copyField(simulation_field(sim, SIMULATION_V), imax, jmax);
+    run->P = copyField(simulation_field(sim, SIMULATION_P), imax, jmax);
+}
+
+static void *runThread(void *data)
+{
+    Run *run = (Run *) data;
+    redirectLog(run->logName, 0);
+    Simulation *sim = simulation_create(&run->parameters, &run->options);
+    simulation_set_output(sim, 0);
+    simulation_run_until(sim, T_RUN);
+    keepFields(run, sim);
+    simulation_destroy(sim);
+    closeLogFile();
+    return NULL;
+}
+
+// Number of cells where the fields of a and b are not bitwise equal
+static int compareRuns(const Run *a, const Run *b)
+{
+    int imax = a->parameters.imax, jmax = a->parameters.jmax;
+    int differences = 0;
+    for (int i = 0; i <= imax + 1; i++)
+    {
+        for (int j = 0; j <= jmax + 1; j++)
+        {
+            differences += a->U[i][j] != b->U[i][j] || a->V[i][j] != b->V[i][j] || a->P[i][j] != b->P[i][j];
+        }
+    }
+    return differences;
+}
+
+static void freeRun(Run *run)
+{
+    int imax = run->parameters.imax, jmax = run->parameters.jmax;
+    free_matrix(run->U, 0, imax+1, 0, jmax+1);
+    free_matrix(run->V, 0, imax+1, 0, jmax+1);
+    free_matrix(run->P, 0, imax+1, 0, jmax+1);
+}
+
+int main(int argn, char** args)
+{
+    char szFileName[256];
+    snprintf(szFileName, sizeof(szFileName), "%s.dat", (argn > 1) ? args[1] : "cavity100");
+
+    redirectLog("library_test.log", 1);
+    Run sequential[2], concurrent[2];
+    read_parameter_set(szFileName, &sequential[0].parameters);
+    read_solver_options(szFileName, &sequential[0].options);
+    sequential[1] = sequential[0];
+    sequential[1].parameters.Re *= 2;
+    sequential[1].parameters.alpha = 0.9;
+
+    // one context set up in memory, reset to the parameters of the second run
+    Config config;
+    read_config(szFileName, &config);
+    int width, height;
+    int **geometry = read_pgm(sequential[0].parameters.geometry, &width, &height);
+    Simulation *sim = simulation_load_string(config.text, geometry);
+    free_imatrix(geometry, 0, width - 1, 0, height - 1);
+    free_config(&config);
+    simulation_set_output(sim, 0);
+    simulation_run_until(sim, T_RUN);
+    keepFields(&sequential[0], sim);
+    simulation_reset(sim, &sequential[1].parameters);
+    simulation_run_until(sim, T_RUN);
+    keepFields(&sequential[1], sim);
+    simulation_destroy(sim);
+
+    // two contexts at the same time
+    pthread_t threads[2];
+    for (int r = 0; r < 2; r++)
+    {
+        concurrent[r].parameters = sequential[r].parameters;
+        concurrent[r].options = sequential[r].options;
+        concurrent[r].logName = (r == 0) ? "library_test_0.log" : "library_test_1.log";
+        if (pthread_create(threads + r, NULL, runThread, concurrent + r) != 0)
+            ERROR("Cannot start the thread of a run");
+    }
+    for (int r = 0; r < 2; r++)
+    {
+        pthread_join(threads[r], NULL);
+    }
+
+    // the two runs must differ from each other, or mixed up contexts would go unnoticed
+    int failed = compareRuns(sequential + 0, sequential + 1) == 0;
+    for (int r = 0; r < 2; r++)
+    {
+        int differences = compareRuns(sequential + r, concurrent + r);
+        logMsg("Run %d (Re %g, alpha %g): %d cells differ between the sequential and the concurrent context",
+               r, sequential[r].parameters.Re, sequential[r].parameters.alpha, differences);
+        failed += differences > 0;
+        freeRun(sequential + r);
+        freeRun(concurrent + r);
+    }
+    logMsg("%s", failed ? "FAILED" : "PASSED");
+    closeLogFile();
+    return failed != 0;
+}
@@ -0,0 +1,85 @@
+#include "tiles.h"
+#include "helper.h"
+#include "logger.h"
+
+// Returns 1 if the cell or one of its 4 neighbours is fluid, i.e. some kernel may write to it.
+static int isActiveCell(flag **Flags, int imax, int jmax, int i, int j)
+{
+    if (isFluid(Flags[i][j]))
+        return 1;
+    if (i > 0 && isFluid(Flags[i - 1][j]))
+        return 1;
+    if (i < imax + 1 && isFluid(Flags[i + 1][j]))
+        return 1;
+    if (j > 0 && isFluid(Flags[i][j - 1]))
+        return 1;
+    if (j < jmax + 1 && isFluid(Flags[i][j + 1]))
+        return 1;
+    return 0;
+}
+
+static int isActiveTile(flag **Flags, int imax, int jmax, const Tile *tile)
+{
+    for (int i = tile->ilo; i <= tile->ihi; i++)
+    {
+        for (int j = tile->jlo; j <= tile->jhi; j++)
+        {
+            if (isActiveCell(Flags, imax, jmax, i, j))
+                return 1;
+        }
+    }
+    return 0;
+}
+
+void build_tiles(TileList *tiles, flag **Flags, int imax, int jmax, int tileI, int tileJ, int sparse)
+{
+    if (tileI <= 0 || tileI > imax + 2)
+        tileI = imax + 2;
+    if (tileJ <= 0 || tileJ > jmax + 2)
+        tileJ = jmax + 2;
+
+    int numTilesI = (imax + 2 + tileI - 1) / tileI;
+    int numTilesJ = (jmax + 2 + tileJ - 1) / tileJ;
+
+    tiles->tileI = tileI;
+    tiles->tileJ = tileJ;
+    tiles->sparse = sparse;
+    tiles->numTiles = 0;
+    tiles->numCells = 0;
+    tiles->tiles = (Tile *) malloc((size_t) (numTilesI * numTilesJ * sizeof(Tile)));
+    if (tiles->tiles == NULL)
+        ERROR("Storage cannot be allocated");
+
+    // Tiles ordered i-outer, j-inner like the original loops
+    for (int ti = 0; ti < numTilesI; ti++)
+    {
+        for (int tj = 0; tj < numTilesJ; tj++)
+        {
+            Tile tile;
+            tile.ilo = ti * tileI;
+            tile.ihi = min(tile.ilo + tileI - 1, imax + 1);
+            tile.jlo = tj * tileJ;
+            tile.jhi = min(tile.jlo + tileJ - 1, jmax + 1);
+            if (sparse && !isActiveTile(Flags, imax, jmax, &tile))
+                continue;
+            tiles->tiles[tiles->numTiles++] = tile;
+            tiles->numCells += (long) (tile.ihi - tile.ilo + 1) * (tile.jhi - tile.jlo + 1);
+        }
+    }
+}
+
+void log_tiles(const TileList *tiles, int imax, int jmax)
+{
+    int numTilesI = (imax + 2 + tiles->tileI - 1) / tiles->tileI;
+    int numTilesJ = (jmax + 2 + tiles->tileJ - 1) / tiles->tileJ;
+    logMsg("Tiles: %d of %d tiles of %dx%d cells, covering %.1f%% of the grid%s", tiles->numTiles,
+           numTilesI * numTilesJ, tiles->tileI, tiles->tileJ, 100.0 * tiles->numCells / ((imax + 2.0) * (jmax + 2.0)),
+           tiles->sparse ? " (sparse storage)" : "");
+}
+
+void free_tiles(TileList *tiles)
+{
+    free(tiles->tiles);
+    tiles->tiles = NULL;
+    tiles->numTiles = 0;
+}
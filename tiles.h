@@ -0,0 +1,51 @@
+#ifndef __TILES_H__
+#define __TILES_H__
+
+#include "flags.h"
+
+/*
+ * Block index of the grid: the kernels do not sweep the whole (imax+2)*(jmax+2) matrices
+ * but the list of tiles (rectangular blocks of cells, ghost layer included) built here,
+ * clipping every tile to their own index range.
+ *
+ * - dense:  the tiles cover the whole grid, with the default tile size there is a single
+ *           tile and the kernels traverse the grid exactly as before. Smaller tiles are a
+ *           cache blocking of the traversal: the rows of a tile are only tileJ cells long,
+ *           so the neighbouring rows an i-sweep reuses still sit in cache on wide grids.
+ *           The tile size is set with tile_i, tile_j or picked by tune_tiles() (sor.h).
+ * - sparse: only the tiles containing fluid cells or obstacle cells next to fluid (their
+ *           ghost neighbours) are kept. The dropped tiles are deep inside obstacles, where
+ *           all fields are 0 and stay 0, so skipping them does not change the results.
+ *           As the fields are allocated zeroed (matrix() uses calloc) and the dropped tiles
+ *           are never written, their memory pages are not committed either: memory and
+ *           per-step work scale with the fluid fraction rather than the bounding box.
+ */
+typedef struct Tile
+{
+    int ilo, ihi; // inclusive range of cells in x-direction
+    int jlo, jhi; // inclusive range of cells in y-direction
+} Tile;
+
+typedef struct TileList
+{
+    int numTiles;
+    Tile *tiles;
+    int tileI;       // tile size in x-direction
+    int tileJ;       // tile size in y-direction
+    int sparse;      // 1 if the tiles without fluid have been dropped
+    long numCells;   // number of cells covered by the tiles
+} TileList;
+
+/**
+ * Builds the tile list over the cells 0..imax+1 x 0..jmax+1 with tiles of tileI x tileJ
+ * cells (a value <= 0 means the whole extent in that direction). With sparse = 1 only the
+ * tiles holding fluid cells or obstacle cells with a fluid neighbour are kept.
+ */
+void build_tiles(TileList *tiles, flag **Flags, int imax, int jmax, int tileI, int tileJ, int sparse);
+
+// Logs the tile size and the fraction of the grid covered by the tiles
+void log_tiles(const TileList *tiles, int imax, int jmax);
+
+void free_tiles(TileList *tiles);
+
+#endif
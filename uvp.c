@@ -6,6 +6,210 @@
 const short XDIR = 0;
 const short YDIR = 1;
 
+/*
+ * The stencils of the momentum equations on the rows of the fields: am, a and ap are the rows i - 1, i and i + 1, and
+ * the neighbours j -+ 1 of the entry c lie at c -+ s, s being 1 in plain fields and ENSEMBLE_WIDTH in ensemble fields
+ * (see ensemble.h). The scalar and the ensemble kernels share them, as do the derivative functions of uvp.h.
+ */
+static inline double secondDx(const real *am, const real *a, const real *ap, int c, double h)
+{
+    // central difference
+    return (am[c] - 2 * a[c] + ap[c]) / (h * h);
+}
+
+static inline double secondDy(const real *a, int c, int s, double h)
+{
+    return (a[c - s] - 2 * a[c] + a[c + s]) / (h * h);
+}
+
+/* derivative of AB along x as per formula in the worksheet, A (along x) on the rows am, a and B on the rows bm, b, bp */
+static inline double productDx(const real *am, const real *a, const real *bm, const real *b, const real *bp, int c,
+                               int s, double h, double alpha)
+{
+    return 1 / h *
+           (
+                   (a[c] + a[c + s]) / 2 * (b[c] + bp[c]) / 2
+                   - (am[c] + am[c + s]) / 2 * (bm[c] + b[c]) / 2
+           )
+           + alpha / h *
+             (
+                     fabs(a[c] + a[c + s]) / 2 * (b[c] - bp[c]) / 2
+                     - fabs(am[c] + am[c + s]) / 2 * (bm[c] - b[c]) / 2
+             );
+}
+
+/* same along y, A on the row a and B (along y) on the rows b, bp */
+static inline double productDy(const real *a, const real *b, const real *bp, int c, int s, double h, double alpha)
+{
+    return 1 / h *
+           (
+                   (b[c] + bp[c]) / 2 * (a[c] + a[c + s]) / 2
+                   - (b[c - s] + bp[c - s]) / 2 * (a[c - s] + a[c]) / 2
+           )
+           + alpha / h *
+             (
+                     fabs(b[c] + bp[c]) / 2 * (a[c] - a[c + s]) / 2
+                     - fabs(b[c - s] + bp[c - s]) / 2 * (a[c - s] - a[c]) / 2
+             );
+}
+
+/* derivative of AA along x as per formula in the worksheet */
+static inline double squareDx(const real *am, const real *a, const real *ap, int c, double h, double alpha)
+{
+    return 1 / h *
+           (
+                   pow((a[c] + ap[c]) / 2, 2)
+                   - pow((am[c] + a[c]) / 2, 2)
+           )
+           + alpha / h *
+             (
+                     fabs(a[c] + ap[c]) / 2 * (a[c] - ap[c]) / 2
+                     - fabs(am[c] + a[c]) / 2 * (am[c] - a[c]) / 2
+             );
+}
+
+static inline double squareDy(const real *a, int c, int s, double h, double alpha)
+{
+    return 1 / h *
+           (
+                   pow((a[c] + a[c + s]) / 2, 2)
+                   - pow((a[c - s] + a[c]) / 2, 2)
+           )
+           + alpha / h *
+             (
+                     fabs(a[c] + a[c + s]) / 2 * (a[c] - a[c + s]) / 2
+                     - fabs(a[c - s] + a[c]) / 2 * (a[c - s] - a[c]) / 2
+             );
+}
+
+/* F at the entry c of the rows um, u, up of U and v, vp of V (i and i + 1), t being the temperature there */
+static inline double momentumF(const real *um, const real *u, const real *up, const real *v, const real *vp, int c,
+                               int s, double Re, double GX, double alpha, double beta, double t, double dt, double dx,
+                               double dy)
+{
+    return u[c] // velocity u
+           // diffusive term
+           + dt *
+             (
+                     1 / Re * (secondDx(um, u, up, c, dx) + secondDy(u, c, s, dy))
+                     // convective term
+                     - squareDx(um, u, up, c, dx, alpha)
+                     // convective term cont.
+                     - productDy(u, v, vp, c, s, dy, alpha)
+                     // volume force
+                     + (1 - beta * t) * GX
+             );
+}
+
+/* G at the entry c of the rows vm, v, vp of V and um, u of U (i - 1 and i) */
+static inline double momentumG(const real *vm, const real *v, const real *vp, const real *um, const real *u, int c,
+                               int s, double Re, double GY, double alpha, double beta, double t, double dt, double dx,
+                               double dy)
+{
+    return v[c] // velocity v
+    // diffusive term
+    + dt *
+      (
+              1 / Re * (secondDx(vm, v, vp, c, dx) + secondDy(v, c, s, dy))
+              // convective term
+              - productDx(um, u, vm, v, vp, c, s, dx, alpha)
+              // convective term cont.
+              - squareDy(v, c, s, dy, alpha)
+              // volume force
+              + (1 - beta * t) * GY
+      );
+}
+
+/*
+ * F and G on the domain boundary for K lanes (K = 1: plain fields): the normal velocities, the pressure having
+ * homogeneous Neumann conditions
+ */
+static inline void setFGBoundary(int K, int imax, int jmax, real **U, real **V, real **F, real **G)
+{
+    // set boundary conditions for G - see discrete momentum equations - In any case apply Neumann BC - first derivative of pressure must be "zero" - dp/dy = 0
+    for (int i = 1; i <= imax; i++)
+    {
+        for (int k = 0; k < K; k++)
+        {
+            G[i][k] = V[i][k];
+            G[i][jmax * K + k] = V[i][jmax * K + k];
+        }
+    }
+    
+    // // set boundary conditions for F - see discrete momentum equations - In any case apply Neumann BC - first derivative of pressure must be "zero" - dp/dx = 0
+    for (int j = 1; j <= jmax; j++)
+    {
+        for (int k = 0; k < K; k++)
+        {
+            F[0][j * K + k] = U[0][j * K + k];
+            F[imax][j * K + k] = U[imax][j * K + k];
+        }
+    }
+}
+
+/*
+ * calculate_fg() on K lanes of the fields (K = 1: plain fields, ENSEMBLE_WIDTH: ensemble fields), the parameters of
+ * lane k being Re[k], GX[k], ... Both kernels inline it with their constant K.
+ */
+static inline void fgLanes(int K, const double *Re, const double *GX, const double *GY, const double *alpha,
+                           const double *beta, double dt, double dx, double dy, int imax, int jmax, real **U, real **V,
+                           real **F, real **G, real **T, flag **Flags, const TileList *tiles)
+{
+    setFGBoundary(K, imax, jmax, U, V, F, G);
+    
+    // calculate F and G in the domain, tile by tile (see tiles.h)
+    for (int t = 0; t < tiles->numTiles; t++)
+    {
+        const Tile *tile = tiles->tiles + t;
+        
+        // calculate F
+        for (int i = max(tile->ilo, 1); i <= min(tile->ihi, imax - 1); i++)
+        {
+            const real *um = U[i - 1], *u = U[i], *up = U[i + 1], *v = V[i], *vp = V[i + 1];
+            for (int j = max(tile->jlo, 1); j <= min(tile->jhi, jmax); j++)
+            {
+                int c = j * K;
+                // We need to compute F only on edges between 2 fluid cells (see p.6 WS2).
+                if (!isUEdge(Flags[i][j]))
+                {
+                    // Boundary condition for F at the obstacle-fluid interface. (or on the obstacle itself)
+                    for (int k = 0; k < K; k++)
+                        F[i][c + k] = u[c + k];
+                    continue;
+                }
+                for (int k = 0; k < K; k++)
+                {
+                    F[i][c + k] = momentumF(um, u, up, v, vp, c + k, K, Re[k], GX[k], alpha[k], beta[k], T[i][c + k],
+                                            dt, dx, dy);
+                }
+            }
+        }
+        
+        // calculate G
+        for (int i = max(tile->ilo, 1); i <= min(tile->ihi, imax); i++)
+        {
+            const real *vm = V[i - 1], *v = V[i], *vp = V[i + 1], *um = U[i - 1], *u = U[i];
+            for (int j = max(tile->jlo, 1); j <= min(tile->jhi, jmax - 1); j++)
+            {
+                int c = j * K;
+                // We need to compute G only on edges between 2 fluid cells (see p.6 WS2).
+                if (!isVEdge(Flags[i][j]))
+                {
+                    // Boundary condition for G at the obstacle-fluid interface. (or on the obstacle itself)
+                    for (int k = 0; k < K; k++)
+                        G[i][c + k] = v[c + k];
+                    continue;
+                }
+                for (int k = 0; k < K; k++)
+                {
+                    G[i][c + k] = momentumG(vm, v, vp, um, u, c + k, K, Re[k], GY[k], alpha[k], beta[k], T[i][c + k],
+                                            dt, dx, dy);
+                }
+            }
+        }
+    }
+}
+
 /**
  * Determines the value of F and G according to the formula
  *
@@ -29,179 +233,211 @@ const short YDIR = 1;
  */
 
 void calculate_fg(double Re, double GX, double GY, double alpha, double beta, double dt, double dx, double dy, int imax,
-                  int jmax, double **U, double **V, double **F, double **G, double **T, int **Flags)
+                  int jmax, real **U, real **V, real **F, real **G, real **T, flag **Flags, const TileList *tiles)
 {
-    // Compute F, G on boundaries
-    // set boundary conditions for G - see discrete momentum equations - In any case apply Neumann BC - first derivative of pressure must be "zero" - dp/dy = 0
-    for (int i = 1; i <= imax; i++)
-    {
-        G[i][0] = V[i][0];
-        G[i][jmax] = V[i][jmax];
-    }
-    
-    // // set boundary conditions for F - see discrete momentum equations - In any case apply Neumann BC - first derivative of pressure must be "zero" - dp/dx = 0
-    for (int j = 1; j <= jmax; j++)
-    {
-        F[0][j] = U[0][j];
-        F[imax][j] = U[imax][j];
-    }
-    
-    // calculate F in the domain
-    for (int i = 1; i < imax; i++)
-    {
-        for (int j = 1; j <= jmax; j++)
-        {
-            // We need to compute F only on edges between 2 fluid cells (see p.6 WS2).
-            int cell = Flags[i][j];
-            if (isObstacle(cell) || isNeighbourObstacle(cell, RIGHT))
-            {
-                // Boundary condition for F at the obstacle-fluid interface. (or on the obstacle itself)
-                F[i][j] = U[i][j];
-                continue;
-            }
-            //
-            F[i][j] = computeF(Re, GX, alpha, beta, dt, dx, dy, U, V, T, i, j);
-        }
-    }
-    
-    // calculate G in the domain
-    for (int i = 1; i <= imax; i++)
-    {
-        for (int j = 1; j < jmax; j++)
-        {
-            // We need to compute G only on edges between 2 fluid cells (see p.6 WS2).
-            if (isObstacle(Flags[i][j]) || isNeighbourObstacle(Flags[i][j], TOP))
-            {
-                // Boundary condition for G at the obstacle-fluid interface. (or on the obstacle itself)
-                G[i][j] = V[i][j];
-                continue;
-            }
-            //
-            G[i][j] = computeG(Re, GY, alpha, beta, dt, dx, dy, U, V, T, i, j);
-        }
-    }
+    fgLanes(1, &Re, &GX, &GY, &alpha, &beta, dt, dx, dy, imax, jmax, U, V, F, G, T, Flags, tiles);
 }
 
-double computeF(double Re, double GX, double alpha, double beta, double dt, double dx, double dy, double **U, double **V, double **T, int i, int j)
+double computeF(double Re, double GX, double alpha, double beta, double dt, double dx, double dy, real **U, real **V, real **T, int i, int j)
 {
-    return U[i][j] // velocity u
-           // diffusive term
-           + dt *
-             (
-                     1 / Re * (secondDerivativeDx(U, i, j, dx) + secondDerivativeDy(U, i, j, dy))
-                     // convective term
-                     - squareDerivativeDx(U, i, j, dx, alpha)
-                     // convective term cont.
-                     - productDerivativeDy(U, V, i, j, dy, alpha)
-                     // volume force
-                     + (1 - beta * T[i][j]) * GX
-             );
+    return momentumF(U[i - 1], U[i], U[i + 1], V[i], V[i + 1], j, 1, Re, GX, alpha, beta, T[i][j], dt, dx, dy);
 }
 
-double computeG(double Re, double GY, double alpha, double beta, double dt, double dx, double dy, double **U, double **V, double **T, int i, int j)
+double computeG(double Re, double GY, double alpha, double beta, double dt, double dx, double dy, real **U, real **V, real **T, int i, int j)
 {
-    return V[i][j] // velocity v
-    // diffusive term
-    + dt *
-      (
-              1 / Re * (secondDerivativeDx(V, i, j, dx) + secondDerivativeDy(V, i, j, dy))
-              // convective term
-              - productDerivativeDx(U, V, i, j, dx, alpha)
-              // convective term cont.
-              - squareDerivativeDy(V, i, j, dy, alpha)
-              // volume force
-              + (1 - beta * T[i][j]) * GY
-      );
+    return momentumG(V[i - 1], V[i], V[i + 1], U[i - 1], U[i], j, 1, Re, GY, alpha, beta, T[i][j], dt, dx, dy);
 }
 
-double secondDerivativeDx(double **A, int i, int j, double h)
+double secondDerivativeDx(real **A, int i, int j, double h)
 {
-    // Approximate the second derivative via central difference.
-    // A is the matrix of values.
-    // i,j are the coordinates of the central element.
-    // h is the discretization step for the chosen direction
-    return (A[i - 1][j] - 2 * A[i][j] + A[i + 1][j]) / (h * h);
+    return secondDx(A[i - 1], A[i], A[i + 1], j, h);
 }
 
-double secondDerivativeDy(double **A, int i, int j, double h)
+double secondDerivativeDy(real **A, int i, int j, double h)
 {
-    // Approximate the second derivative via central difference.
-    // A is the matrix of values.
-    // i,j are the coordinates of the central element.
-    // h is the discretization step for the chosen direction
-    return (A[i][j - 1] - 2 * A[i][j] + A[i][j + 1]) / (h * h);
+    return secondDy(A[i], j, 1, h);
 }
 
-double productDerivativeDx(double **A, double **B, int i, int j, double h, double alpha)
+double productDerivativeDx(real **A, real **B, int i, int j, double h, double alpha)
 {
-    // Approximate the derivative of the AB product as per formula in the worksheet.
     // A,B are the matrices of values. (Their order is important: A is along x, B along y)
-    // i,j are the coordinates of the central element.
-    // h is the discretization step for the chosen direction
-    return 1 / h *
-           (
-                   (A[i][j] + A[i][j + 1]) / 2 * (B[i][j] + B[i + 1][j]) / 2
-                   - (A[i - 1][j] + A[i - 1][j + 1]) / 2 * (B[i - 1][j] + B[i][j]) / 2
-           )
-           + alpha / h *
-             (
-                     fabs(A[i][j] + A[i][j + 1]) / 2 * (B[i][j] - B[i + 1][j]) / 2
-                     - fabs(A[i - 1][j] + A[i - 1][j + 1]) / 2 * (B[i - 1][j] - B[i][j]) / 2
-             );
+    return productDx(A[i - 1], A[i], B[i - 1], B[i], B[i + 1], j, 1, h, alpha);
 }
 
-double productDerivativeDy(double **A, double **B, int i, int j, double h, double alpha)
+double productDerivativeDy(real **A, real **B, int i, int j, double h, double alpha)
 {
-    // Approximate the derivative of the AB product as per formula in the worksheet.
-    // A,B are the matrices of values. (Their order is important: A is along x, B along y)
-    // i,j are the coordinates of the central element.
-    // h is the discretization step for the chosen direction
-    return 1 / h *
-           (
-                   (B[i][j] + B[i + 1][j]) / 2 * (A[i][j] + A[i][j + 1]) / 2
-                   - (B[i][j - 1] + B[i + 1][j - 1]) / 2 * (A[i][j - 1] + A[i][j]) / 2
-           )
-           + alpha / h *
-             (
-                     fabs(B[i][j] + B[i + 1][j]) / 2 * (A[i][j] - A[i][j + 1]) / 2
-                     - fabs(B[i][j - 1] + B[i + 1][j - 1]) / 2 * (A[i][j - 1] - A[i][j]) / 2
-             );
+    return productDy(A[i], B[i], B[i + 1], j, 1, h, alpha);
 }
 
-double squareDerivativeDx(double **A, int i, int j, double h, double alpha)
+double squareDerivativeDx(real **A, int i, int j, double h, double alpha)
 {
-    // Approximate the derivative of the AA product as per formula in the worksheet.
-    // A is the matrices of values.
-    // i,j are the coordinates of the central element.
-    // h is the discretization step for the chosen direction
-    return 1 / h *
-           (
-                   pow((A[i][j] + A[i + 1][j]) / 2, 2)
-                   - pow((A[i - 1][j] + A[i][j]) / 2, 2)
-           )
-           + alpha / h *
-             (
-                     fabs(A[i][j] + A[i + 1][j]) / 2 * (A[i][j] - A[i + 1][j]) / 2
-                     - fabs(A[i - 1][j] + A[i][j]) / 2 * (A[i - 1][j] - A[i][j]) / 2
-             );
+    return squareDx(A[i - 1], A[i], A[i + 1], j, h, alpha);
 }
 
-double squareDerivativeDy(double **A, int i, int j, double h, double alpha)
+double squareDerivativeDy(real **A, int i, int j, double h, double alpha)
 {
-    // Approximate the derivative of the AA product as per formula in the worksheet.
-    // A is the matrices of values.
-    // i,j are the coordinates of the central element.
-    // h is the discretization step for the chosen direction
-    return 1 / h *
-           (
-                   pow((A[i][j] + A[i][j + 1]) / 2, 2)
-                   - pow((A[i][j - 1] + A[i][j]) / 2, 2)
-           )
-           + alpha / h *
-             (
-                     fabs(A[i][j] + A[i][j + 1]) / 2 * (A[i][j] - A[i][j + 1]) / 2
-                     - fabs(A[i][j - 1] + A[i][j]) / 2 * (A[i][j - 1] - A[i][j]) / 2
-             );
+    return squareDy(A[i], j, 1, h, alpha);
+}
+
+/* Catmull-Rom weights of the points -1, 0, 1, 2 at the fraction a between 0 and 1 */
+static void cubicWeights(double a, double w[4])
+{
+    w[0] = a * (-0.5 + a * (1.0 - 0.5 * a));
+    w[1] = 1.0 + a * a * (-2.5 + 1.5 * a);
+    w[2] = a * (0.5 + a * (2.0 - 1.5 * a));
+    w[3] = a * a * (-0.5 + 0.5 * a);
+}
+
+/*
+ * Interpolation of the field A at the grid coordinates (fi, fj), A[i][j] lying at (i, j), the indices clamped to
+ * ilo..ihi, jlo..jhi: bilinear, or with cubic = 1 bicubic (Catmull-Rom) limited to the range of the 4 nearest values,
+ * so that no new extrema appear (which would make the advection unstable near walls).
+ */
+static double interpolate(real **A, int ilo, int ihi, int jlo, int jhi, double fi, double fj, int cubic)
+{
+    int i = min(max((int) floor(fi), ilo), ihi - 1);
+    int j = min(max((int) floor(fj), jlo), jhi - 1);
+    double a = fmin(fmax(fi - i, 0.0), 1.0), b = fmin(fmax(fj - j, 0.0), 1.0);
+    if (!cubic)
+    {
+        return (1 - a) * ((1 - b) * A[i][j] + b * A[i][j + 1]) + a * ((1 - b) * A[i + 1][j] + b * A[i + 1][j + 1]);
+    }
+    double wi[4], wj[4];
+    cubicWeights(a, wi);
+    cubicWeights(b, wj);
+    double value = 0;
+    for (int k = 0; k < 4; k++)
+    {
+        real *row = A[min(max(i - 1 + k, ilo), ihi)];
+        double sum = 0;
+        for (int l = 0; l < 4; l++)
+        {
+            sum += wj[l] * row[min(max(j - 1 + l, jlo), jhi)];
+        }
+        value += wi[k] * sum;
+    }
+    double lo = fmin(fmin(A[i][j], A[i][j + 1]), fmin(A[i + 1][j], A[i + 1][j + 1]));
+    double hi = fmax(fmax(A[i][j], A[i][j + 1]), fmax(A[i + 1][j], A[i + 1][j + 1]));
+    return fmin(fmax(value, lo), hi);
+}
+
+/* U at the point (x, y), U being staggered at x = i dx, y = (j - 1/2) dy */
+static double interpolateU(real **U, int imax, int jmax, double dx, double dy, double x, double y, int cubic)
+{
+    return interpolate(U, 0, imax, 0, jmax + 1, x / dx, y / dy + 0.5, cubic);
+}
+
+/* same for V, staggered at x = (i - 1/2) dx, y = j dy */
+static double interpolateV(real **V, int imax, int jmax, double dx, double dy, double x, double y, int cubic)
+{
+    return interpolate(V, 0, imax + 1, 0, jmax, x / dx + 0.5, y / dy, cubic);
+}
+
+/* 1 if the point, inside the domain, lies in a fluid cell */
+static int isFluidPoint(flag **Flags, int imax, int jmax, double dx, double dy, double x, double y)
+{
+    int i = min((int) (x / dx) + 1, imax), j = min((int) (y / dy) + 1, jmax);
+    return isPCell(Flags[i][j]);
+}
+
+/*
+ * Follows the characteristic through (x, y) back over dt, midpoint rule in substeps of at most one cell. A point
+ * beyond the domain boundary is moved back onto it (the characteristic slides along the wall); where it would enter
+ * an obstacle the last point in the fluid is kept.
+ */
+static void backtrace(real **U, real **V, flag **Flags, int imax, int jmax, double dx, double dy, double dt,
+                      double *x, double *y)
+{
+    // the path only needs the bilinear velocities, the bicubic interpolation is kept for the transported value
+    double u = interpolateU(U, imax, jmax, dx, dy, *x, *y, 0), v = interpolateV(V, imax, jmax, dx, dy, *x, *y, 0);
+    int steps = 1 + (int) fmax(fabs(u) * dt / dx, fabs(v) * dt / dy);
+    double h = dt / steps;
+    for (int s = 0; s < steps; s++)
+    {
+        if (s > 0)
+        {
+            u = interpolateU(U, imax, jmax, dx, dy, *x, *y, 0);
+            v = interpolateV(V, imax, jmax, dx, dy, *x, *y, 0);
+        }
+        double xm = *x - h / 2 * u, ym = *y - h / 2 * v;
+        double xn = *x - h * interpolateU(U, imax, jmax, dx, dy, xm, ym, 0);
+        double yn = *y - h * interpolateV(V, imax, jmax, dx, dy, xm, ym, 0);
+        xn = fmin(fmax(xn, 0.0), imax * dx);
+        yn = fmin(fmax(yn, 0.0), jmax * dy);
+        if (!isFluidPoint(Flags, imax, jmax, dx, dy, xn, yn))
+            break;
+        *x = xn;
+        *y = yn;
+    }
+}
+
+void calculate_fg_semi_lagrangian(double Re, double GX, double GY, double beta, double dt, double dx, double dy,
+                                  int imax, int jmax, real **U, real **V, real **F, real **G, real **T, flag **Flags,
+                                  const TileList *tiles)
+{
+    setFGBoundary(1, imax, jmax, U, V, F, G);
+    
+    for (int t = 0; t < tiles->numTiles; t++)
+    {
+        const Tile *tile = tiles->tiles + t;
+        for (int i = max(tile->ilo, 1); i <= min(tile->ihi, imax - 1); i++)
+        {
+            for (int j = max(tile->jlo, 1); j <= min(tile->jhi, jmax); j++)
+            {
+                if (!isUEdge(Flags[i][j]))
+                {
+                    F[i][j] = U[i][j];
+                    continue;
+                }
+                double x = i * dx, y = (j - 0.5) * dy;
+                backtrace(U, V, Flags, imax, jmax, dx, dy, dt, &x, &y);
+                F[i][j] = interpolateU(U, imax, jmax, dx, dy, x, y, 1)
+                          + dt * (1 / Re * (secondDerivativeDx(U, i, j, dx) + secondDerivativeDy(U, i, j, dy))
+                                  + (1 - beta * T[i][j]) * GX);
+            }
+        }
+        for (int i = max(tile->ilo, 1); i <= min(tile->ihi, imax); i++)
+        {
+            for (int j = max(tile->jlo, 1); j <= min(tile->jhi, jmax - 1); j++)
+            {
+                if (!isVEdge(Flags[i][j]))
+                {
+                    G[i][j] = V[i][j];
+                    continue;
+                }
+                double x = (i - 0.5) * dx, y = j * dy;
+                backtrace(U, V, Flags, imax, jmax, dx, dy, dt, &x, &y);
+                G[i][j] = interpolateV(V, imax, jmax, dx, dy, x, y, 1)
+                          + dt * (1 / Re * (secondDerivativeDx(V, i, j, dx) + secondDerivativeDy(V, i, j, dy))
+                                  + (1 - beta * T[i][j]) * GY);
+            }
+        }
+    }
+}
+
+/* calculate_rs() on K lanes of the fields, as fgLanes() */
+static inline void rsLanes(int K, double dt, double dx, double dy, int imax, int jmax, real **F, real **G, real **RS,
+                           flag **Flags, const TileList *tiles)
+{
+    for (int t = 0; t < tiles->numTiles; t++)
+    {
+        const Tile *tile = tiles->tiles + t;
+        for (int i = max(tile->ilo, 1); i <= min(tile->ihi, imax); i++)
+        {
+            for (int j = max(tile->jlo, 1); j <= min(tile->jhi, jmax); j++)
+            {
+                if (isPCell(Flags[i][j])) // TODO: double check if this restriction is correct
+                {
+                    int c = j * K;
+                    for (int k = 0; k < K; k++)
+                    {
+                        RS[i][c + k] = ((F[i][c + k] - F[i - 1][c + k]) / dx
+                                        + (G[i][c + k] - G[i][c - K + k]) / dy) / dt;
+                    }
+                }
+            }
+        }
+    }
 }
 
 /**
@@ -211,20 +447,57 @@ double squareDerivativeDy(double **A, int i, int j, double h, double alpha)
  * @f$ rs = \frac{1}{\delta t} \left( \frac{F^{(n)}_{i,j}-F^{(n)}_{i-1,j}}{\delta x} + \frac{G^{(n)}_{i,j}-G^{(n)}_{i,j-1}}{\delta y} \right)  @f$
  *
  */
-void calculate_rs(double dt, double dx, double dy, int imax, int jmax, double **F, double **G, double **RS, int **Flags)
+void calculate_rs(double dt, double dx, double dy, int imax, int jmax, real **F, real **G, real **RS, flag **Flags,
+                  const TileList *tiles)
+{
+    rsLanes(1, dt, dx, dy, imax, jmax, F, G, RS, Flags, tiles);
+}
+
+/* largest |U| and |V| of each of K lanes of the fields, over the tiles */
+static inline void velocityMaxima(int K, int imax, int jmax, real **U, real **V, const TileList *tiles, double *u_max,
+                                  double *v_max)
 {
-    for (int i = 1; i < imax + 1; i++)
+    for (int k = 0; k < K; k++)
     {
-        for (int j = 1; j < jmax + 1; j++)
+        u_max[k] = 0;
+        v_max[k] = 0;
+    }
+    for (int t = 0; t < tiles->numTiles; t++)
+    {
+        const Tile *tile = tiles->tiles + t;
+        for (int i = tile->ilo; i <= min(tile->ihi, imax); i++)
         {
-            if (isFluid(Flags[i][j])) // TODO: double check if this restriction is correct
+            for (int j = tile->jlo; j <= min(tile->jhi, jmax); j++)
             {
-                RS[i][j] = ((F[i][j] - F[i - 1][j]) / dx + (G[i][j] - G[i][j - 1]) / dy) / dt;
+                for (int k = 0; k < K; k++)
+                {
+                    if (fabs(U[i][j * K + k]) > u_max[k])
+                    {
+                        u_max[k] = fabs(U[i][j * K + k]);
+                    }
+                    if (fabs(V[i][j * K + k]) > v_max[k])
+                    {
+                        v_max[k] = fabs(V[i][j * K + k]);
+                    }
+                }
             }
         }
     }
 }
 
+/* the stability bound of the step before the safety factor tau, the factors scaling its two parts */
+static double stepBound(double Re, double Pr, double dx, double dy, double u_max, double v_max, double diffusiveFactor,
+                        double convectiveFactor)
+{
+    // Pr is optional in the parameter file (0 if absent): only the momentum diffusion bound applies then.
+    double diffusionRe = (Pr > 0) ? fmin(Re, Re * Pr) : Re;
+    double minimum = convectiveFactor * fmin(dx / u_max, dy / v_max);
+    // with implicit diffusion (implicit_viscous_fg()) only the convective bound is left
+    if (diffusiveFactor > 0)
+        minimum = fmin(diffusiveFactor * (diffusionRe / 2 / (1 / pow(dx, 2) + 1 / pow(dy, 2))), minimum);
+    return minimum;
+}
+
 /**
  * Determines the maximal time step size. The time step size is restricted
  * accordin to the CFL theorem. So the final time step size formula is given
@@ -243,29 +516,52 @@ void calculate_dt(
         double dy,
         int imax,
         int jmax,
-        double **U,
-        double **V
+        real **U,
+        real **V,
+        double diffusiveFactor,
+        double convectiveFactor,
+        const TileList *tiles
 )
 {
-    double u_max = 0, v_max = 0;
-    for (int i = 0; i < imax + 1; i++)
+    double u_max, v_max;
+    velocityMaxima(1, imax, jmax, U, V, tiles, &u_max, &v_max);
+    *dt = tau * stepBound(Re, Pr, dx, dy, u_max, v_max, diffusiveFactor, convectiveFactor);
+}
+
+/* calculate_uv() on K lanes of the fields, as fgLanes() */
+static inline void uvLanes(int K, double dt, double dx, double dy, int imax, int jmax, real **U, real **V, real **F,
+                           real **G, real **P, flag **Flags, const TileList *tiles)
+{
+    for (int t = 0; t < tiles->numTiles; t++)
     {
-        for (int j = 0; j < jmax + 1; j++)
+        const Tile *tile = tiles->tiles + t;
+        for (int i = max(tile->ilo, 1); i <= min(tile->ihi, imax - 1); ++i)
         {
-            if (fabs(U[i][j]) > u_max)
+            for (int j = max(tile->jlo, 1); j <= min(tile->jhi, jmax); ++j)
             {
-                u_max = fabs(U[i][j]);
+                if (isUEdge(Flags[i][j]))
+                {
+                    // We need to compute velocity updates only on edges between 2 fluid cells (see p.6 WS2).
+                    int c = j * K;
+                    for (int k = 0; k < K; k++)
+                        U[i][c + k] = F[i][c + k] - (dt / dx * (P[i + 1][c + k] - P[i][c + k]));
+                }
             }
-            if (fabs(V[i][j]) > v_max)
+        }
+        for (int i = max(tile->ilo, 1); i <= min(tile->ihi, imax); ++i)
+        {
+            for (int j = max(tile->jlo, 1); j <= min(tile->jhi, jmax - 1); ++j)
             {
-                v_max = fabs(V[i][j]);
+                if (isVEdge(Flags[i][j]))
+                {
+                    // We need to compute velocity updates only on edges between 2 fluid cells (see p.6 WS2).
+                    int c = j * K;
+                    for (int k = 0; k < K; k++)
+                        V[i][c + k] = G[i][c + k] - (dt / dy * (P[i][c + K + k] - P[i][c + k]));
+                }
             }
         }
     }
-
-    //printf("%f\n", dy / v_max); // todo: can this be removed?
-    double minimum = fmin((Re * Pr / 2 / (1 / pow(dx, 2) + 1 / pow(dy, 2))), fmin(dx / u_max, dy / v_max));
-    *dt = tau * minimum;
 }
 
 /**
@@ -282,38 +578,14 @@ void calculate_dt(
  * @image html calculate_uv.jpg
  */
 
-void calculate_uv(double dt, double dx, double dy, int imax, int jmax, double **U, double **V, double **F, double **G,
-                  double **P, int **Flags)
+void calculate_uv(double dt, double dx, double dy, int imax, int jmax, real **U, real **V, real **F, real **G,
+                  real **P, flag **Flags, const TileList *tiles)
 {
-    for (int i = 1; i < imax; ++i)
-    {
-        for (int j = 1; j < jmax + 1; ++j)
-        {
-            int cell = Flags[i][j];
-            if (isFluid(cell) && isNeighbourFluid(cell,RIGHT))
-            {
-                // We need to compute velocity updates only on edges between 2 fluid cells (see p.6 WS2).
-                U[i][j] = F[i][j] - (dt / dx * (P[i + 1][j] - P[i][j]));
-            }
-        }
-    }
-    for (int i = 1; i < imax + 1; ++i)
-    {
-        for (int j = 1; j < jmax; ++j)
-        {
-            int cell = Flags[i][j];
-            if (isFluid(cell) && isNeighbourFluid(cell,TOP))
-            {
-                // We need to compute velocity updates only on edges between 2 fluid cells (see p.6 WS2).
-                V[i][j] = G[i][j] - (dt / dy * (P[i][j + 1] - P[i][j]));
-            }
-        }
-    }
+    uvLanes(1, dt, dx, dy, imax, jmax, U, V, F, G, P, Flags, tiles);
 }
 
-
 void calculate_T(double Re, double Pr, double dt, double dx, double dy, double alpha, int imax, int jmax,
-                 double **T, double **U, double **V){
+                 real **T, real **U, real **V){
     for(int i=0; i < imax+1; ++i){
         for(int j=0; j < jmax+1; ++j){
             T[i][j] = T[i][j] + dt *
@@ -345,3 +617,179 @@ void calculate_T(double Re, double Pr, double dt, double dx, double dy, double a
         }
     }
 }
+
+/* increments of the masked entries along the lines in x-direction: (1 - r Dxx) D = D, all lines (j) solved together */
+static void diffuseLinesX(double r, int imax, int jmax, real **D, flag **Flags, KernelMask mask, real **W)
+{
+    for (int i = 1; i <= imax; i++)
+    {
+        for (int j = 1; j <= jmax; j++)
+        {
+            // the neighbours outside the mask keep their value, their increment is 0
+            if ((Flags[i][j] >> mask) & 1)
+            {
+                double a = ((Flags[i - 1][j] >> mask) & 1) ? -r : 0.0;
+                double c = ((Flags[i + 1][j] >> mask) & 1) ? -r : 0.0;
+                double m = 1.0 / (1.0 + 2.0 * r - a * W[i - 1][j]);
+                W[i][j] = c * m;
+                D[i][j] = (D[i][j] - a * D[i - 1][j]) * m;
+            }
+            else
+            {
+                W[i][j] = 0.0;
+            }
+        }
+    }
+    for (int i = imax - 1; i >= 1; i--)
+    {
+        for (int j = 1; j <= jmax; j++)
+        {
+            if ((Flags[i][j] >> mask) & 1)
+                D[i][j] -= W[i][j] * D[i + 1][j];
+        }
+    }
+}
+
+/* same in y-direction, line by line along the contiguous index */
+static void diffuseLinesY(double r, int imax, int jmax, real **D, flag **Flags, KernelMask mask, real **W)
+{
+    for (int i = 1; i <= imax; i++)
+    {
+        for (int j = 1; j <= jmax; j++)
+        {
+            if ((Flags[i][j] >> mask) & 1)
+            {
+                double a = ((Flags[i][j - 1] >> mask) & 1) ? -r : 0.0;
+                double c = ((Flags[i][j + 1] >> mask) & 1) ? -r : 0.0;
+                double m = 1.0 / (1.0 + 2.0 * r - a * W[i][j - 1]);
+                W[i][j] = c * m;
+                D[i][j] = (D[i][j] - a * D[i][j - 1]) * m;
+            }
+            else
+            {
+                W[i][j] = 0.0;
+            }
+        }
+        for (int j = jmax - 1; j >= 1; j--)
+        {
+            if ((Flags[i][j] >> mask) & 1)
+                D[i][j] -= W[i][j] * D[i][j + 1];
+        }
+    }
+}
+
+void implicit_diffusion(double diffusivity, double dt, double dx, double dy, int imax, int jmax, real **D, flag **Flags,
+                        KernelMask mask, real **W)
+{
+    diffuseLinesX(diffusivity * dt / (dx * dx), imax, jmax, D, Flags, mask, W);
+    diffuseLinesY(diffusivity * dt / (dy * dy), imax, jmax, D, Flags, mask, W);
+}
+
+void implicit_viscous_fg(double Re, double dt, double dx, double dy, int imax, int jmax, real **U, real **V, real **F,
+                         real **G, real **P, flag **Flags, real **W)
+{
+    // increments with respect to the velocity the old pressure alone would give, F = U + dt dp/dx at steady state
+    for (int i = 1; i <= imax; i++)
+    {
+        for (int j = 1; j <= jmax; j++)
+        {
+            if (isUEdge(Flags[i][j]))
+                F[i][j] -= U[i][j] + dt / dx * (P[i + 1][j] - P[i][j]);
+            if (isVEdge(Flags[i][j]))
+                G[i][j] -= V[i][j] + dt / dy * (P[i][j + 1] - P[i][j]);
+        }
+    }
+    implicit_diffusion(1 / Re, dt, dx, dy, imax, jmax, F, Flags, U_EDGE, W);
+    implicit_diffusion(1 / Re, dt, dx, dy, imax, jmax, G, Flags, V_EDGE, W);
+    for (int i = 1; i <= imax; i++)
+    {
+        for (int j = 1; j <= jmax; j++)
+        {
+            if (isUEdge(Flags[i][j]))
+                F[i][j] += U[i][j] + dt / dx * (P[i + 1][j] - P[i][j]);
+            if (isVEdge(Flags[i][j]))
+                G[i][j] += V[i][j] + dt / dy * (P[i][j + 1] - P[i][j]);
+        }
+    }
+}
+
+void init_adams_bashforth(AdamsBashforth *ab, int imax, int jmax)
+{
+    ab->HU = matrix(0, imax + 1, 0, jmax + 1);
+    ab->HV = matrix(0, imax + 1, 0, jmax + 1);
+    ab->dtPrev = 0;
+}
+
+void adams_bashforth_fg(AdamsBashforth *ab, double dt, int imax, int jmax, real **U, real **V, real **F, real **G,
+                        flag **Flags, const TileList *tiles)
+{
+    // weights of the current and the last explicit terms, for a step dt after one of dtPrev (Euler at the first step)
+    double w = (ab->dtPrev > 0) ? dt / ab->dtPrev : 0.0;
+    double current = 1.0 + w / 2, last = w / 2;
+    for (int t = 0; t < tiles->numTiles; t++)
+    {
+        const Tile *tile = tiles->tiles + t;
+        for (int i = max(tile->ilo, 1); i <= min(tile->ihi, imax - 1); i++)
+        {
+            for (int j = max(tile->jlo, 1); j <= min(tile->jhi, jmax); j++)
+            {
+                if (isUEdge(Flags[i][j]))
+                {
+                    real H = (F[i][j] - U[i][j]) / dt;
+                    F[i][j] = U[i][j] + dt * (current * H - last * ab->HU[i][j]);
+                    ab->HU[i][j] = H;
+                }
+            }
+        }
+        for (int i = max(tile->ilo, 1); i <= min(tile->ihi, imax); i++)
+        {
+            for (int j = max(tile->jlo, 1); j <= min(tile->jhi, jmax - 1); j++)
+            {
+                if (isVEdge(Flags[i][j]))
+                {
+                    real H = (G[i][j] - V[i][j]) / dt;
+                    G[i][j] = V[i][j] + dt * (current * H - last * ab->HV[i][j]);
+                    ab->HV[i][j] = H;
+                }
+            }
+        }
+    }
+    ab->dtPrev = dt;
+}
+
+void free_adams_bashforth(AdamsBashforth *ab, int imax, int jmax)
+{
+    free_matrix(ab->HU, 0, imax + 1, 0, jmax + 1);
+    free_matrix(ab->HV, 0, imax + 1, 0, jmax + 1);
+}
+
+void calculate_fg_ensemble(const double *Re, const double *GX, const double *GY, const double *alpha,
+                           const double *beta, double dt, double dx, double dy, int imax, int jmax, real **U, real **V,
+                           real **F, real **G, real **T, flag **Flags, const TileList *tiles)
+{
+    fgLanes(ENSEMBLE_WIDTH, Re, GX, GY, alpha, beta, dt, dx, dy, imax, jmax, U, V, F, G, T, Flags, tiles);
+}
+
+void calculate_rs_ensemble(double dt, double dx, double dy, int imax, int jmax, real **F, real **G, real **RS,
+                           flag **Flags, const TileList *tiles)
+{
+    rsLanes(ENSEMBLE_WIDTH, dt, dx, dy, imax, jmax, F, G, RS, Flags, tiles);
+}
+
+void calculate_dt_ensemble(const double *Re, const double *Pr, double tau, double *dt, double dx, double dy, int imax,
+                           int jmax, real **U, real **V, const TileList *tiles)
+{
+    double u_max[ENSEMBLE_WIDTH], v_max[ENSEMBLE_WIDTH];
+    velocityMaxima(ENSEMBLE_WIDTH, imax, jmax, U, V, tiles, u_max, v_max);
+    // the bound of calculate_dt() of every lane, the smallest one is taken by all
+    double minimum = INFINITY;
+    for (int k = 0; k < ENSEMBLE_WIDTH; k++)
+        minimum = fmin(minimum, stepBound(Re[k], Pr[k], dx, dy, u_max[k], v_max[k], 1.0, 1.0));
+    *dt = tau * minimum;
+}
+
+void calculate_uv_ensemble(double dt, double dx, double dy, int imax, int jmax, real **U, real **V, real **F, real **G,
+                           real **P, flag **Flags, const TileList *tiles)
+{
+    uvLanes(ENSEMBLE_WIDTH, dt, dx, dy, imax, jmax, U, V, F, G, P, Flags, tiles);
+}
@@ -3,6 +3,8 @@
 
 
 #include "boundary_val.h"
+#include "tiles.h"
+#include "ensemble.h"
 
 /**
  * Determines the value of U and G according to the formula
@@ -26,16 +28,40 @@
  *
  */
 void calculate_fg(double Re, double GX, double GY, double alpha, double beta, double dt, double dx, double dy, int imax,
-                  int jmax, double **U, double **V, double **F, double **G, double **T, int **Flags);
+                  int jmax, real **U, real **V, real **F, real **G, real **T, flag **Flags, const TileList *tiles);
+
+/**
+ * Same as calculate_fg(), but with semi-Lagrangian advection instead of the donor cell
+ * convective terms: F at a U edge is U interpolated at the departure point of the
+ * characteristic through the edge, traced back over dt (midpoint rule with bilinear
+ * velocities, in substeps of at most one cell), plus dt times the viscous and volume
+ * force terms
+ *
+ * @f$ F_{i,j} := u(\mathbf{x}_{i,j} - \delta t \, \mathbf{u}) + \delta t \left( \frac{1}{Re} \Delta u_{i,j} + g_x \right) @f$
+ *
+ * and G alike. The advection is then stable for any dt, so that dt is only limited by
+ * the accuracy wanted (see calculate_dt()). The interpolation is bicubic, limited to the
+ * range of the nearest values. Characteristics slide along the domain walls and stop in
+ * front of obstacles, so only fluid velocities and the boundary values around them are read.
+ *
+ * Like the Euler step it is first order in time, the forces acting at the edge rather than
+ * along the characteristic: steady flows depend on dt by a diffusion along the streamlines
+ * of the order of dt |u|^2, so large steps suit transients and early stages better than
+ * converged steady states.
+ */
+void calculate_fg_semi_lagrangian(double Re, double GX, double GY, double beta, double dt, double dx, double dy,
+                                  int imax, int jmax, real **U, real **V, real **F, real **G, real **T, flag **Flags,
+                                  const TileList *tiles);
+
 // Helper functions for calculate_fg
-double computeF(double Re, double GX, double alpha, double beta, double dt, double dx, double dy, double **U, double **V, double **T, int i, int j);
-double computeG(double Re, double GY, double alpha, double beta, double dt, double dx, double dy, double **U, double **V, double **T, int i, int j);
-double secondDerivativeDx(double** A, int i, int j, double h);
-double secondDerivativeDy(double** A, int i, int j, double h);
-double productDerivativeDx(double** A, double** B, int i, int j, double h, double alpha);
-double productDerivativeDy(double** A, double** B, int i, int j, double h, double alpha);
-double squareDerivativeDx(double **A, int i, int j, double h, double alpha);
-double squareDerivativeDy(double **A, int i, int j, double h, double alpha);
+double computeF(double Re, double GX, double alpha, double beta, double dt, double dx, double dy, real **U, real **V, real **T, int i, int j);
+double computeG(double Re, double GY, double alpha, double beta, double dt, double dx, double dy, real **U, real **V, real **T, int i, int j);
+double secondDerivativeDx(real** A, int i, int j, double h);
+double secondDerivativeDy(real** A, int i, int j, double h);
+double productDerivativeDx(real** A, real** B, int i, int j, double h, double alpha);
+double productDerivativeDy(real** A, real** B, int i, int j, double h, double alpha);
+double squareDerivativeDx(real **A, int i, int j, double h, double alpha);
+double squareDerivativeDy(real **A, int i, int j, double h, double alpha);
 
 /**
  * This operation computes the right hand side of the pressure poisson equation.
@@ -45,7 +71,8 @@ double squareDerivativeDy(double **A, int i, int j, double h, double alpha);
  *
  */
 void
-calculate_rs(double dt, double dx, double dy, int imax, int jmax, double **F, double **G, double **RS, int **Flags);
+calculate_rs(double dt, double dx, double dy, int imax, int jmax, real **F, real **G, real **RS, flag **Flags,
+             const TileList *tiles);
 
 
 /**
@@ -55,6 +82,11 @@ calculate_rs(double dt, double dx, double dy, int imax, int jmax, double **F, do
  *
  * @f$ {\delta t} := \tau \, \min\left( \frac{Re}{2}\left(\frac{1}{{\delta x}^2} + \frac{1}{{\delta y}^2}\right)^{-1},  \frac{{\delta x}}{|u_{max}|},\frac{{\delta y}}{|v_{max}|} \right) @f$
  *
+ * The first (diffusive) bound is scaled by diffusiveFactor: 1 for the Euler steps,
+ * 0.5 for the Adams-Bashforth ones (adams_bashforth_fg()), and 0 leaves it out, if the
+ * viscous terms are made implicit by implicit_viscous_fg(). The convective bounds are
+ * scaled by convectiveFactor, 1 but with the semi-Lagrangian advection, whose steps may
+ * cross several cells (calculate_fg_semi_lagrangian()).
  */
 void calculate_dt(
   double Re,
@@ -65,8 +97,11 @@ void calculate_dt(
   double dy,
   int imax,
   int jmax,
-  double **U,
-  double **V
+  real **U,
+  real **V,
+  double diffusiveFactor,
+  double convectiveFactor,
+  const TileList *tiles
 );
 
 
@@ -83,11 +118,85 @@ void calculate_dt(
  *
  * @image html calculate_uv.jpg
  */
-void calculate_uv(double dt, double dx, double dy, int imax, int jmax, double **U, double **V, double **F, double **G,
-                  double **P, int **Flags);
+void calculate_uv(double dt, double dx, double dy, int imax, int jmax, real **U, real **V, real **F, real **G,
+                  real **P, flag **Flags, const TileList *tiles);
 
 
 void calculate_T(double Re, double Pr, double dt, double dx, double dy, double alpha, int imax, int jmax,
-                 double **T, double **U, double **V);
+                 real **T, real **U, real **V);
+
+/**
+ * Makes the diffusion of an explicit Euler step implicit (Douglas ADI in delta form):
+ * the increment D of the step is replaced in place by the solution of
+ *
+ * @f$ (1 - \delta t \, \kappa \, \partial_{xx}) (1 - \delta t \, \kappa \, \partial_{yy}) D^{new} = D @f$
+ *
+ * i.e. two sets of tridiagonal systems, one per grid line in x-direction then in
+ * y-direction. To first order in dt the diffusion of the step is then taken at the
+ * new time level (backward Euler), which is stable for any dt, while the other terms
+ * of the step are unchanged. Only the entries of D whose mask bit (see flags.h) is set
+ * are unknowns; the others, among them the boundary values, keep their increment 0.
+ *
+ * diffusivity is kappa, W a work matrix (0..imax+1, 0..jmax+1) whose row 0 and
+ * column 0 must be 0.
+ */
+void implicit_diffusion(double diffusivity, double dt, double dx, double dy, int imax, int jmax, real **D, flag **Flags,
+                        KernelMask mask, real **W);
+
+/**
+ * Semi-implicit viscous term: called after calculate_fg(), with the U, V and P of the
+ * last step, it makes the viscous terms of F and G implicit (implicit_diffusion() on
+ * the U and V edges). The increments are taken with respect to the velocity the last
+ * pressure gradient alone would give, so that a steady flow is the same as with the
+ * explicit terms. calculate_dt() may then drop its diffusive bound.
+ */
+void implicit_viscous_fg(double Re, double dt, double dx, double dy, int imax, int jmax, real **U, real **V, real **F,
+                         real **G, real **P, flag **Flags, real **W);
+
+/**
+ * Second order Adams-Bashforth (AB2) time integration of the momentum step. calculate_fg()
+ * takes an explicit Euler step, F = U + dt H(U, V); adams_bashforth_fg(), called right
+ * after it, replaces the explicit terms H by the extrapolation
+ *
+ * @f$ F = U + \delta t \left( (1 + \frac{\omega}{2}) H^{n} - \frac{\omega}{2} H^{n-1} \right), \quad \omega = \frac{\delta t^{n}}{\delta t^{n-1}} @f$
+ *
+ * which is second order accurate also for varying steps, still with one pressure solve
+ * per step. The terms of the last step are kept in the struct, the first step is Euler.
+ * A steady flow is the same as with the Euler steps. AB2 is stable on a shorter stretch
+ * of the real axis than Euler, so with explicit viscous terms calculate_dt() halves
+ * its diffusive bound.
+ */
+typedef struct AdamsBashforth
+{
+    real **HU;      // explicit terms of the last step on the U edges, (F - U) / dt of calculate_fg()
+    real **HV;      // same on the V edges
+    double dtPrev;  // last step, 0 before the first one
+} AdamsBashforth;
+
+void init_adams_bashforth(AdamsBashforth *ab, int imax, int jmax);
+
+void adams_bashforth_fg(AdamsBashforth *ab, double dt, int imax, int jmax, real **U, real **V, real **F, real **G,
+                        flag **Flags, const TileList *tiles);
+
+void free_adams_bashforth(AdamsBashforth *ab, int imax, int jmax);
+
+/**
+ * Ensemble versions of calculate_fg(), calculate_rs(), calculate_dt() and calculate_uv():
+ * the same formulas for the ENSEMBLE_WIDTH lanes of ensemble fields (see ensemble.h), each
+ * lane with its own parameters (arrays of ENSEMBLE_WIDTH values) but all with the same dt.
+ * calculate_dt_ensemble() returns the smallest of the steps calculate_dt() gives the lanes.
+ */
+void calculate_fg_ensemble(const double *Re, const double *GX, const double *GY, const double *alpha,
+                           const double *beta, double dt, double dx, double dy, int imax, int jmax, real **U, real **V,
+                           real **F, real **G, real **T, flag **Flags, const TileList *tiles);
+
+void calculate_rs_ensemble(double dt, double dx, double dy, int imax, int jmax, real **F, real **G, real **RS,
+                           flag **Flags, const TileList *tiles);
+
+void calculate_dt_ensemble(const double *Re, const double *Pr, double tau, double *dt, double dx, double dy, int imax,
+                           int jmax, real **U, real **V, const TileList *tiles);
+
+void calculate_uv_ensemble(double dt, double dx, double dy, int imax, int jmax, real **U, real **V, real **F, real **G,
+                           real **P, flag **Flags, const TileList *tiles);
 
 #endif
@@ -2,21 +2,34 @@
 #include "visual.h"
 #include <stdio.h>
 
+// File name of the problem with the suffix, e.g. ".U.bin"; stops with ERROR() rather than cut the name short
+static void fileName(char *szFileName, size_t size, const char *szProblem, const char *szSuffix)
+{
+    int length = snprintf(szFileName, size, "%s%s", szProblem, szSuffix);
+    if (length < 0 || length >= (int) size)
+    {
+        char szBuff[MAX_LINE_LENGTH + 100];
+        snprintf(szBuff, sizeof(szBuff), "Output file name of %.*s too long", MAX_LINE_LENGTH, szProblem);
+        ERROR(szBuff);
+    }
+}
 
 void
 write_vtkFile(const char *szProblem, int timeStepNumber, double xlength, double ylength, int imax, int jmax, double dx,
-              double dy, double **U, double **V, double **P, double **T, int **Flags)
+              double dy, real **U, real **V, real **P, real **T, flag **Flags)
 {
     
     int i, j;
-    char szFileName[80];
+    char szFileName[MAX_LINE_LENGTH];
+    char szSuffix[32];
     FILE *fp = NULL;
-    sprintf(szFileName, "%s.%i.vtk", szProblem, timeStepNumber);
+    snprintf(szSuffix, sizeof(szSuffix), ".%i.vtk", timeStepNumber);
+    fileName(szFileName, sizeof(szFileName), szProblem, szSuffix);
     fp = fopen(szFileName, "w");
     if (fp == NULL)
     {
-        char szBuff[80];
-        sprintf(szBuff, "Failed to open %s", szFileName);
+        char szBuff[MAX_LINE_LENGTH + 100];
+        snprintf(szBuff, sizeof(szBuff), "Failed to open %s", szFileName);
         ERROR(szBuff);
         return;
     }
@@ -72,8 +85,8 @@ write_vtkFile(const char *szProblem, int timeStepNumber, double xlength, double
     
     if (fclose(fp))
     {
-        char szBuff[80];
-        sprintf(szBuff, "Failed to close %s", szFileName);
+        char szBuff[MAX_LINE_LENGTH + 100];
+        snprintf(szBuff, sizeof(szBuff), "Failed to close %s", szFileName);
         ERROR(szBuff);
     }
 }
@@ -120,3 +133,14 @@ void write_vtkPointCoordinates(FILE *fp, int imax, int jmax,
 }
 
 
+void write_fields(const char *szProblem, int imax, int jmax, double xlength, double ylength,
+                  real **U, real **V, real **P)
+{
+    char szFileName[MAX_LINE_LENGTH];
+    fileName(szFileName, sizeof(szFileName), szProblem, ".U.bin");
+    write_matrix(szFileName, U, 0, imax + 1, 0, jmax + 1, xlength, ylength, 1);
+    fileName(szFileName, sizeof(szFileName), szProblem, ".V.bin");
+    write_matrix(szFileName, V, 0, imax + 1, 0, jmax + 1, xlength, ylength, 1);
+    fileName(szFileName, sizeof(szFileName), szProblem, ".P.bin");
+    write_matrix(szFileName, P, 0, imax + 1, 0, jmax + 1, xlength, ylength, 1);
+}
@@ -1,6 +1,9 @@
 #ifndef __VISUAL_H__
 #define __VISUAL_H__
 
+#include "precision.h"
+#include "flags.h"
+
 /**
  * Method for writing header information in vtk format. 
  * 
@@ -22,7 +25,7 @@
  * @author Tobias Neckel
  */
 void write_vtkFile(const char *szProblem, int timeStepNumber, double xlength, double ylength, int imax, int jmax, double dx,
-                   double dy, double **U, double **V, double **P, double **T, int **Flags);
+                   double dy, real **U, real **V, real **P, real **T, flag **Flags);
 
 /**
  * Method for writing header information in vtk format. 
@@ -52,4 +55,12 @@ void write_vtkHeader( FILE *fp, int imax, int jmax,
 void write_vtkPointCoordinates( FILE *fp, int imax, int jmax, 
                                 double dx, double dy);
 
+/**
+ * Dumps the final U, V and P fields (ghost layer included) with write_matrix()
+ * into the files <szProblem>.U.bin, <szProblem>.V.bin and <szProblem>.P.bin.
+ * These are the fields compared against the golden ones by the regression suite.
+ */
+void write_fields(const char *szProblem, int imax, int jmax, double xlength, double ylength,
+                  real **U, real **V, real **P);
+
 #endif